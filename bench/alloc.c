@@ -0,0 +1,88 @@
+/*
+libactor - A C Actor Library
+alloc.c
+
+Allocations per message. One actor sends a burst of messages with a
+payload of each size to a sink actor, and the allocation counters are read
+before and after to show how many blocks came from the slab, the arena or
+malloc(), and how many calls to malloc() were made per message.
+
+Payloads over 4 KiB do not fit the arena and fall back to malloc().
+
+usage: bench_alloc [messages per size]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, SYNC_MSG, STOP_MSG };
+
+static long messages = 200000;
+static const size_t sizes[] = {16, 256, 4096, 16384};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(sink_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type == SYNC_MSG) actor_reply_msg(msg, SYNC_MSG, NULL, 0);
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    static char payload[16384];
+    actor_alloc_stats_t before, after;
+    actor_id sink = spawn_actor(sink_func, NULL);
+    double start, elapsed;
+    size_t s;
+    long x;
+
+    (void)args;
+    memset(payload, 'x', sizeof(payload));
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        actor_alloc_stats(&before);
+        start = now();
+        for (x = 0; x < messages; x++) actor_send_msg(sink, DATA_MSG, payload, sizes[s]);
+        actor_send_msg(sink, SYNC_MSG, NULL, 0);
+        arelease(actor_receive());
+        elapsed = now() - start;
+        actor_alloc_stats(&after);
+
+        printf("%5zu bytes: %.0f ns/msg, %.2f blocks/msg (slab %.2f, arena %.2f, heap %.2f), %.3f mallocs/msg\n",
+               sizes[s], elapsed * 1e9 / messages, (double)(after.blocks - before.blocks) / messages,
+               (double)(after.slab_blocks - before.slab_blocks) / messages,
+               (double)(after.arena_blocks - before.arena_blocks) / messages,
+               (double)(after.heap_blocks - before.heap_blocks) / messages,
+               (double)(after.mallocs - before.mallocs) / messages);
+    }
+
+    actor_send_msg(sink, STOP_MSG, NULL, 0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) messages = atol(argv[1]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+libactor - A C Actor Library
+batch.c
+
+Producer/consumer throughput with batched sends and receives. The producer
+sends its messages with actor_send_batch() and the consumer drains them
+with actor_receive_batch(), both using the same batch size.
+
+usage: bench_batch [messages per batch size]
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, DONE_MSG };
+
+static long messages = 1000000;
+static const size_t batch_sizes[] = {1, 16, 256};
+
+struct consumer_args {
+    size_t batch;
+    long expected;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    struct consumer_args *ca = (struct consumer_args *)args;
+    actor_msg_t *msgs[256];
+    actor_id producer = NULL;
+    long received = 0;
+    size_t n, x;
+
+    while (received < ca->expected) {
+        n = actor_receive_batch(msgs, ca->batch, 0);
+        for (x = 0; x < n; x++) {
+            producer = msgs[x]->sender;
+            arelease(msgs[x]);
+        }
+        received += n;
+    }
+    actor_send_msg(producer, DONE_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_batch_msg_t batch[256];
+    struct consumer_args ca;
+    actor_id consumer;
+    double start, elapsed;
+    long sent, values[256];
+    size_t b, x, n;
+
+    (void)args;
+    for (b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+        ca.batch = batch_sizes[b];
+        ca.expected = messages;
+        consumer = spawn_actor(consumer_func, &ca);
+
+        start = now();
+        for (sent = 0; sent < messages; sent += n) {
+            n = messages - sent < (long)ca.batch ? (size_t)(messages - sent) : ca.batch;
+            for (x = 0; x < n; x++) {
+                values[x] = sent + x;
+                batch[x].type = DATA_MSG;
+                batch[x].data = &values[x];
+                batch[x].size = sizeof(long);
+            }
+            actor_send_batch(consumer, batch, n);
+        }
+        arelease(actor_receive());
+        elapsed = now() - start;
+
+        printf("batch %3zu: %ld messages in %.3fs, %.0f msgs/s\n", ca.batch, messages, elapsed, messages / elapsed);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) messages = atol(argv[1]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
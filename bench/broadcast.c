@@ -0,0 +1,82 @@
+/*
+libactor - A C Actor Library
+broadcast.c
+
+Broadcast fan-out: handler actors on the worker pool each count the
+broadcasts they receive and acknowledge the last one. Data over
+ACTOR_MSG_INLINE_SIZE bytes is shared by every message of a broadcast.
+
+usage: bench_broadcast [actors] [broadcasts] [size] [workers]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { BROADCAST_MSG = 100, ACK_MSG, STOP_MSG };
+
+static long actors = 10000;
+static long broadcasts = 100;
+static size_t size = 16;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_HANDLER(counter_handler, msg, args) {
+    long *received = (long *)args;
+
+    if (msg->type == STOP_MSG) {
+        free(received);
+        return 1;
+    }
+    if (msg->type == BROADCAST_MSG && ++*received == broadcasts) actor_reply_msg(msg, ACK_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_msg_t *msg;
+    char *data;
+    double start, elapsed;
+    long x;
+
+    (void)args;
+    for (x = 0; x < actors; x++) spawn_actor_handler(counter_handler, calloc(1, sizeof(long)), NULL);
+    data = calloc(1, size > 0 ? size : 1);
+
+    start = now();
+    for (x = 0; x < broadcasts; x++) {
+        actor_broadcast_msg(BROADCAST_MSG, data, size);
+        /* Our own copy */
+        arelease(actor_receive_type(BROADCAST_MSG, 0));
+    }
+    for (x = 0; x < actors; x++) arelease(actor_receive_type(ACK_MSG, 0));
+    elapsed = now() - start;
+    printf("broadcast: %ld broadcasts of %zu bytes to %ld actors in %.3fs, %.0f broadcasts/s, %.0f deliveries/s\n",
+           broadcasts, size, actors, elapsed, broadcasts / elapsed, broadcasts * (actors + 1) / elapsed);
+
+    actor_broadcast_msg(STOP_MSG, NULL, 0);
+    while ((msg = actor_receive_timeout(1)) != NULL) arelease(msg);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned int workers = 0;
+
+    if (argc > 1) actors = atol(argv[1]);
+    if (argc > 2) broadcasts = atol(argv[2]);
+    if (argc > 3) size = (size_t)atol(argv[3]);
+    if (argc > 4) workers = (unsigned int)atoi(argv[4]);
+
+    actor_init_scheduler(workers);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+libactor - A C Actor Library
+fan_in.c
+
+Multi-producer fan-in stress test: many producers flood one consumer,
+while independent producer/consumer pairs run alongside to show that
+sends to different actors do not contend.
+
+usage: bench_fan_in [producers] [messages per producer] [pairs]
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, DONE_MSG };
+
+static long producers = 8;
+static long messages = 100000;
+static long pairs = 4;
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(producer_func, args) {
+    actor_msg_t *msg = actor_receive(); /* the target to flood */
+    actor_id target = *(actor_id *)msg->data;
+    long payload;
+
+    (void)args;
+    arelease(msg);
+    for (payload = 0; payload < messages; payload++) actor_send_msg(target, DATA_MSG, &payload, sizeof(payload));
+    return 0;
+}
+
+/* Counts `expected` messages then reports back */
+ACTOR_FUNCTION(consumer_func, args) {
+    actor_msg_t *msg = actor_receive(); /* who to report to and how many to expect */
+    actor_id report_to = msg->sender;
+    long expected = *(long *)msg->data;
+    long received = 0;
+    double start = now(), elapsed;
+
+    (void)args;
+    arelease(msg);
+    while (received < expected) {
+        msg = actor_receive();
+        if (msg->type == DATA_MSG) received++;
+        arelease(msg);
+    }
+    elapsed = now() - start;
+    actor_send_msg(report_to, DONE_MSG, &elapsed, sizeof(elapsed));
+    return 0;
+}
+
+static actor_id start_consumer(long expected) {
+    actor_id consumer = spawn_actor(consumer_func, NULL);
+    actor_send_msg(consumer, 0, &expected, sizeof(expected));
+    return consumer;
+}
+
+static void start_producer(actor_id target) {
+    actor_id producer = spawn_actor(producer_func, NULL);
+    actor_send_msg(producer, 0, &target, sizeof(target));
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id fan_in;
+    actor_msg_t *msg;
+    long x;
+    double start = now(), elapsed;
+
+    (void)args;
+    fan_in = start_consumer(producers * messages);
+    for (x = 0; x < producers; x++) start_producer(fan_in);
+    for (x = 0; x < pairs; x++) start_producer(start_consumer(messages));
+
+    for (x = 0; x < pairs + 1; x++) {
+        msg = actor_receive();
+        elapsed = *(double *)msg->data;
+        if (msg->sender == fan_in)
+            printf("fan-in: %ld producers x %ld messages in %.3fs, %.0f msgs/s\n", producers, messages, elapsed,
+                   producers * messages / elapsed);
+        else
+            printf("pair: %ld messages in %.3fs, %.0f msgs/s\n", messages, elapsed, messages / elapsed);
+        arelease(msg);
+    }
+    elapsed = now() - start;
+    printf("total: %ld messages in %.3fs, %.0f msgs/s\n", (producers + pairs) * messages, elapsed,
+           (producers + pairs) * messages / elapsed);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) producers = atol(argv[1]);
+    if (argc > 2) messages = atol(argv[2]);
+    if (argc > 3) pairs = atol(argv[3]);
+
+    actor_init();
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+libactor - A C Actor Library
+handlers.c
+
+Many mostly-idle actors on the worker pool: spawns them, reports the
+memory each costs, sends each a message and waits for the replies, then
+stops them. `handlers` spawns stackless handler actors, `tasks` actors
+with a stack of their own of the given size.
+
+usage: bench_handlers handlers|tasks [actors] [rounds] [stack size]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <libactor/actor.h>
+
+enum { PING_MSG = 100, PONG_MSG, STOP_MSG };
+
+static long actors = 1000000;
+static long rounds = 3;
+static const char *mode = "handlers";
+static actor_opts_t opts;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long max_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+ACTOR_HANDLER(session_handler, msg, args) {
+    (void)args;
+    if (msg->type == STOP_MSG) return 1;
+    actor_reply_msg(msg, PONG_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(session_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    while ((msg = actor_receive())->type != STOP_MSG) {
+        actor_reply_msg(msg, PONG_MSG, NULL, 0);
+        arelease(msg);
+    }
+    arelease(msg);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id *ids;
+    double start, elapsed;
+    long rss, x, r;
+
+    (void)args;
+    ids = (actor_id *)malloc(sizeof(actor_id) * actors);
+    actor_trap_exit(1);
+
+    rss = max_rss_kb();
+    start = now();
+    for (x = 0; x < actors; x++) {
+        if (strcmp(mode, "handlers") == 0)
+            ids[x] = spawn_actor_handler(session_handler, NULL, &opts);
+        else
+            ids[x] = spawn_actor_opts(session_func, NULL, &opts);
+    }
+    elapsed = now() - start;
+    printf("%s spawn: %ld actors in %.3fs, %.0f actors/s, %.2f KiB each\n", mode, actors, elapsed,
+           actors / elapsed, (double)(max_rss_kb() - rss) / actors);
+
+    for (r = 0; r < rounds; r++) {
+        start = now();
+        for (x = 0; x < actors; x++) actor_send_msg(ids[x], PING_MSG, NULL, 0);
+        for (x = 0; x < actors; x++) arelease(actor_receive());
+        elapsed = now() - start;
+        printf("%s round %ld: %ld round trips in %.3fs, %.0f round trips/s\n", mode, r + 1, actors, elapsed,
+               actors / elapsed);
+    }
+
+    start = now();
+    for (x = 0; x < actors; x++) actor_send_msg(ids[x], STOP_MSG, NULL, 0);
+    for (x = 0; x < actors; x++) arelease(actor_receive());
+    elapsed = now() - start;
+    printf("%s stop: %ld actors in %.3fs\n", mode, actors, elapsed);
+
+    free(ids);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) mode = argv[1];
+    if (argc > 2) actors = atol(argv[2]);
+    if (argc > 3) rounds = atol(argv[3]);
+    if (argc > 4) opts.stack_size = (size_t)atol(argv[4]);
+
+    if (strcmp(mode, "handlers") != 0 && strcmp(mode, "tasks") != 0) {
+        printf("usage: %s handlers|tasks [actors] [rounds] [stack size]\n", argv[0]);
+        return 1;
+    }
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
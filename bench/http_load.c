@@ -0,0 +1,152 @@
+/*
+libactor - A C Actor Library
+http_load.c
+
+A load generator for examples/http_server.c on the local host. Each
+connection is an actor with a thread of its own that sends keep-alive
+requests one after another and times each response. Prints the request
+rate over all connections and percentiles of the response times.
+
+usage: bench_http_load port [connections] [requests per connection]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libactor/actor.h>
+
+enum { DONE_MSG = 100 };
+
+static int port;
+static long connections = 100;
+static long requests = 1000;
+
+static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+struct result {
+    long completed;
+    uint64_t times[]; /* one per request, in nanoseconds */
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Reads one response with a Content-Length; returns -1 if the connection failed */
+static int read_response(int sock, char *buf, size_t size) {
+    size_t len = 0, head = 0, body = 0;
+    const char *cl;
+    ssize_t ret;
+
+    for (;;) {
+        if ((ret = recv(sock, buf + len, size - 1 - len, 0)) <= 0) return -1;
+        len += ret;
+        buf[len] = 0;
+
+        if (head == 0 && (cl = strstr(buf, "\r\n\r\n")) != NULL) {
+            head = cl + 4 - buf;
+            if ((cl = strstr(buf, "Content-Length:")) != NULL) body = strtoul(cl + 15, NULL, 10);
+        }
+        if (head != 0 && len >= head + body) return len == head + body ? 0 : -1;
+        if (len == size - 1) return -1;
+    }
+}
+
+ACTOR_FUNCTION(client_func, args) {
+    actor_id parent = (actor_id)args;
+    struct result *r = malloc(sizeof(struct result) + requests * sizeof(uint64_t));
+    struct sockaddr_in remote;
+    char buf[4096];
+    uint64_t start;
+    int sock;
+
+    r->completed = 0;
+
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    remote.sin_port = htons(port);
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (connect(sock, (struct sockaddr *)&remote, sizeof(remote)) == 0) {
+        while (r->completed < requests) {
+            start = now_ns();
+            if (send(sock, request, sizeof(request) - 1, 0) != sizeof(request) - 1) break;
+            if (read_response(sock, buf, sizeof(buf)) != 0) break;
+            r->times[r->completed++] = now_ns() - start;
+        }
+    } else {
+        perror("connect");
+    }
+    close(sock);
+
+    actor_send_msg(parent, DONE_MSG, &r, sizeof(r));
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    uint64_t *times = malloc(connections * requests * sizeof(uint64_t));
+    long x, total = 0, failed = 0;
+    actor_msg_t *msg;
+    struct result *r;
+    uint64_t start, elapsed;
+    size_t p;
+
+    (void)args;
+    start = now_ns();
+    for (x = 0; x < connections; x++) spawn_actor(client_func, actor_self());
+
+    for (x = 0; x < connections; x++) {
+        msg = actor_receive_type(DONE_MSG, 0);
+        r = *(struct result **)msg->data;
+        memcpy(times + total, r->times, r->completed * sizeof(uint64_t));
+        total += r->completed;
+        if (r->completed < requests) failed++;
+        free(r);
+        arelease(msg);
+    }
+    elapsed = now_ns() - start;
+
+    printf("%ld connections, %ld requests in %.2f s: %.0f requests/s\n", connections, total, elapsed / 1e9,
+           total / (elapsed / 1e9));
+    if (failed > 0) printf("%ld connections failed early\n", failed);
+
+    if (total > 0) {
+        qsort(times, total, sizeof(uint64_t), compare);
+        for (p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+            printf("p%-5g %9.1f us\n", percentiles[p], times[(long)(percentiles[p] / 100 * (total - 1))] / 1e3);
+    }
+
+    free(times);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s port [connections] [requests per connection]\n", argv[0]);
+        return 1;
+    }
+    port = atoi(argv[1]);
+    if (argc > 2) connections = atol(argv[2]);
+    if (argc > 3) requests = atol(argv[3]);
+
+    actor_init();
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+libactor - A C Actor Library
+ping_pong.c
+
+Round-trip latency between two actors. One actor sends a message to an
+echo actor and waits for the reply, timing each round trip, and prints a
+histogram of the times in power-of-two buckets with the percentiles. The
+receiver that waits is woken by each send, so this measures the parking
+and waking paths rather than queueing.
+
+usage: bench_ping_pong threads|tasks [round trips]
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { PING_MSG = 100, STOP_MSG };
+
+#define BUCKETS 40
+
+static long round_trips = 200000;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+ACTOR_FUNCTION(echo_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        actor_reply_msg(msg, PING_MSG, NULL, 0);
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    uint64_t *times = malloc(round_trips * sizeof(uint64_t));
+    long histogram[BUCKETS] = {0}, x, max = 0;
+    actor_id echo = spawn_actor(echo_func, NULL);
+    uint64_t start, total = 0;
+    int b, first = BUCKETS, last = 0;
+    size_t p;
+
+    (void)args;
+    /* Let the echo actor start and settle before timing */
+    for (x = 0; x < 1000; x++) {
+        actor_send_msg(echo, PING_MSG, NULL, 0);
+        arelease(actor_receive());
+    }
+
+    for (x = 0; x < round_trips; x++) {
+        start = now_ns();
+        actor_send_msg(echo, PING_MSG, NULL, 0);
+        arelease(actor_receive());
+        times[x] = now_ns() - start;
+        total += times[x];
+
+        for (b = 0; b < BUCKETS - 1 && times[x] >= (2ull << b); b++) continue;
+        histogram[b]++;
+    }
+    actor_send_msg(echo, STOP_MSG, NULL, 0);
+
+    for (b = 0; b < BUCKETS; b++) {
+        if (histogram[b] == 0) continue;
+        if (b < first) first = b;
+        last = b;
+        if (histogram[b] > max) max = histogram[b];
+    }
+
+    printf("%ld round trips, mean %.0f ns\n", round_trips, (double)total / round_trips);
+    for (b = first; b <= last; b++) {
+        printf("%10llu ns %9ld |%.*s\n", 1ull << b, histogram[b], (int)(histogram[b] * 50 / max),
+               "##################################################");
+    }
+
+    qsort(times, round_trips, sizeof(uint64_t), compare);
+    for (p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+        printf("p%-5g %9llu ns\n", percentiles[p],
+               (unsigned long long)times[(long)(percentiles[p] / 100 * (round_trips - 1))]);
+
+    free(times);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "threads";
+
+    if (argc > 2) round_trips = atol(argv[2]);
+
+    if (strcmp(mode, "tasks") == 0) {
+        actor_init_scheduler(0);
+    } else if (strcmp(mode, "threads") == 0) {
+        actor_init();
+    } else {
+        printf("usage: %s threads|tasks [round trips]\n", argv[0]);
+        return 1;
+    }
+
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
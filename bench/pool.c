@@ -0,0 +1,197 @@
+/*
+libactor - A C Actor Library
+pool.c
+
+Load balancing over a pool of workers with skewed work. A source sends
+requests at a steady rate, about 70% of what the workers can serve, to a
+pool made with spawn_actor_pool() under each strategy, and the workers
+reply with how long each request took from its send to its end. Three
+kinds of skew:
+
+  heavy tail   one request in 20 takes 20 times as long as the rest
+  slow worker  one of the workers takes 4 times as long as the others
+  hot keys     requests carry keys drawn from a Zipf distribution
+
+A request's work is a sleep, as a worker waiting on I/O would, so the
+workers run in parallel even on one CPU. Round-robin queues work behind
+a busy worker; the strategies that look at mailbox depths do not.
+Hashing keeps each key on one worker, and with hot keys one worker gets
+more than its share.
+
+usage: bench_pool [requests] [workers] [service us]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { REQUEST_MSG = 100, REPLY_MSG, STOP_MSG };
+enum { HEAVY_TAIL, SLOW_WORKER, HOT_KEYS, SCENARIOS };
+
+static const char *scenario_names[SCENARIOS] = {"heavy tail", "slow worker", "hot keys"};
+static const char *strategy_names[] = {"round-robin", "least depth", "hash", "two choices"};
+
+#define KEYS 1000
+#define LOAD 0.7
+
+static long requests = 4000;
+static long workers = 8;
+static long service_us = 200;
+
+static double zipf[KEYS]; /* cumulative */
+
+struct request {
+    double sent;
+    long work_us;
+};
+
+struct run {
+    int scenario;
+    atomic_int started;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void serve(long us) {
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static unsigned long zipf_key(unsigned int *seed) {
+    double u = rand_r(seed) / (RAND_MAX + 1.0);
+    size_t low = 0, high = KEYS - 1, mid;
+
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (zipf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+ACTOR_FUNCTION(worker_func, args) {
+    struct run *run = (struct run *)args;
+    const struct request *req;
+    actor_msg_t *msg;
+    double latency;
+    int slow = run->scenario == SLOW_WORKER && atomic_fetch_add(&run->started, 1) == 0;
+
+    while ((msg = actor_receive())->type != STOP_MSG) {
+        if (msg->type == REQUEST_MSG) {
+            req = (const struct request *)msg->data;
+            serve(slow ? req->work_us * 4 : req->work_us);
+            latency = now() - req->sent;
+            actor_reply_msg(msg, REPLY_MSG, &latency, sizeof(latency));
+        }
+        arelease(msg);
+    }
+    arelease(msg);
+    return 0;
+}
+
+static void run_pool(int scenario, int strategy) {
+    struct run run = {scenario, 0};
+    struct request req;
+    struct timespec tick;
+    actor_msg_t *msg;
+    actor_id pool;
+    double *latencies, capacity, per_tick, due = 0, start, elapsed, sum = 0;
+    unsigned int seed = 1;
+    long sent = 0, x;
+
+    /* Requests per second the pool can serve */
+    if (scenario == HEAVY_TAIL)
+        capacity = workers / (service_us * (0.95 + 0.05 * 20) / 1e6);
+    else if (scenario == SLOW_WORKER)
+        capacity = (workers - 1 + 0.25) / (service_us / 1e6);
+    else
+        capacity = workers / (service_us / 1e6);
+    per_tick = LOAD * capacity / 1000;
+
+    latencies = (double *)malloc(sizeof(double) * requests);
+    pool = spawn_actor_pool(worker_func, &run, (unsigned int)workers, strategy);
+
+    start = now();
+    clock_gettime(CLOCK_MONOTONIC, &tick);
+    while (sent < requests) {
+        for (due += per_tick; due >= 1 && sent < requests; due--, sent++) {
+            req.sent = now();
+            req.work_us = scenario == HEAVY_TAIL && rand_r(&seed) % 20 == 0 ? service_us * 20 : service_us;
+            actor_send_key_msg(pool, scenario == HOT_KEYS ? zipf_key(&seed) : (unsigned long)rand_r(&seed),
+                               REQUEST_MSG, &req, sizeof(req));
+        }
+        /* A millisecond per tick */
+        if ((tick.tv_nsec += 1000000) >= 1000000000) {
+            tick.tv_sec++;
+            tick.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
+    }
+    for (x = 0; x < requests; x++) {
+        msg = actor_receive_type(REPLY_MSG, 0);
+        memcpy(&latencies[x], msg->data, sizeof(double));
+        sum += latencies[x];
+        arelease(msg);
+    }
+    elapsed = now() - start;
+
+    /* Every actor but the pool itself gets the broadcast, this one too */
+    actor_broadcast_msg(STOP_MSG, NULL, 0);
+    arelease(actor_receive_type(ACTOR_MSG_EXITED, 0));
+    arelease(actor_receive_type(STOP_MSG, 0));
+
+    qsort(latencies, requests, sizeof(double), compare);
+    printf("%-12s %-12s %8.3f %10.2f %10.2f %10.2f %10.2f\n", scenario_names[scenario], strategy_names[strategy],
+           elapsed, sum / requests * 1e3, latencies[requests / 2] * 1e3, latencies[requests * 99 / 100] * 1e3,
+           latencies[requests - 1] * 1e3);
+    free(latencies);
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    int scenario, strategy;
+
+    (void)args;
+    actor_trap_exit(1);
+
+    printf("%ld requests of %ld us to %ld workers at %.0f%% load\n", requests, service_us, workers, LOAD * 100);
+    printf("%-12s %-12s %8s %10s %10s %10s %10s\n", "skew", "strategy", "s", "mean ms", "p50 ms", "p99 ms",
+           "max ms");
+    for (scenario = 0; scenario < SCENARIOS; scenario++) {
+        for (strategy = ACTOR_POOL_ROUND_ROBIN; strategy <= ACTOR_POOL_TWO_CHOICES; strategy++)
+            run_pool(scenario, strategy);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double total = 0;
+    int x;
+
+    if (argc > 1) requests = atol(argv[1]);
+    if (argc > 2) workers = atol(argv[2]);
+    if (argc > 3) service_us = atol(argv[3]);
+
+    for (x = 0; x < KEYS; x++) total += zipf[x] = 1.0 / (x + 1);
+    for (x = 0; x < KEYS; x++) zipf[x] = (x > 0 ? zipf[x - 1] : 0) + zipf[x] / total;
+
+    actor_init();
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
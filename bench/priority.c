@@ -0,0 +1,171 @@
+/*
+libactor - A C Actor Library
+priority.c
+
+Control message latency behind a saturated mailbox. A producer keeps
+between one and two windows of bulk messages queued for a consumer that
+does a little work per message, while a controller sends a control
+message every millisecond. The control messages are sent once in the
+normal lane, behind the bulk data, and once in the urgent lane.
+
+Each control message carries the number of bulk messages the consumer
+had taken when it was sent, so the consumer can tell how many it took
+ahead of it. That depends only on the order of the mailbox. The time
+from send to receive also depends on when the scheduler runs the
+controller and the consumer. A worker runs the consumer for as long as
+its mailbox holds messages, so on a single worker the controller only
+gets to send once the bulk data has been taken: neither lane has
+anything to overtake, and the times are those of the run queue. Use two
+workers or more to compare the lanes.
+
+usage: bench_priority [control messages] [window] [workers]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { BULK_MSG = 100, ACK_MSG, CONTROL_MSG, DONE_MSG };
+
+static long controls = 1000;
+static long window = 10000;
+static unsigned int workers = 0;
+
+struct run {
+    int priority;
+    actor_id consumer;
+    atomic_long taken; /* bulk messages the consumer has taken */
+    double *latencies;
+    double *ahead;
+};
+
+struct control {
+    double sent;
+    long taken;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+ACTOR_FUNCTION(producer_func, args) {
+    struct run *run = (struct run *)args;
+    actor_msg_t *msg;
+    long x, value = 0;
+
+    for (x = 0; x < 2 * window; x++, value++) actor_send_msg(run->consumer, BULK_MSG, &value, sizeof(value));
+
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type != ACK_MSG) {
+            arelease(msg);
+            break;
+        }
+        arelease(msg);
+        for (x = 0; x < window; x++, value++) actor_send_msg(run->consumer, BULK_MSG, &value, sizeof(value));
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(controller_func, args) {
+    struct run *run = (struct run *)args;
+    struct control control;
+    long x;
+
+    for (x = 0; x < controls; x++) {
+        actor_msg_t *pause = actor_receive_timeout(1);
+        if (pause != NULL) arelease(pause);
+        control.taken = atomic_load_explicit(&run->taken, memory_order_relaxed);
+        control.sent = now();
+        actor_send_priority_msg(run->consumer, run->priority, CONTROL_MSG, &control, sizeof(control));
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    struct run *run = (struct run *)args;
+    volatile unsigned long work = 0;
+    actor_id producer = NULL;
+    actor_msg_t *msg;
+    long bulk = 0, received = 0, x;
+
+    while (received < controls) {
+        msg = actor_receive();
+        if (msg->type == CONTROL_MSG) {
+            const struct control *control = (const struct control *)msg->data;
+            run->latencies[received] = now() - control->sent;
+            run->ahead[received++] = bulk - control->taken;
+        } else {
+            producer = msg->sender;
+            atomic_store_explicit(&run->taken, ++bulk, memory_order_relaxed);
+            for (x = 0; x < 200; x++) work += x;
+            if (bulk % window == 0) actor_send_msg(producer, ACK_MSG, NULL, 0);
+        }
+        arelease(msg);
+    }
+    actor_send_msg(producer, DONE_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    static const int priorities[] = {ACTOR_PRIORITY_NORMAL, ACTOR_PRIORITY_URGENT};
+    static const char *names[] = {"normal", "urgent"};
+    struct run run;
+    actor_msg_t *msg;
+    size_t p;
+
+    (void)args;
+    actor_trap_exit(1);
+    run.latencies = (double *)malloc(controls * sizeof(double));
+    run.ahead = (double *)malloc(controls * sizeof(double));
+
+    for (p = 0; p < sizeof(priorities) / sizeof(priorities[0]); p++) {
+        run.priority = priorities[p];
+        atomic_store(&run.taken, 0);
+        run.consumer = spawn_actor(consumer_func, &run);
+        spawn_actor(producer_func, &run);
+        spawn_actor(controller_func, &run);
+
+        /* Wait for the consumer, producer and controller to exit */
+        for (int exited = 0; exited < 3;) {
+            msg = actor_receive();
+            if (msg->type == ACTOR_MSG_EXITED) exited++;
+            arelease(msg);
+        }
+
+        qsort(run.latencies, controls, sizeof(double), compare_doubles);
+        qsort(run.ahead, controls, sizeof(double), compare_doubles);
+        printf("%s lane: bulk messages taken ahead p50 %6.0f, p99 %6.0f, max %6.0f; "
+               "time p50 %8.1f us, p99 %8.1f us, max %8.1f us\n",
+               names[p], run.ahead[controls / 2], run.ahead[controls * 99 / 100], run.ahead[controls - 1],
+               run.latencies[controls / 2] * 1e6, run.latencies[controls * 99 / 100] * 1e6,
+               run.latencies[controls - 1] * 1e6);
+    }
+
+    free(run.latencies);
+    free(run.ahead);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) controls = atol(argv[1]);
+    if (argc > 2) window = atol(argv[2]);
+    if (argc > 3) workers = (unsigned int)atol(argv[3]);
+
+    actor_init_scheduler(workers);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+libactor - A C Actor Library
+scaling.c
+
+Messaging throughput as the number of busy cores grows. Independent
+producer/consumer pairs stream messages through bounded mailboxes, with
+1, 2, 4, ... pairs up to the maximum, so each doubling should add cores
+rather than contention: the pairs share no actors, only the library.
+Run in threads mode each pair occupies two threads; in tasks mode use as
+many workers as cores.
+
+usage: bench_scaling threads|tasks [max pairs] [messages per pair]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, DONE_MSG };
+
+static long max_pairs = 64;
+static long messages = 200000;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    actor_id bench = (actor_id)args;
+    long received = 0, sum = 0;
+    actor_msg_t *msg;
+
+    while (received < messages) {
+        msg = actor_receive();
+        sum += *(const long *)msg->data;
+        received++;
+        arelease(msg);
+    }
+    actor_send_msg(bench, DONE_MSG, &sum, sizeof(sum));
+    return 0;
+}
+
+ACTOR_FUNCTION(producer_func, args) {
+    actor_id consumer = (actor_id)args;
+    long x;
+
+    for (x = 0; x < messages; x++) actor_send_msg(consumer, DATA_MSG, &x, sizeof(x));
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_opts_t opts = {.mailbox_capacity = 1024, .mailbox_overflow = ACTOR_OVERFLOW_BLOCK};
+    double start, elapsed, base = 0;
+    actor_id consumer;
+    long pairs, x;
+
+    (void)args;
+    for (pairs = 1; pairs <= max_pairs; pairs *= 2) {
+        start = now();
+        for (x = 0; x < pairs; x++) {
+            consumer = spawn_actor_opts(consumer_func, actor_self(), &opts);
+            spawn_actor(producer_func, consumer);
+        }
+        for (x = 0; x < pairs; x++) arelease(actor_receive_type(DONE_MSG, 0));
+        elapsed = now() - start;
+
+        if (pairs == 1) base = messages / elapsed;
+        printf("%3ld pairs: %10.0f msgs/s total, %9.0f per pair, speedup %5.2f\n", pairs, pairs * messages / elapsed,
+               messages / elapsed, pairs * messages / elapsed / base);
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "threads";
+
+    if (argc > 2) max_pairs = atol(argv[2]);
+    if (argc > 3) messages = atol(argv[3]);
+
+    if (strcmp(mode, "tasks") == 0) {
+        actor_init_scheduler(0);
+    } else if (strcmp(mode, "threads") == 0) {
+        actor_init();
+    } else {
+        printf("usage: %s threads|tasks [max pairs] [messages per pair]\n", argv[0]);
+        return 1;
+    }
+
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+libactor - A C Actor Library
+scheduler.c
+
+Compares the thread-per-actor model with the M:N scheduler:
+spawn/exit rate and ping-pong round trips per second.
+
+usage: bench_scheduler threads|tasks [workers] [spawns] [round trips]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { PING_MSG = 100, PONG_MSG, STOP_MSG };
+
+static long spawns = 10000;
+static long round_trips = 100000;
+static const char *mode = "threads";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(noop_func, args) {
+    (void)args;
+    return 0;
+}
+
+ACTOR_FUNCTION(pong_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        actor_reply_msg(msg, PONG_MSG, NULL, 0);
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id pong;
+    double start, elapsed;
+    long x;
+
+    (void)args;
+    /* Spawn/exit */
+    actor_trap_exit(1);
+    start = now();
+    for (x = 0; x < spawns; x++) spawn_actor(noop_func, NULL);
+    for (x = 0; x < spawns; x++) arelease(actor_receive());
+    elapsed = now() - start;
+    printf("%s spawn: %ld actors in %.3fs, %.0f actors/s\n", mode, spawns, elapsed, spawns / elapsed);
+    actor_trap_exit(0);
+
+    /* Ping-pong */
+    pong = spawn_actor(pong_func, NULL);
+    start = now();
+    for (x = 0; x < round_trips; x++) {
+        actor_send_msg(pong, PING_MSG, NULL, 0);
+        arelease(actor_receive());
+    }
+    elapsed = now() - start;
+    printf("%s ping-pong: %ld round trips in %.3fs, %.0f round trips/s\n", mode, round_trips, elapsed,
+           round_trips / elapsed);
+    actor_send_msg(pong, STOP_MSG, NULL, 0);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned int workers = 0;
+
+    if (argc > 1) mode = argv[1];
+    if (argc > 2) workers = (unsigned int)atoi(argv[2]);
+    if (argc > 3) spawns = atol(argv[3]);
+    if (argc > 4) round_trips = atol(argv[4]);
+
+    if (strcmp(mode, "tasks") == 0) {
+        actor_init_scheduler(workers);
+    } else if (strcmp(mode, "threads") == 0) {
+        actor_init();
+    } else {
+        printf("usage: %s threads|tasks [workers] [spawns] [round trips]\n", argv[0]);
+        return 1;
+    }
+
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
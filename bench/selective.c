@@ -0,0 +1,99 @@
+/*
+libactor - A C Actor Library
+selective.c
+
+Selective receive behind a backlog. The consumer's mailbox is filled with
+unrelated messages first, then with requests; the consumer takes the
+requests with actor_receive_type() and the interleaved replies with
+actor_receive_match(), then drains the backlog in order. The cost per
+selective receive should not grow with the backlog.
+
+usage: bench_selective [requests per backlog size]
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { FILLER_MSG = 100, REQUEST_MSG, REPLY_MSG, GO_MSG };
+
+static long requests = 100000;
+static const long backlogs[] = {0, 1000, 100000};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_request_or_reply(long type, void *arg) {
+    (void)arg;
+    return type == REQUEST_MSG || type == REPLY_MSG;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    long backlog = *(long *)args;
+    actor_msg_t *msg;
+    actor_id producer;
+    double start, typed, matched;
+    long x, expect;
+
+    msg = actor_receive_type(GO_MSG, 0);
+    producer = msg->sender;
+    arelease(msg);
+
+    start = now();
+    for (x = 0; x < requests; x++) arelease(actor_receive_type(REQUEST_MSG, 0));
+    typed = now() - start;
+
+    start = now();
+    for (x = 0; x < requests; x++) arelease(actor_receive_match(is_request_or_reply, NULL, 0));
+    matched = now() - start;
+
+    /* The backlog must come out in the order it was sent */
+    for (expect = 0; expect < backlog; expect++) {
+        msg = actor_receive();
+        if (msg->type != FILLER_MSG || *(const long *)msg->data != expect) {
+            printf("backlog out of order at %ld\n", expect);
+            break;
+        }
+        arelease((void *)msg->data);
+        arelease(msg);
+    }
+
+    printf("backlog %6ld: receive_type %5.0f ns/msg, receive_match %5.0f ns/msg\n", backlog, typed * 1e9 / requests,
+           matched * 1e9 / requests);
+    actor_send_msg(producer, GO_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id consumer;
+    long backlog, b, x;
+
+    (void)args;
+    for (b = 0; b < (long)(sizeof(backlogs) / sizeof(backlogs[0])); b++) {
+        backlog = backlogs[b];
+        consumer = spawn_actor(consumer_func, &backlog);
+
+        for (x = 0; x < backlog; x++) actor_send_msg(consumer, FILLER_MSG, &x, sizeof(x));
+        for (x = 0; x < requests; x++) actor_send_msg(consumer, REQUEST_MSG, NULL, 0);
+        for (x = 0; x < requests; x++) actor_send_msg(consumer, x % 2 ? REQUEST_MSG : REPLY_MSG, NULL, 0);
+        actor_send_msg(consumer, GO_MSG, NULL, 0);
+
+        arelease(actor_receive_type(GO_MSG, 0));
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) requests = atol(argv[1]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+libactor - A C Actor Library
+send_latency.c
+
+Send latency as the number of live actors grows. Idle actors are spawned
+in steps from 10 up to the maximum, and at each step one actor sends a
+burst of messages to a sink actor. Every actor acknowledges its spawn
+before it waits, so the clock only starts once they are all parked and
+the burst does not also time the scheduler starting them.
+
+The actors run on the M:N scheduler. Each task stack takes two mappings,
+so past about 32k actors Linux needs a higher vm.max_map_count; the
+benchmark stops at the first spawn that fails.
+
+usage: bench_send_latency [max actors] [sends per step]
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, SYNC_MSG, STOP_MSG, READY_MSG };
+
+static long max_actors = 10000;
+static long sends = 100000;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(idle_func, args) {
+    actor_send_msg((actor_id)args, READY_MSG, NULL, 0);
+    arelease(actor_receive());
+    return 0;
+}
+
+ACTOR_FUNCTION(sink_func, args) {
+    actor_msg_t *msg;
+
+    actor_send_msg((actor_id)args, READY_MSG, NULL, 0);
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type == SYNC_MSG) actor_reply_msg(msg, SYNC_MSG, NULL, 0);
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id *idle = (actor_id *)malloc(sizeof(actor_id) * max_actors);
+    actor_id sink;
+    long live = 0, step, x;
+    double start, elapsed;
+
+    (void)args;
+    for (step = 10; step <= max_actors; step *= 10) {
+        for (; live < step; live++) {
+            if ((idle[live] = spawn_actor(idle_func, actor_self())) == NULL) break;
+            arelease(actor_receive_type(READY_MSG, 0));
+        }
+        if (live < step || (sink = spawn_actor(sink_func, actor_self())) == NULL) {
+            printf("cannot spawn more than %ld actors: %s\n", live, strerror(errno));
+            break;
+        }
+        arelease(actor_receive_type(READY_MSG, 0));
+        start = now();
+        for (x = 0; x < sends; x++) actor_send_msg(sink, DATA_MSG, &x, sizeof(x));
+        actor_send_msg(sink, SYNC_MSG, NULL, 0);
+        arelease(actor_receive_type(SYNC_MSG, 0));
+        elapsed = now() - start;
+        actor_send_msg(sink, STOP_MSG, NULL, 0);
+
+        printf("%ld actors: %ld sends in %.3fs, %.0f ns/send\n", live, sends, elapsed, elapsed * 1e9 / sends);
+    }
+
+    for (x = 0; x < live; x++) actor_send_msg(idle[x], STOP_MSG, NULL, 0);
+    free(idle);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) max_actors = atol(argv[1]);
+    if (argc > 2) sends = atol(argv[2]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+libactor - A C Actor Library
+small_msg.c
+
+Round-trip latency and allocations for small messages. One actor sends a
+payload of each size to an echo actor and waits for the echo, and the
+allocation counters are read before and after each run.
+
+usage: bench_small_msg [round trips per size]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { PING_MSG = 100, STOP_MSG };
+
+static long round_trips = 200000;
+static const size_t sizes[] = {0, 8, 16, 32, 64, 128};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(echo_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    for (;;) {
+        msg = actor_receive();
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        actor_reply_msg(msg, PING_MSG, (void *)msg->data, msg->size);
+        arelease((void *)msg->data);
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    char payload[128];
+    actor_alloc_stats_t before, after;
+    actor_id echo = spawn_actor(echo_func, NULL);
+    actor_msg_t *msg;
+    double start, elapsed;
+    size_t s;
+    long x;
+
+    (void)args;
+    memset(payload, 'x', sizeof(payload));
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        actor_alloc_stats(&before);
+        start = now();
+        for (x = 0; x < round_trips; x++) {
+            actor_send_msg(echo, PING_MSG, payload, sizes[s]);
+            msg = actor_receive();
+            arelease((void *)msg->data);
+            arelease(msg);
+        }
+        elapsed = now() - start;
+        actor_alloc_stats(&after);
+
+        printf("%4zu bytes: %.0f ns/round trip, %.2f blocks/round trip, %.3f mallocs/round trip\n", sizes[s],
+               elapsed * 1e9 / round_trips, (double)(after.blocks - before.blocks) / round_trips,
+               (double)(after.mallocs - before.mallocs) / round_trips);
+    }
+
+    actor_send_msg(echo, STOP_MSG, NULL, 0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) round_trips = atol(argv[1]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
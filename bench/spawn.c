@@ -0,0 +1,86 @@
+/*
+libactor - A C Actor Library
+spawn.c
+
+Spawn/exit churn: actors that exit straight away, spawned one at a time
+(the spawner waits for each exit notification, so this is the latency of a
+spawn) and then in bursts of 100. With `cached`, threads are started
+ahead with actor_prespawn_threads(); threads are cached either way once
+the first actors exit.
+
+usage: bench_spawn threads|cached|tasks [spawns] [stack size]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+#define BURST 100
+
+static long spawns = 20000;
+static const char *mode = "threads";
+static actor_opts_t opts;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(noop_func, args) {
+    (void)args;
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    double start, elapsed;
+    long x, y;
+
+    (void)args;
+    actor_trap_exit(1);
+
+    start = now();
+    for (x = 0; x < spawns; x++) {
+        spawn_actor_opts(noop_func, NULL, &opts);
+        arelease(actor_receive());
+    }
+    elapsed = now() - start;
+    printf("%s one at a time: %ld actors in %.3fs, %.0f actors/s, %.2fus per spawn and exit\n", mode, spawns,
+           elapsed, spawns / elapsed, elapsed * 1e6 / spawns);
+
+    start = now();
+    for (x = 0; x < spawns; x += BURST) {
+        for (y = 0; y < BURST; y++) spawn_actor_opts(noop_func, NULL, &opts);
+        for (y = 0; y < BURST; y++) arelease(actor_receive());
+    }
+    elapsed = now() - start;
+    printf("%s bursts of %d: %ld actors in %.3fs, %.0f actors/s\n", mode, BURST, x, elapsed, x / elapsed);
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) mode = argv[1];
+    if (argc > 2) spawns = atol(argv[2]);
+    if (argc > 3) opts.stack_size = (size_t)atol(argv[3]);
+
+    if (strcmp(mode, "tasks") == 0) {
+        actor_init_scheduler(0);
+    } else if (strcmp(mode, "threads") == 0) {
+        actor_init();
+    } else if (strcmp(mode, "cached") == 0) {
+        actor_init();
+        actor_prespawn_threads(BURST / 2, opts.stack_size);
+    } else {
+        printf("usage: %s threads|cached|tasks [spawns] [stack size]\n", argv[0]);
+        return 1;
+    }
+
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
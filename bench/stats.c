@@ -0,0 +1,101 @@
+/*
+libactor - A C Actor Library
+stats.c
+
+Finding the bottleneck of a pipeline. A source feeds messages through a
+chain of stages, one of which does more work per message than the rest,
+and prints actor_stats_dump() at the end: the slow stage is the one with
+the deep mailbox and the long times queued. Also prints the throughput,
+so builds with and without ACTOR_STATS can be compared for overhead.
+
+usage: bench_stats [messages] [stages] [slow stage]
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, DONE_MSG };
+
+static long messages = 200000;
+static long stages = 4;
+static long slow = 2;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct stage {
+    actor_id next;
+    long work; /* spins per message */
+};
+
+ACTOR_FUNCTION(stage_func, args) {
+    struct stage *stage = (struct stage *)args;
+    actor_msg_t *msg;
+    volatile long spin;
+    long y;
+
+    while ((msg = actor_receive())->type == DATA_MSG) {
+        for (y = 0; y < stage->work; y++) spin = y;
+        actor_send_msg(stage->next, DATA_MSG, (void *)msg->data, msg->size);
+        arelease(msg);
+    }
+    /* Pass the end along */
+    actor_send_msg(stage->next, DONE_MSG, NULL, 0);
+    arelease(msg);
+    (void)spin;
+    free(stage);
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_stats_t stats;
+    struct stage *stage;
+    actor_id first;
+    double start, elapsed;
+    long x;
+    char data[32] = {0};
+
+    (void)args;
+    first = actor_self();
+    for (x = stages - 1; x >= 0; x--) {
+        stage = malloc(sizeof(struct stage));
+        stage->next = first;
+        stage->work = x == slow ? 2000 : 0;
+        first = spawn_actor(stage_func, stage);
+    }
+
+    start = now();
+    for (x = 0; x < messages; x++) actor_send_msg(first, DATA_MSG, data, sizeof(data));
+    for (x = 0; x < messages; x++) arelease(actor_receive());
+    elapsed = now() - start;
+    printf("%ld messages through %ld stages in %.3fs, %.0f messages/s\n", messages, stages, elapsed,
+           messages / elapsed);
+
+    if (actor_stats_get(actor_self(), &stats) == ENOTSUP)
+        printf("built without ACTOR_STATS\n");
+    else
+        actor_stats_dump(stdout);
+
+    actor_send_msg(first, DONE_MSG, NULL, 0);
+    arelease(actor_receive_type(DONE_MSG, 0));
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) messages = atol(argv[1]);
+    if (argc > 2) stages = atol(argv[2]);
+    if (argc > 3) slow = atol(argv[3]);
+
+    actor_init();
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
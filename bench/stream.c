@@ -0,0 +1,207 @@
+/*
+libactor - A C Actor Library
+stream.c
+
+Requests per second from a loopback HTTP server on the worker pool, with
+the connections served either by a message per read from actor_io_read(),
+as examples/http_server.c did before it used streams, or by a buffered
+stream. The load comes from threads of the benchmark's own, each sending
+keep-alive requests one after another on a connection of its own.
+
+usage: bench_stream read|stream [connections] [requests per connection]
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libactor/actor.h>
+#include <libactor/stream.h>
+
+enum { STOP_MSG = 100 };
+
+#define REQUEST_MAX 8192
+
+static long connections = 100;
+static long requests = 2000;
+static int use_stream;
+static atomic_int port;
+
+static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 15\r\n"
+    "\r\n"
+    "Hello, World!\r\n";
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The length of the request head in `buf`, or 0 if it is not all there */
+static size_t request_end(const char *buf, size_t len) {
+    for (size_t x = 3; x < len; x++) {
+        if (buf[x - 3] == '\r' && buf[x - 2] == '\n' && buf[x - 1] == '\r' && buf[x] == '\n') return x + 1;
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(read_client, args) {
+    int sock = (int)(intptr_t)args;
+    char *buf = amalloc(REQUEST_MAX);
+    const actor_io_event_t *ev;
+    actor_msg_t *msg;
+    size_t len = 0, end;
+
+    while (actor_io_read(sock, 512) == 0) {
+        msg = actor_receive_type(ACTOR_MSG_IO_READ, 0);
+        ev = (const actor_io_event_t *)msg->data;
+        if (ev->length == 0 || len + ev->length > REQUEST_MAX) {
+            arelease((void *)msg->data);
+            arelease(msg);
+            break;
+        }
+        memcpy(buf + len, ev->data, ev->length);
+        len += ev->length;
+        arelease((void *)msg->data);
+        arelease(msg);
+
+        while ((end = request_end(buf, len)) != 0) {
+            send(sock, response, sizeof(response) - 1, 0);
+            memmove(buf, buf + end, len - end);
+            len -= end;
+        }
+    }
+
+    arelease(buf);
+    close(sock);
+    return 0;
+}
+
+ACTOR_FUNCTION(stream_client, args) {
+    actor_stream_t *s = actor_stream_open((int)(intptr_t)args);
+    const char *line;
+    size_t len;
+
+    while ((line = actor_stream_read_line(s, &len, 0)) != NULL) {
+        if (len > 0) continue;
+        if (actor_stream_write(s, response, sizeof(response) - 1, 0) != 0) break;
+        if (actor_stream_buffered(s) == 0 && actor_stream_flush(s, 0) != 0) break;
+    }
+
+    actor_stream_close(s);
+    return 0;
+}
+
+ACTOR_FUNCTION(listener_func, args) {
+    struct sockaddr_in local;
+    socklen_t socklen = sizeof(local);
+    actor_msg_t *msg;
+    int sockfd, clientsock, stop = 0;
+
+    (void)args;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    bind(sockfd, (struct sockaddr *)&local, sizeof(local));
+    listen(sockfd, SOMAXCONN);
+    getsockname(sockfd, (struct sockaddr *)&local, &socklen);
+    atomic_store(&port, ntohs(local.sin_port));
+
+    while (!stop && actor_io_watch(sockfd, ACTOR_IO_READ) == 0) {
+        msg = actor_receive();
+        if (msg->type == STOP_MSG) {
+            actor_io_unwatch(sockfd);
+            stop = 1;
+        }
+        arelease(msg);
+        while ((clientsock = accept(sockfd, NULL, NULL)) != -1)
+            spawn_actor(use_stream ? stream_client : read_client, (void *)(intptr_t)clientsock);
+    }
+
+    close(sockfd);
+    return 0;
+}
+
+static void *load_thread(void *arg) {
+    long *completed = (long *)arg;
+    struct sockaddr_in remote;
+    char buf[4096];
+    size_t len;
+    ssize_t ret;
+    int sock;
+
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    remote.sin_port = htons(atomic_load(&port));
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (connect(sock, (struct sockaddr *)&remote, sizeof(remote)) == 0) {
+        for (*completed = 0; *completed < requests; (*completed)++) {
+            if (send(sock, request, sizeof(request) - 1, 0) != sizeof(request) - 1) break;
+            for (len = 0; len < sizeof(response) - 1; len += ret) {
+                if ((ret = recv(sock, buf + len, sizeof(buf) - len, 0)) <= 0) break;
+            }
+            if (len != sizeof(response) - 1) break;
+        }
+    }
+    close(sock);
+
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "stream";
+    pthread_t *threads;
+    long *completed, x, total = 0;
+    actor_id listener;
+    uint64_t start, elapsed;
+
+    if (argc > 2) connections = atol(argv[2]);
+    if (argc > 3) requests = atol(argv[3]);
+
+    if (strcmp(mode, "stream") == 0) {
+        use_stream = 1;
+    } else if (strcmp(mode, "read") != 0) {
+        printf("usage: %s read|stream [connections] [requests per connection]\n", argv[0]);
+        return 1;
+    }
+
+    actor_init_scheduler(0);
+    listener = spawn_actor(listener_func, NULL);
+    while (atomic_load(&port) == 0) usleep(1000);
+
+    threads = malloc(connections * sizeof(pthread_t));
+    completed = calloc(connections, sizeof(long));
+    start = now_ns();
+    for (x = 0; x < connections; x++) pthread_create(&threads[x], NULL, load_thread, &completed[x]);
+    for (x = 0; x < connections; x++) {
+        pthread_join(threads[x], NULL);
+        total += completed[x];
+    }
+    elapsed = now_ns() - start;
+
+    printf("%s: %ld connections, %ld requests in %.2f s: %.0f requests/s\n", mode, connections, total, elapsed / 1e9,
+           total / (elapsed / 1e9));
+
+    actor_send_msg(listener, STOP_MSG, NULL, 0);
+    actor_wait_finish();
+    actor_destroy_all();
+    free(threads);
+    free(completed);
+    return 0;
+}
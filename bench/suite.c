@@ -0,0 +1,626 @@
+/*
+libactor - A C Actor Library
+suite.c
+
+The benchmark suite: a fixed set of benchmarks run one after another,
+with the results printed as CSV or JSON so runs can be kept and
+compared. Each benchmark runs in a child process of its own, so one that
+crashes or hangs does not take the rest with it and every one starts
+from a freshly initialised library.
+
+  ping_pong_threads   round trips between two actors with threads
+  ping_pong_tasks     the same on the worker pool
+  fan_in              producers flooding one consumer
+  fan_out             one producer spreading messages over consumers
+  spawn_threads       spawn/exit churn of actors with threads
+  spawn_tasks         the same for tasks on the worker pool
+  spawn_handlers      the same for stackless handler actors
+  broadcast_inline    broadcasts of 16 bytes to 10,000 handler actors
+  broadcast_shared    broadcasts of 1 KiB, shared by every message
+  alloc_small         amalloc()/arelease() pairs of 64 bytes
+  alloc_large         amalloc()/arelease() pairs of 8 KiB
+  http                examples/http_server under keep-alive load
+
+The counts are sized for a few seconds per benchmark on a small machine;
+--scale multiplies them.
+
+Results go to standard output, or to the file given with --output, and
+progress to standard error. The exit status is non-zero if any benchmark
+failed. The bench target of the build runs the whole suite and writes
+bench.json in the build directory.
+
+usage: libactor_bench [--format csv|json] [--output file] [--scale n]
+                      [--only name[,name...]] [--http-server path] [--list]
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <libactor/actor.h>
+
+#ifndef HTTP_SERVER_PATH
+#define HTTP_SERVER_PATH "http_server"
+#endif
+
+enum { DATA_MSG = 100, DONE_MSG, STOP_MSG };
+
+/* Seconds a benchmark may run before it is killed */
+#define BENCH_TIMEOUT 300
+
+static long scale = 1;
+static int result_fd = -1;
+static const char *http_server = HTTP_SERVER_PATH;
+static int http_port;
+static pid_t http_pid;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Hands one result of the running benchmark to the parent */
+static void report(const char *metric, double value, const char *unit) {
+    dprintf(result_fd, "%s %.6g %s\n", metric, value, unit);
+}
+
+/* Reports the median and 99th percentile of count times, sorting them */
+static void report_percentiles(uint64_t *times, long count) {
+    if (count == 0) return;
+    qsort(times, count, sizeof(uint64_t), compare);
+    report("p50", times[(count - 1) / 2] / 1e3, "us");
+    report("p99", times[(long)(0.99 * (count - 1))] / 1e3, "us");
+}
+
+/*------------------------------------------------------------------------------
+                                   ping-pong
+------------------------------------------------------------------------------*/
+
+ACTOR_FUNCTION(echo_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    while ((msg = actor_receive())->type != STOP_MSG) {
+        actor_reply_msg(msg, DATA_MSG, NULL, 0);
+        arelease(msg);
+    }
+    arelease(msg);
+    return 0;
+}
+
+ACTOR_FUNCTION(ping_pong_func, args) {
+    long x, round_trips = 20000 * scale;
+    uint64_t *times = malloc(round_trips * sizeof(uint64_t));
+    actor_id echo = spawn_actor(echo_func, NULL);
+    uint64_t start, total;
+
+    (void)args;
+    /* Let the echo actor start and settle before timing */
+    for (x = 0; x < 1000; x++) {
+        actor_send_msg(echo, DATA_MSG, NULL, 0);
+        arelease(actor_receive());
+    }
+
+    total = now_ns();
+    for (x = 0; x < round_trips; x++) {
+        start = now_ns();
+        actor_send_msg(echo, DATA_MSG, NULL, 0);
+        arelease(actor_receive());
+        times[x] = now_ns() - start;
+    }
+    total = now_ns() - total;
+    actor_send_msg(echo, STOP_MSG, NULL, 0);
+
+    report("round_trips", round_trips / (total / 1e9), "1/s");
+    report_percentiles(times, round_trips);
+    free(times);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                fan-in and fan-out
+------------------------------------------------------------------------------*/
+
+#define FAN_ACTORS 8
+
+static long fan_messages() {
+    return 50000 * scale;
+}
+
+ACTOR_FUNCTION(producer_func, args) {
+    actor_id consumer = (actor_id)args;
+    long x, messages = fan_messages();
+
+    for (x = 0; x < messages; x++) actor_send_msg(consumer, DATA_MSG, &x, sizeof(x));
+    return 0;
+}
+
+ACTOR_FUNCTION(fan_in_func, args) {
+    long x, messages = FAN_ACTORS * fan_messages();
+    uint64_t start;
+
+    (void)args;
+    start = now_ns();
+    for (x = 0; x < FAN_ACTORS; x++) spawn_actor(producer_func, actor_self());
+    for (x = 0; x < messages; x++) arelease(actor_receive());
+
+    report("messages", messages / ((now_ns() - start) / 1e9), "1/s");
+    return 0;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    actor_id parent = (actor_id)args;
+    long x, messages = fan_messages();
+
+    for (x = 0; x < messages; x++) arelease(actor_receive());
+    actor_send_msg(parent, DONE_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_FUNCTION(fan_out_func, args) {
+    long x, messages = FAN_ACTORS * fan_messages();
+    actor_id consumers[FAN_ACTORS];
+    uint64_t start;
+
+    (void)args;
+    start = now_ns();
+    for (x = 0; x < FAN_ACTORS; x++) consumers[x] = spawn_actor(consumer_func, actor_self());
+    for (x = 0; x < messages; x++) actor_send_msg(consumers[x % FAN_ACTORS], DATA_MSG, &x, sizeof(x));
+    for (x = 0; x < FAN_ACTORS; x++) arelease(actor_receive_type(DONE_MSG, 0));
+
+    report("messages", messages / ((now_ns() - start) / 1e9), "1/s");
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                  spawn churn
+------------------------------------------------------------------------------*/
+
+/* Actors are spawned in bursts of this many and the burst waited for */
+#define SPAWN_BURST 100
+
+ACTOR_FUNCTION(short_func, args) {
+    actor_send_msg((actor_id)args, DONE_MSG, NULL, 0);
+    return 0;
+}
+
+ACTOR_HANDLER(short_handler, msg, args) {
+    (void)args;
+    actor_reply_msg(msg, DONE_MSG, NULL, 0);
+    return 1;
+}
+
+static void spawn_churn(int handlers) {
+    long x, y, actors = 20000 * scale;
+    uint64_t start;
+    actor_id aid;
+
+    start = now_ns();
+    for (x = 0; x < actors; x += SPAWN_BURST) {
+        for (y = 0; y < SPAWN_BURST; y++) {
+            if (handlers) {
+                aid = spawn_actor_handler(short_handler, NULL, NULL);
+                actor_send_msg(aid, DATA_MSG, NULL, 0);
+            } else {
+                spawn_actor(short_func, actor_self());
+            }
+        }
+        for (y = 0; y < SPAWN_BURST; y++) arelease(actor_receive_type(DONE_MSG, 0));
+    }
+
+    report("actors", actors / ((now_ns() - start) / 1e9), "1/s");
+}
+
+ACTOR_FUNCTION(spawn_func, args) {
+    (void)args;
+    spawn_churn(0);
+    return 0;
+}
+
+ACTOR_FUNCTION(spawn_handlers_func, args) {
+    (void)args;
+    spawn_churn(1);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                   broadcast
+------------------------------------------------------------------------------*/
+
+#define BROADCAST_ACTORS 10000
+
+static long broadcasts() {
+    return 20 * scale;
+}
+
+ACTOR_HANDLER(counter_handler, msg, args) {
+    long *received = (long *)args;
+
+    if (msg->type == STOP_MSG) {
+        free(received);
+        return 1;
+    }
+    if (msg->type == DATA_MSG && ++*received == broadcasts()) actor_reply_msg(msg, DONE_MSG, NULL, 0);
+    return 0;
+}
+
+static void broadcast(size_t size) {
+    long x, count = broadcasts();
+    char *data = calloc(1, size);
+    actor_msg_t *msg;
+    uint64_t start;
+
+    for (x = 0; x < BROADCAST_ACTORS; x++) spawn_actor_handler(counter_handler, calloc(1, sizeof(long)), NULL);
+
+    start = now_ns();
+    for (x = 0; x < count; x++) {
+        actor_broadcast_msg(DATA_MSG, data, size);
+        /* Our own copy */
+        arelease(actor_receive_type(DATA_MSG, 0));
+    }
+    for (x = 0; x < BROADCAST_ACTORS; x++) arelease(actor_receive_type(DONE_MSG, 0));
+    report("broadcasts", count / ((now_ns() - start) / 1e9), "1/s");
+
+    actor_broadcast_msg(STOP_MSG, NULL, 0);
+    while ((msg = actor_receive_timeout(1)) != NULL) arelease(msg);
+    free(data);
+}
+
+ACTOR_FUNCTION(broadcast_inline_func, args) {
+    (void)args;
+    broadcast(16);
+    return 0;
+}
+
+ACTOR_FUNCTION(broadcast_shared_func, args) {
+    (void)args;
+    broadcast(1024);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                  allocation
+------------------------------------------------------------------------------*/
+
+static void alloc_pairs(size_t size) {
+    long x, pairs = 2000000 * scale;
+    uint64_t start;
+    char *block;
+
+    start = now_ns();
+    for (x = 0; x < pairs; x++) {
+        block = amalloc(size);
+        block[0] = (char)x;
+        arelease(block);
+    }
+    report("pair", (double)(now_ns() - start) / pairs, "ns");
+}
+
+ACTOR_FUNCTION(alloc_small_func, args) {
+    (void)args;
+    alloc_pairs(64);
+    return 0;
+}
+
+ACTOR_FUNCTION(alloc_large_func, args) {
+    (void)args;
+    alloc_pairs(8192);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                     http
+------------------------------------------------------------------------------*/
+
+#define HTTP_CONNECTIONS 16
+
+static const char http_request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+struct http_result {
+    long completed;
+    uint64_t times[]; /* one per request, in nanoseconds */
+};
+
+static long http_requests() {
+    return 1000 * scale;
+}
+
+static int http_connect() {
+    struct sockaddr_in remote;
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    remote.sin_port = htons(http_port);
+    if (connect(sock, (struct sockaddr *)&remote, sizeof(remote)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Reads one response with a Content-Length; returns -1 if the connection failed */
+static int http_read_response(int sock, char *buf, size_t size) {
+    size_t len = 0, head = 0, body = 0;
+    const char *cl;
+    ssize_t ret;
+
+    for (;;) {
+        if ((ret = recv(sock, buf + len, size - 1 - len, 0)) <= 0) return -1;
+        len += ret;
+        buf[len] = 0;
+
+        if (head == 0 && (cl = strstr(buf, "\r\n\r\n")) != NULL) {
+            head = cl + 4 - buf;
+            if ((cl = strstr(buf, "Content-Length:")) != NULL) body = strtoul(cl + 15, NULL, 10);
+        }
+        if (head != 0 && len >= head + body) return len == head + body ? 0 : -1;
+        if (len == size - 1) return -1;
+    }
+}
+
+/* Starts the server on a free port and waits until it accepts connections */
+static int http_setup() {
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    char port[16];
+    int sock, x;
+
+    if (access(http_server, X_OK) != 0) {
+        fprintf(stderr, "http: cannot run %s; pass --http-server\n", http_server);
+        return -1;
+    }
+
+    /* Let the kernel pick a port that is free now */
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+        getsockname(sock, (struct sockaddr *)&local, &len) != 0) {
+        perror("http: bind");
+        close(sock);
+        return -1;
+    }
+    http_port = ntohs(local.sin_port);
+    close(sock);
+    snprintf(port, sizeof(port), "%d", http_port);
+
+    if ((http_pid = fork()) == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(1);
+        execl(http_server, http_server, port, (char *)NULL);
+        _exit(127);
+    }
+    if (http_pid < 0) return -1;
+
+    for (x = 0; x < 500; x++) {
+        if ((sock = http_connect()) >= 0) {
+            close(sock);
+            return 0;
+        }
+        if (waitpid(http_pid, NULL, WNOHANG) == http_pid) break;
+        usleep(10000);
+    }
+    fprintf(stderr, "http: the server did not start\n");
+    return -1;
+}
+
+static void http_teardown() {
+    if (http_pid <= 0) return;
+    kill(http_pid, SIGTERM);
+    waitpid(http_pid, NULL, 0);
+}
+
+ACTOR_FUNCTION(http_client_func, args) {
+    actor_id parent = (actor_id)args;
+    long requests = http_requests();
+    struct http_result *r = malloc(sizeof(struct http_result) + requests * sizeof(uint64_t));
+    char buf[4096];
+    uint64_t start;
+    int sock;
+
+    r->completed = 0;
+    if ((sock = http_connect()) >= 0) {
+        while (r->completed < requests) {
+            start = now_ns();
+            if (send(sock, http_request, sizeof(http_request) - 1, 0) != sizeof(http_request) - 1) break;
+            if (http_read_response(sock, buf, sizeof(buf)) != 0) break;
+            r->times[r->completed++] = now_ns() - start;
+        }
+        close(sock);
+    }
+
+    actor_send_msg(parent, DONE_MSG, &r, sizeof(r));
+    return 0;
+}
+
+ACTOR_FUNCTION(http_func, args) {
+    long x, total = 0, failed = 0, requests = http_requests();
+    uint64_t *times = malloc(HTTP_CONNECTIONS * requests * sizeof(uint64_t));
+    struct http_result *r;
+    actor_msg_t *msg;
+    uint64_t start;
+
+    (void)args;
+    start = now_ns();
+    for (x = 0; x < HTTP_CONNECTIONS; x++) spawn_actor(http_client_func, actor_self());
+
+    for (x = 0; x < HTTP_CONNECTIONS; x++) {
+        msg = actor_receive_type(DONE_MSG, 0);
+        r = *(struct http_result **)msg->data;
+        memcpy(times + total, r->times, r->completed * sizeof(uint64_t));
+        total += r->completed;
+        if (r->completed < requests) failed++;
+        free(r);
+        arelease(msg);
+    }
+
+    report("requests", total / ((now_ns() - start) / 1e9), "1/s");
+    report_percentiles(times, total);
+    report("failed_connections", failed, "count");
+    free(times);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+                                    driver
+------------------------------------------------------------------------------*/
+
+struct bench_case {
+    const char *name;
+    actor_function_ptr_t func;
+    int scheduled; /* run on the worker pool rather than threads */
+    int (*setup)();
+    void (*teardown)();
+};
+
+static const struct bench_case cases[] = {
+    {"ping_pong_threads", ping_pong_func, 0, NULL, NULL},
+    {"ping_pong_tasks", ping_pong_func, 1, NULL, NULL},
+    {"fan_in", fan_in_func, 0, NULL, NULL},
+    {"fan_out", fan_out_func, 0, NULL, NULL},
+    {"spawn_threads", spawn_func, 0, NULL, NULL},
+    {"spawn_tasks", spawn_func, 1, NULL, NULL},
+    {"spawn_handlers", spawn_handlers_func, 1, NULL, NULL},
+    {"broadcast_inline", broadcast_inline_func, 1, NULL, NULL},
+    {"broadcast_shared", broadcast_shared_func, 1, NULL, NULL},
+    {"alloc_small", alloc_small_func, 0, NULL, NULL},
+    {"alloc_large", alloc_large_func, 0, NULL, NULL},
+    {"http", http_func, 0, http_setup, http_teardown},
+};
+
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+/* Runs one benchmark in a child process and collects what it reported */
+static int run_case(const struct bench_case *c, char *out, size_t size) {
+    size_t len = 0;
+    ssize_t ret;
+    int fds[2], status;
+    pid_t pid;
+
+    if (pipe(fds) != 0) return -1;
+    fflush(NULL);
+    if ((pid = fork()) == 0) {
+        close(fds[0]);
+        result_fd = fds[1];
+        alarm(BENCH_TIMEOUT);
+        if (c->setup != NULL && c->setup() != 0) {
+            if (c->teardown != NULL) c->teardown();
+            _exit(1);
+        }
+        if (c->scheduled)
+            actor_init_scheduler(0);
+        else
+            actor_init();
+        spawn_actor(c->func, NULL);
+        actor_wait_finish();
+        actor_destroy_all();
+        if (c->teardown != NULL) c->teardown();
+        _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    while (len < size - 1 && ((ret = read(fds[0], out + len, size - 1 - len)) > 0 || (ret < 0 && errno == EINTR)))
+        if (ret > 0) len += ret;
+    out[len] = 0;
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) continue;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int selected(const char *only, const char *name) {
+    size_t len = strlen(name);
+    const char *p;
+
+    if (only == NULL) return 1;
+    for (p = only; (p = strstr(p, name)) != NULL; p += len)
+        if ((p == only || p[-1] == ',') && (p[len] == 0 || p[len] == ',')) return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *format = "csv", *only = NULL;
+    char out[4096], metric[64], unit[16], *line;
+    int x, failed = 0, first = 1;
+    double value;
+    size_t c;
+
+    for (x = 1; x < argc; x++) {
+        if (strcmp(argv[x], "--format") == 0 && x + 1 < argc) {
+            format = argv[++x];
+        } else if (strcmp(argv[x], "--scale") == 0 && x + 1 < argc) {
+            scale = atol(argv[++x]);
+        } else if (strcmp(argv[x], "--only") == 0 && x + 1 < argc) {
+            only = argv[++x];
+        } else if (strcmp(argv[x], "--output") == 0 && x + 1 < argc) {
+            if (freopen(argv[++x], "w", stdout) == NULL) {
+                perror(argv[x]);
+                return 1;
+            }
+        } else if (strcmp(argv[x], "--http-server") == 0 && x + 1 < argc) {
+            http_server = argv[++x];
+        } else if (strcmp(argv[x], "--list") == 0) {
+            for (c = 0; c < CASES; c++) printf("%s\n", cases[c].name);
+            return 0;
+        } else {
+            break;
+        }
+    }
+    if (x < argc || scale < 1 || (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)) {
+        fprintf(stderr,
+                "usage: %s [--format csv|json] [--output file] [--scale n] [--only name[,name...]]\n"
+                "       [--http-server path] [--list]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (strcmp(format, "csv") == 0)
+        printf("benchmark,metric,value,unit\n");
+    else
+        printf("{\"scale\": %ld, \"results\": [", scale);
+
+    for (c = 0; c < CASES; c++) {
+        if (!selected(only, cases[c].name)) continue;
+        fprintf(stderr, "%s...\n", cases[c].name);
+        if (run_case(&cases[c], out, sizeof(out)) != 0) {
+            fprintf(stderr, "%s failed\n", cases[c].name);
+            failed++;
+        }
+
+        for (line = strtok(out, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+            if (sscanf(line, "%63s %lf %15s", metric, &value, unit) != 3) continue;
+            if (strcmp(format, "csv") == 0) {
+                printf("%s,%s,%.6g,%s\n", cases[c].name, metric, value, unit);
+            } else {
+                printf("%s\n  {\"benchmark\": \"%s\", \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+                       first ? "" : ",", cases[c].name, metric, value, unit);
+                first = 0;
+            }
+        }
+        fflush(stdout);
+    }
+
+    if (strcmp(format, "json") == 0) printf("\n]}\n");
+    return failed > 0;
+}
@@ -0,0 +1,90 @@
+/*
+libactor - A C Actor Library
+trace.c
+
+The cost of tracing. Two actors play ping-pong, first untraced and then
+traced to a file, and the difference per round trip is divided by the
+six events each one records: two sends, two receives and two arelease()
+calls. Needs a library built with ACTOR_TRACE; convert the file with
+actor_trace2json to look at it.
+
+usage: bench_trace [round trips] [trace file]
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { PING_MSG = 100, STOP_MSG };
+
+#define EVENTS_PER_ROUND_TRIP 6
+
+static long round_trips = 200000;
+static const char *path = "actor.trace";
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(echo_func, args) {
+    actor_msg_t *msg;
+
+    (void)args;
+    while ((msg = actor_receive())->type != STOP_MSG) {
+        actor_reply_msg(msg, PING_MSG, NULL, 0);
+        arelease(msg);
+    }
+    arelease(msg);
+    return 0;
+}
+
+static double run(actor_id echo) {
+    double start = now();
+    long x;
+
+    for (x = 0; x < round_trips; x++) {
+        actor_send_msg(echo, PING_MSG, NULL, 0);
+        arelease(actor_receive());
+    }
+    return (now() - start) / round_trips * 1e9;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id echo = spawn_actor(echo_func, NULL);
+    double untraced, traced;
+    int err;
+
+    (void)args;
+    run(echo); /* warm up */
+    untraced = run(echo);
+    if ((err = actor_trace_start(path)) != 0) {
+        printf("cannot trace: %s\n", err == ENOTSUP ? "built without ACTOR_TRACE" : strerror(err));
+        actor_send_msg(echo, STOP_MSG, NULL, 0);
+        return 0;
+    }
+    traced = run(echo);
+    actor_send_msg(echo, STOP_MSG, NULL, 0);
+    actor_trace_stop();
+
+    printf("untraced: %.0f ns per round trip\n", untraced);
+    printf("traced:   %.0f ns per round trip, %.1f ns per event, written to %s\n", traced,
+           (traced - untraced) / EVENTS_PER_ROUND_TRIP, path);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) round_trips = atol(argv[1]);
+    if (argc > 2) path = argv[2];
+
+    actor_init();
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+libactor - A C Actor Library
+zero_copy.c
+
+Throughput by payload size for copied and moved messages. Two actors bounce
+one payload back and forth: with actor_send_msg() each hop copies it, with
+actor_send_move() each hop hands the same amalloc() block over.
+
+usage: bench_zero_copy [megabytes per run]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { COPY_MSG = 100, MOVE_MSG, STOP_MSG };
+
+static long megabytes = 512;
+static const size_t sizes[] = {64, 4096, 65536, 1 << 20, 4 << 20};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+ACTOR_FUNCTION(echo_func, args) {
+    actor_msg_t *msg;
+    void *data;
+
+    (void)args;
+    for (;;) {
+        msg = actor_receive();
+        data = (void *)msg->data;
+        if (msg->type == STOP_MSG) {
+            arelease(msg);
+            break;
+        }
+        if (msg->type == MOVE_MSG) {
+            actor_send_move(msg->sender, MOVE_MSG, &data, msg->size);
+        } else {
+            actor_reply_msg(msg, COPY_MSG, data, msg->size);
+            arelease(data);
+        }
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(bench_func, args) {
+    actor_id echo = spawn_actor(echo_func, NULL);
+    actor_msg_t *msg;
+    double start, copy_time, move_time;
+    void *block;
+    long hops, x;
+    size_t s;
+
+    (void)args;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        hops = (megabytes << 20) / (long)sizes[s];
+        if (hops > 200000) hops = 200000;
+        hops -= hops % 2;
+
+        block = amalloc(sizes[s]);
+        memset(block, 'x', sizes[s]);
+
+        start = now();
+        for (x = 0; x < hops; x += 2) {
+            actor_send_msg(echo, COPY_MSG, block, sizes[s]);
+            msg = actor_receive();
+            arelease((void *)msg->data);
+            arelease(msg);
+        }
+        copy_time = now() - start;
+
+        start = now();
+        for (x = 0; x < hops; x += 2) {
+            actor_send_move(echo, MOVE_MSG, &block, sizes[s]);
+            msg = actor_receive();
+            block = (void *)msg->data;
+            arelease(msg);
+        }
+        move_time = now() - start;
+        arelease(block);
+
+        printf("%8zu bytes: copy %9.1f MB/s %7.0f ns/hop, move %9.1f MB/s %7.0f ns/hop\n", sizes[s],
+               hops * (double)sizes[s] / copy_time / 1e6, copy_time * 1e9 / hops,
+               hops * (double)sizes[s] / move_time / 1e6, move_time * 1e9 / hops);
+    }
+
+    actor_send_msg(echo, STOP_MSG, NULL, 0);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) megabytes = atol(argv[1]);
+
+    actor_init_scheduler(0);
+    spawn_actor(bench_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+    return 0;
+}
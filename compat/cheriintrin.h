@@ -0,0 +1,48 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef COMPAT_CHERIINTRIN_H_
+#define COMPAT_CHERIINTRIN_H_
+
+/*
+ * Stand-ins for the CHERI intrinsics the library uses, for building on
+ * hosts without CHERI. Capabilities become plain pointers: sealing,
+ * bounds and permissions do nothing and every non-NULL pointer is
+ * tagged. Only used when LIBACTOR_CHERI is off.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHERI_PERM_LOAD      (1 << 2)
+#define CHERI_PERM_LOAD_CAP  (1 << 4)
+
+#define cheri_tag_get(p)                        ((p) != NULL)
+#define cheri_address_get(p)                    ((uintptr_t)(p))
+#define cheri_length_get(p)                     ((void)(p), ~(size_t)0)
+#define cheri_offset_get(p)                     ((void)(p), (size_t)0)
+#define cheri_offset_set(p, o)                  ((void)(o), (void *)(p))
+#define cheri_bounds_set(p, n)                  ((void)(n), (void *)(p))
+#define cheri_perms_and(p, m)                   ((void)(m), (void *)(p))
+#define cheri_seal(p, s)                        ((void)(s), (void *)(p))
+#define cheri_unseal(p, s)                      ((void)(s), (void *)(p))
+#define cheri_representable_length(n)           ((size_t)(n))
+#define cheri_representable_alignment_mask(n)   ((void)(n), ~(size_t)0)
+
+#endif /* COMPAT_CHERIINTRIN_H_ */
@@ -18,6 +18,8 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -32,20 +34,21 @@ enum { PING_MSG = 100, PONG_MSG, ECHO_CLIENT_INFO };
 Trap exit example
 */
 void *trap_exit_die(void *args) {
+    (void)args;
     sleep(5);
     return 0;
 }
 
 void *trap_exit(void *args) {
     actor_msg_t *msg;
-    actor_id aid;
 
+    (void)args;
     actor_trap_exit(1);
-    aid = spawn_actor(trap_exit_die, NULL);
+    spawn_actor(trap_exit_die, NULL);
     printf("Waiting for actor to die...\n");
     msg = actor_receive();
     if (msg->type == ACTOR_MSG_EXITED) {
-        printf("An actor died! ID: %d\n", msg->sender);
+        printf("An actor died! ID: %p\n", (void *)msg->sender);
     }
     arelease(msg);
     return 0;
@@ -56,33 +59,42 @@ Echo Server Example
 */
 
 void *echo_client(void *args) {
-    actor_msg_t *msg;
+    actor_msg_t *msg, *data;
+    const actor_io_event_t *ev;
     struct sockaddr_in *remote;
-    char buf[32];
-    int sock = (int)args;
-    int ret;
+    int sock = (int)(intptr_t)args;
+    ssize_t sent;
 
     msg = actor_receive();
     if (msg->type == ECHO_CLIENT_INFO) {
         remote = (struct sockaddr_in *)msg->data;
         printf("Echo client connected: %s\n", inet_ntoa(remote->sin_addr));
 
-        while ((ret = recv(sock, buf, 32, 0)) > 0) {
-            if (send(sock, buf, ret, 0) == -1) break;
+        /* The reactor reads for us; the actor holds no thread while it waits */
+        while (actor_io_read(sock, 32) == 0) {
+            data = actor_receive_type(ACTOR_MSG_IO_READ, 0);
+            ev = (const actor_io_event_t *)data->data;
+            sent = ev->length > 0 ? send(sock, ev->data, ev->length, 0) : -1;
+            /* The block the reactor read into is ours, apart from the message */
+            arelease((void *)data->data);
+            arelease(data);
+            if (sent == -1) break;
         }
         printf("Echo client disconnected: %s\n", inet_ntoa(remote->sin_addr));
     }
     arelease(msg);
+    close(sock);
     return 0;
 }
 
 void *echo_server(void *args) {
     struct sockaddr_in local, remote;
     int sockfd, clientsock;
-    int socklen = sizeof(struct sockaddr_in);
+    socklen_t socklen = sizeof(struct sockaddr_in);
     int sockoption;
     actor_id aid;
 
+    (void)args;
     local.sin_family = AF_INET;
     local.sin_addr.s_addr = INADDR_ANY;
     local.sin_port = htons(9999);
@@ -98,12 +110,14 @@ void *echo_server(void *args) {
     }
     listen(sockfd, 5);
     printf("Echo server listening on port: 9999\n");
-    while (1) {
-        if ((clientsock = accept(sockfd, (struct sockaddr *)&remote, &socklen)) != -1) {
-            aid = spawn_actor(echo_client, (void *)clientsock);
+    while (actor_io_watch(sockfd, ACTOR_IO_READ) == 0) {
+        arelease(actor_receive_type(ACTOR_MSG_IO, 0));
+        while ((clientsock = accept(sockfd, (struct sockaddr *)&remote, &socklen)) != -1) {
+            aid = spawn_actor(echo_client, (void *)(intptr_t)clientsock);
             actor_send_msg(aid, ECHO_CLIENT_INFO, (void *)&remote, sizeof(struct sockaddr_in));
-        } else
-            break;
+            socklen = sizeof(struct sockaddr_in);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) break;
     }
     printf("Echo server exiting...\n");
     return 0;
@@ -116,6 +130,7 @@ PING/PONG Example
 void *pong_func(void *args) {
     actor_msg_t *msg;
 
+    (void)args;
     while (1) {
         msg = actor_receive();
         if (msg->type == PING_MSG) {
@@ -130,10 +145,12 @@ void *pong_func(void *args) {
 void *ping_func(void *args) {
     actor_msg_t *msg;
     actor_id aid = spawn_actor(pong_func, NULL);
+
+    (void)args;
     while (1) {
         actor_send_msg(aid, PING_MSG, NULL, 0);
-        msg = actor_receive();
-        if (msg->type == PONG_MSG) printf("PONG!\n");
+        msg = actor_receive_type(PONG_MSG, 0);
+        printf("PONG!\n");
         arelease(msg);
         sleep(5);
     }
@@ -157,6 +174,7 @@ void *main_func(void *args) {
 
     /* Trap exit example */
     spawn_actor(trap_exit, NULL);
+    return 0;
 }
 
 DECLARE_ACTOR_MAIN(main_func)
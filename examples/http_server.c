@@ -2,7 +2,10 @@
 libactor - A C Actor Library
 http_server.c
 
-A Simple HTTP Server. Just returns "Hello, World to the client". Doesn't do any handling of headers.
+A Simple HTTP Server. Just returns "Hello, World to the client". Only looks at the Connection header.
+Each connection is an actor on the worker pool that reads and writes its
+socket through a buffered stream, which waits on the library's I/O reactor,
+so idle connections hold no thread.
 
 Copyright (C) 2009 Chris Moos
 
@@ -23,7 +26,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 
 #include <libactor/actor.h>
+#include <libactor/stream.h>
 
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -31,77 +38,50 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <arpa/inet.h>
 
 
-#define BUFFER_SIZE 512
-#define HTTP_CLIENT_INFO 100
-
-
-unsigned char *recvline(int sockfd) {
-    unsigned char *buf = (unsigned char *)malloc(BUFFER_SIZE);
-    unsigned int len = 0, bufLen = BUFFER_SIZE;
-    int ret;
-
-    for (;;) {
-        ret = recv(sockfd, buf + len, 1, 0);
-        if (ret <= 0) {
-            free(buf);
-            return NULL;
-        } else {
-            if (buf[len] == 0) {
-                free(buf);
-                return NULL;
-            }
-            len += ret;
-            if (len >= 2 && (buf[len - 2] == '\r' && buf[len - 1] == '\n')) {
-                buf[len - 2] = 0;
-                return buf;
-            }
-            if (len == (BUFFER_SIZE - 1)) {
-                buf = (unsigned char *)realloc(buf, bufLen + BUFFER_SIZE);
-                bufLen += BUFFER_SIZE;
-            }
-        }
-    }
-
-    return buf;
-}
+static const char response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 15\r\n"
+    "\r\n"
+    "Hello, World!\r\n";
 
 
 ACTOR_FUNCTION(http_client, args) {
-    actor_msg_t *msg;
-    struct sockaddr_in *remote;
-    int sock = (int)args;
-    unsigned char *line = NULL;
-    char *response =
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: text/plain\r\n"
-        "Content-Length: 12\r\n"
-        "\r\n"
-        "Hello, World!\r\n";
-
-    msg = actor_receive();
-    if (msg->type == HTTP_CLIENT_INFO) {
-        remote = (struct sockaddr_in *)msg->data;
-        while ((line = recvline(sock)) != NULL) {
-            if (*line == 0) {
-                free(line);
-                break;
-            }
-            free(line);
+    actor_stream_t *s = actor_stream_open((int)(intptr_t)args);
+    const char *line;
+    size_t len;
+    int first = 1, keep_alive = 0;
+
+    while ((line = actor_stream_read_line(s, &len, 0)) != NULL) {
+        if (first && len == 0) {
+            /* Clients may send empty lines between requests */
+            continue;
+        } else if (first) {
+            /* HTTP/1.1 keeps connections open unless asked not to */
+            keep_alive = len >= 8 && memcmp(line + len - 8, "HTTP/1.1", 8) == 0;
+            first = 0;
+        } else if (strcmp(line, "Connection: close") == 0) {
+            keep_alive = 0;
+        } else if (strcmp(line, "Connection: keep-alive") == 0) {
+            keep_alive = 1;
+        } else if (len == 0) {
+            /* The end of the request. The answer goes out when the next read has to wait, so pipelined
+               requests already read get their answers in the same write. */
+            if (actor_stream_write(s, response, sizeof(response) - 1, 0) != 0 || !keep_alive) break;
+            first = 1;
         }
-        send(sock, response, strlen(response), 0);
     }
-    arelease(msg);
-    close(sock);
+
+    actor_stream_close(s);
     return 0;
 }
 
 
 ACTOR_FUNCTION(http_listener, arg) {
-    struct sockaddr_in local, remote;
-    int sockfd;
-    int socklen = sizeof(struct sockaddr_in);
+    struct sockaddr_in local;
+    int sockfd, clientsock;
 
-    int port = (int)arg;
+    int port = (int)(intptr_t)arg;
 
     local.sin_family = AF_INET;
     local.sin_addr.s_addr = INADDR_ANY;
@@ -119,17 +99,21 @@ ACTOR_FUNCTION(http_listener, arg) {
         return 0;
     }
 
-    listen(sockfd, 0);
+    listen(sockfd, SOMAXCONN);
     printf("HTTP server listening on port: %d\n", port);
 
-    while (1) {
-        int clientsock = accept(sockfd, (struct sockaddr *)&remote, &socklen);
-        if (clientsock == -1) break;
+    while (actor_io_watch(sockfd, ACTOR_IO_READ) == 0) {
+        arelease(actor_receive_type(ACTOR_MSG_IO, 0));
 
-        actor_id aid = spawn_actor(http_client, (void *)clientsock);
-        actor_send_msg(aid, HTTP_CLIENT_INFO, (void *)&remote, sizeof(struct sockaddr_in));
+        /* Take every connection that is waiting, then watch again */
+        while ((clientsock = accept(sockfd, NULL, NULL)) != -1) spawn_actor(http_client, (void *)(intptr_t)clientsock);
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+            perror("accept");
+            break;
+        }
     }
 
+    close(sockfd);
     return 0;
 }
 
@@ -137,12 +121,15 @@ ACTOR_FUNCTION(http_listener, arg) {
 ACTOR_FUNCTION(main_func, args) {
     struct actor_main *amain = (struct actor_main *)args;
 
+    /* A client that hangs up early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
     if (amain->argc < 2)
         printf("usage: %s port\n", amain->argv[0]);
     else
-        spawn_actor(http_listener, (void *)atoi(amain->argv[1]));
+        spawn_actor(http_listener, (void *)(intptr_t)atoi(amain->argv[1]));
 
     return 0;
 }
 
-DECLARE_ACTOR_MAIN(main_func)
+DECLARE_ACTOR_MAIN_SCHEDULED(main_func, 0)
@@ -30,6 +30,8 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 /*------------------------------------------------------------------------------
@@ -54,6 +56,19 @@
         exit(0);                          \
     }
 
+/* Same as DECLARE_ACTOR_MAIN, but runs the actors on a pool of `workers` threads (see actor_init_scheduler()) */
+#define DECLARE_ACTOR_MAIN_SCHEDULED(fun, workers) \
+    int main(int argc, char **argv) {              \
+        struct actor_main amain;                   \
+        amain.argc = argc;                         \
+        amain.argv = argv;                         \
+        actor_init_scheduler(workers);             \
+        spawn_actor(fun, (void *)&amain);          \
+        actor_wait_finish();                       \
+        actor_destroy_all();                       \
+        exit(0);                                   \
+    }
+
 #define ACTOR_INVALID (-1)
 
 struct actor_main {
@@ -82,6 +97,12 @@ typedef void *actor_id;
 struct actor_message_struct;
 typedef struct actor_message_struct actor_msg_t;
 
+/**
+ * Copied messages of up to this many bytes carry their data inside the
+ * message instead of in a block of their own.
+ */
+#define ACTOR_MSG_INLINE_SIZE 64
+
 /**
  * This structure contains information about a message.
  */
@@ -112,9 +133,112 @@ struct actor_message_struct {
      * The size of the data.
      */
     size_t size;
+
+    /**
+     * Holds the data of small messages, which then lives only as long as
+     * the message: retain the message, not `data`, to keep it.
+     */
+    _Alignas(max_align_t) char inline_data[ACTOR_MSG_INLINE_SIZE];
+};
+
+enum { ACTOR_MSG_EXITED = 1, ACTOR_MSG_IO, ACTOR_MSG_IO_READ };
+
+/*
+**
+** Handler Function, see spawn_actor_handler()
+**
+*/
+#define ACTOR_HANDLER(name, msg, args) int(name)(actor_msg_t * msg, void *args)
+typedef int (*actor_handler_ptr_t)(actor_msg_t *, void *);
+
+/**
+ * Mailboxes have ACTOR_PRIORITY_LANES lanes. A receive takes the oldest
+ * message of the highest lane that has one, so control messages do not
+ * queue behind bulk data. Library notifications such as ACTOR_MSG_EXITED
+ * use ACTOR_PRIORITY_SYSTEM.
+ */
+#define ACTOR_PRIORITY_LANES 4
+enum {
+    ACTOR_PRIORITY_NORMAL = 0, /* actor_send_msg() and the other sends */
+    ACTOR_PRIORITY_HIGH = 1,
+    ACTOR_PRIORITY_URGENT = 2,
+    ACTOR_PRIORITY_SYSTEM = ACTOR_PRIORITY_LANES - 1
+};
+
+/**
+ * What happens to a message sent to a full mailbox, see actor_opts_t.
+ */
+enum {
+    ACTOR_OVERFLOW_BLOCK,        /* the sender waits for room; actor_try_send_msg() returns EAGAIN */
+    ACTOR_OVERFLOW_REJECT,       /* the message is refused; actor_try_send_msg() returns EAGAIN */
+    ACTOR_OVERFLOW_DROP_OLDEST,  /* the oldest queued message is discarded to make room */
+    ACTOR_OVERFLOW_DROP_NEWEST   /* the new message is discarded */
+};
+
+/**
+ * Options for spawn_actor_opts(). Zero-initialise to get the defaults.
+ */
+typedef struct actor_opts_struct {
+    /**
+     * The most messages the mailbox holds, or 0 for no limit.
+     * Exit notifications and messages from the I/O reactor are always
+     * delivered and do not count.
+     */
+    size_t mailbox_capacity;
+
+    /**
+     * One of the ACTOR_OVERFLOW_* policies.
+     */
+    int mailbox_overflow;
+
+    /**
+     * The size of the actor's stack in bytes, or 0 for the default: the
+     * system's for a thread of its own, 64 KiB for a task on the worker
+     * pool. Actors with the default size spawn fastest, as their threads
+     * and stacks are reused.
+     */
+    size_t stack_size;
+} actor_opts_t;
+
+/**
+ * How a pool spreads messages over its workers, see spawn_actor_pool().
+ */
+enum {
+    ACTOR_POOL_ROUND_ROBIN,  /* each worker in turn */
+    ACTOR_POOL_LEAST_DEPTH,  /* the worker with the fewest messages queued */
+    ACTOR_POOL_HASH,         /* by consistent hashing of a key, see actor_send_key_msg() */
+    ACTOR_POOL_TWO_CHOICES   /* the less loaded of two workers picked at random */
 };
 
-enum { ACTOR_MSG_EXITED = 1 };
+/**
+ * Mailbox counters, see actor_mailbox_stats().
+ */
+typedef struct actor_mailbox_stats_struct {
+    size_t capacity;          /* 0 if unbounded */
+    size_t depth;             /* messages queued and not yet received */
+    unsigned long rejected;   /* sends refused with ACTOR_OVERFLOW_REJECT or by actor_try_send_msg() */
+    unsigned long dropped;    /* messages discarded by the DROP policies */
+} actor_mailbox_stats_t;
+
+/* Buckets of the latency histogram in actor_stats_t */
+#define ACTOR_STATS_BUCKETS 128
+
+/**
+ * Message statistics of one actor, see actor_stats_get(). Only kept when
+ * the library is built with ACTOR_STATS.
+ */
+typedef struct actor_stats_struct {
+    unsigned long enqueued;   /* messages queued to the mailbox */
+    unsigned long dequeued;   /* messages received */
+    unsigned long dropped;    /* messages discarded by the DROP policies */
+    unsigned long rejected;   /* sends refused, as in actor_mailbox_stats_t */
+    unsigned long bytes;      /* message data queued */
+    size_t depth;             /* messages queued and not yet received */
+    size_t max_depth;         /* the most ever queued at once */
+    uint64_t uptime_ns;       /* since the actor was spawned */
+    /* Times from send to receive; bucket b counts those from actor_stats_bucket_ns(b) up to that of b + 1 */
+    unsigned long latency[ACTOR_STATS_BUCKETS];
+} actor_stats_t;
 
 
 /*------------------------------------------------------------------------------
@@ -127,16 +251,107 @@ enum { ACTOR_MSG_EXITED = 1 };
 void actor_init();
 
 
+/**
+ * Initialize global state and run every actor spawned from now on as a
+ * lightweight task on a fixed pool of worker threads, instead of on a
+ * thread of its own. actor_receive() suspends the task, not the worker.
+ * Actors should not make long blocking calls in this mode, as they hold up
+ * every other actor queued on the same worker.
+ *
+ * Each task's stack is mapped with a guard page, which takes two of the
+ * process's memory mappings. Linux allows 65530 by default
+ * (vm.max_map_count), so about 32000 actors with stacks can be alive at
+ * once; past that spawns return NULL with errno set to ENOMEM. Handler
+ * actors (see spawn_actor_handler()) have no stack and no such limit.
+ *
+ * @param workers  the number of worker threads, or 0 for one per online CPU
+ */
+void actor_init_scheduler(unsigned int workers);
+
+
+/**
+ * Start `count` idle threads with stacks of `stack_size` bytes (0 for the
+ * system default) for actors spawned later, so that those spawns hand an
+ * actor to a waiting thread rather than create one. Threads that finish an
+ * actor are kept for the next spawn anyway, but for a few seconds only;
+ * these stay until actor_destroy_all(). At most 64 threads are kept. Does
+ * nothing useful once actor_init_scheduler() has been called.
+ *
+ * @param count       the number of threads
+ * @param stack_size  their stack size, see actor_opts_t
+ * @return            0 on success, or the pthread_create() error
+ */
+int actor_prespawn_threads(unsigned int count, size_t stack_size);
+
+
 /**
  * Spawn a new actor.
  *
  * @param func  the function that the thread should run
  * @param args  passed to the actor when it is spawned
- * @return      the `actor_id`
+ * @return      the `actor_id`, or NULL with errno set if the actor's thread
+ *              or stack could not be created
  */
 actor_id spawn_actor(actor_function_ptr_t func, void *args);
 
 
+/**
+ * Spawn a new actor with options.
+ *
+ * @param func  the function that the thread should run
+ * @param args  passed to the actor when it is spawned
+ * @param opts  the options, or NULL for the defaults
+ * @return      the `actor_id`, or NULL with errno set as for spawn_actor()
+ */
+actor_id spawn_actor_opts(actor_function_ptr_t func, void *args, const actor_opts_t *opts);
+
+
+/**
+ * Spawn an actor that is a message handler rather than a function that
+ * runs until it returns: `handler(msg, args)` is called for each message
+ * that arrives, in the order actor_receive() would return them, and the
+ * actor exits when it returns non-zero. The message and its data are
+ * released once the handler returns; retain them to keep them.
+ *
+ * On the worker pool (see actor_init_scheduler()) a handler actor has no
+ * stack of its own and costs its state and little more while its mailbox
+ * is empty, so a process can hold millions. The handler then runs on the
+ * worker's stack and must not wait: actor_receive() and its variants
+ * return NULL rather than wait for a message, and a send to a full
+ * ACTOR_OVERFLOW_BLOCK mailbox holds up the worker. Without the worker
+ * pool the actor runs on a thread of its own that receives and calls the
+ * handler in turn.
+ *
+ * @param handler  the function to call for each message
+ * @param args     passed to each call
+ * @param opts     the options, or NULL for the defaults; `stack_size` only
+ *                 applies without the worker pool
+ * @return         the `actor_id`, or NULL with errno set as for spawn_actor()
+ */
+actor_id spawn_actor_handler(actor_handler_ptr_t handler, void *args, const actor_opts_t *opts);
+
+
+/**
+ * Spawn `n` actors that run `func(args)` and return one `actor_id` for the
+ * lot. A message sent to the pool goes to one of its workers, picked by
+ * `strategy` as it is sent, straight into that worker's mailbox; a reply
+ * comes from the worker's own ID. ACTOR_POOL_LEAST_DEPTH and
+ * ACTOR_POOL_TWO_CHOICES look at how many messages each worker has
+ * queued, so a slow worker gets fewer. ACTOR_POOL_HASH sends every message
+ * with the same key to the same worker while it lives; when a worker
+ * exits only its keys move. Messages sent to a worker that has exited go
+ * elsewhere. The pool exits once all its workers have.
+ *
+ * @param func      the function that the workers run
+ * @param args      passed to each worker
+ * @param n         the number of workers
+ * @param strategy  one of the ACTOR_POOL_* strategies
+ * @return          the pool's `actor_id`, or NULL with errno set if no
+ *                  worker could be spawned
+ */
+actor_id spawn_actor_pool(actor_function_ptr_t func, void *args, unsigned int n, int strategy);
+
+
 /**
  * Destroy all actors
  */
@@ -152,6 +367,8 @@ void actor_wait_finish();
 /**
  * Send a message to an actor.
  * The data is copied before being sent to the actor.
+ * Threads that are not actors, such as the one running main(), may send
+ * too; their messages arrive with a NULL `sender`.
  *
  * @param aid   the Actor to which the message is sent
  * @param type  a user defined value
@@ -162,7 +379,189 @@ void actor_send_msg(actor_id aid, long type, void *data, size_t size);
 
 
 /**
- * Broadcast a message to all actors.
+ * Same as actor_send_msg(), but queues the message in the given lane of
+ * the receiver's mailbox. Bounded mailboxes count every lane against their
+ * capacity; ACTOR_OVERFLOW_DROP_OLDEST drops from the lowest lane first,
+ * and never drops the messages that do not count.
+ *
+ * @param priority  one of the ACTOR_PRIORITY_* lanes
+ */
+void actor_send_priority_msg(actor_id aid, int priority, long type, void *data, size_t size);
+
+
+/**
+ * Same as actor_send_msg(), but never waits for room in a bounded mailbox.
+ *
+ * @return  0 once the message is queued or dropped by the mailbox's policy,
+ *          EAGAIN if the mailbox is full and the message was not queued,
+ *          ESRCH if `aid` is not a live actor
+ */
+int actor_try_send_msg(actor_id aid, long type, void *data, size_t size);
+
+
+/**
+ * Same as actor_send_msg(), with the key that an ACTOR_POOL_HASH pool
+ * picks the worker by. Other sends to such a pool use the message type as
+ * the key; other actors ignore it.
+ *
+ * @param key  the key, such as a hash of the session or object the message is about
+ */
+void actor_send_key_msg(actor_id aid, unsigned long key, long type, void *data, size_t size);
+
+
+/**
+ * One message of a batch, see actor_send_batch().
+ */
+typedef struct actor_batch_msg_struct {
+    long type;
+    void *data;
+    size_t size;
+} actor_batch_msg_t;
+
+
+/**
+ * Send several messages to an actor at once. Each message's data is copied
+ * as by actor_send_msg(). The messages are queued in order with a single
+ * push and the receiver is woken only once.
+ *
+ * @param aid    the Actor to which the messages are sent
+ * @param msgs   the messages
+ * @param count  the number of entries in `msgs`
+ */
+void actor_send_batch(actor_id aid, actor_batch_msg_t *msgs, size_t count);
+
+
+/**
+ * Send a block from amalloc() to an actor without copying it.
+ * The sender's reference to the block moves into the message, and `*data`
+ * is set to NULL. The receiver gets a capability bounded to `size` that it
+ * may write through, and should arelease() the data once it is done.
+ * Blocks that did not come from amalloc(), or that the sender holds no
+ * reference to, are copied as by actor_send_msg().
+ *
+ * @param aid   the Actor to which the message is sent
+ * @param type  a user defined value
+ * @param data  the block; set to NULL when this returns
+ * @param size  the size of the data pointed at by `*data`
+ */
+void actor_send_move(actor_id aid, long type, void **data, size_t size);
+
+
+/**
+ * Share a block from amalloc() with an actor without copying it.
+ * The message holds a reference of its own. The block becomes immutable:
+ * the receiver gets a read-only capability, and on CHERI `*data` is
+ * narrowed to one as well. Blocks that did not come from amalloc() are
+ * copied as by actor_send_msg().
+ *
+ * @param aid   the Actor to which the message is sent
+ * @param type  a user defined value
+ * @param data  the block; narrowed to read-only when this returns, unless
+ *              it was copied or the send failed
+ * @param size  the size of the data pointed at by `*data`
+ */
+void actor_send_ref(actor_id aid, long type, void **data, size_t size);
+
+
+/**
+ * Refers to a message scheduled with actor_send_after() or
+ * actor_send_interval(), until it is cancelled or has been sent for the
+ * last time.
+ */
+typedef void *actor_timer_id;
+
+/**
+ * Send a message after a delay. The data is copied now; the message is
+ * sent from the library's timer thread, so its `sender` is NULL. If the
+ * mailbox is full when the delay passes, the message is rejected as by
+ * actor_try_send_msg().
+ *
+ * @param aid    the Actor to which the message is sent
+ * @param delay  the delay in milliseconds
+ * @param type   a user defined value
+ * @param data   the data to be copied
+ * @param size   the size of the data
+ * @return       the timer, for actor_cancel_timer()
+ */
+actor_timer_id actor_send_after(actor_id aid, long delay, long type, void *data, size_t size);
+
+/**
+ * Send a message every `interval` milliseconds, the first one an interval
+ * from now, until the timer is cancelled or the actor exits. Each message
+ * carries the same data, copied once now. Sends that would overrun the
+ * actor's mailbox are skipped.
+ *
+ * @return  the timer, for actor_cancel_timer()
+ */
+actor_timer_id actor_send_interval(actor_id aid, long interval, long type, void *data, size_t size);
+
+/**
+ * Cancel a timer from actor_send_after() or actor_send_interval(). No
+ * message is sent for it once this returns.
+ *
+ * @return  0 on success, or ESRCH if the timer has already sent its last message or was cancelled
+ */
+int actor_cancel_timer(actor_timer_id timer);
+
+
+/**
+ * Descriptor events, see actor_io_watch().
+ */
+#define ACTOR_IO_READ 0x1
+#define ACTOR_IO_WRITE 0x2
+#define ACTOR_IO_ERROR 0x4 /* reported with the others on an error or hang-up */
+
+/**
+ * The data of ACTOR_MSG_IO and ACTOR_MSG_IO_READ messages.
+ */
+typedef struct actor_io_event_struct {
+    int fd;
+    int events;    /* the ACTOR_IO_* bits that are ready */
+    int error;     /* the errno of a failed read, or 0 */
+    size_t length; /* bytes read by actor_io_read(), 0 at end of file */
+    _Alignas(max_align_t) char data[]; /* the bytes read, for ACTOR_MSG_IO_READ */
+} actor_io_event_t;
+
+/**
+ * Have the library's I/O reactor send the calling actor an ACTOR_MSG_IO
+ * message once `fd` is ready, instead of blocking a thread in read() or
+ * accept(). A watch fires once: watch again after each message. The
+ * descriptor is made non-blocking. Readiness may be spurious, so read or
+ * write until EAGAIN before watching again. Messages from the reactor do
+ * not count against a bounded mailbox.
+ *
+ * @param fd      the descriptor
+ * @param events  ACTOR_IO_READ, ACTOR_IO_WRITE or both
+ * @return        0, EINVAL on a thread that is not an actor, EBUSY if `fd`
+ *                is watched already, or an errno from the poller
+ */
+int actor_io_watch(int fd, int events);
+
+/**
+ * Same as actor_io_watch() for ACTOR_IO_READ, but once `fd` is readable
+ * the reactor reads up to `max` bytes into a block of its own and moves
+ * the block into an ACTOR_MSG_IO_READ message. `length` is 0 at end of
+ * file, and `error` is set if the read failed, or to ENOMEM with no data
+ * if the block could not be allocated.
+ */
+int actor_io_read(int fd, size_t max);
+
+/**
+ * Stop watching `fd`; call this before closing a descriptor that is still
+ * watched. If the reactor is reading `fd` for actor_io_read() or sending
+ * its message, this waits until it is done, so `fd` may be closed as soon
+ * as this returns. A message the reactor has already sent stays in the
+ * mailbox.
+ *
+ * @return  0, or ESRCH if `fd` was not watched
+ */
+int actor_io_unwatch(int fd);
+
+
+/**
+ * Broadcast a message to all actors, the caller included. The data is
+ * copied once: small data goes inline in each message as with
+ * actor_send_msg(), and larger data is shared read-only by every message.
  */
 void actor_broadcast_msg(long type, void *data, size_t size);
 
@@ -175,6 +574,7 @@ void actor_reply_msg(actor_msg_t *a, long type, void *data, size_t size);
 
 /**
  * Receive a message from the actor’s mailbox.
+ * Returns NULL straight away on a thread that is not an actor.
  */
 actor_msg_t *actor_receive();
 
@@ -183,6 +583,46 @@ actor_msg_t *actor_receive();
  */
 actor_msg_t *actor_receive_timeout(long timeout);
 
+/**
+ * A predicate on message types, see actor_receive_match().
+ *
+ * @return  non-zero if messages of `type` should be received
+ */
+typedef int (*actor_match_ptr_t)(long type, void *arg);
+
+/**
+ * Receive the first message whose type `match` accepts, waiting up to
+ * `timeout` milliseconds (0 to wait forever) for one to arrive. Messages
+ * are looked at as actor_receive() would take them, highest lane first,
+ * and the others stay in the mailbox in their order.
+ *
+ * The mailbox is indexed by type, so `match` is called once per type
+ * waiting, not once per message.
+ *
+ * @param match  the predicate, called as `match(type, arg)`
+ * @param arg    passed to `match`
+ * @return       the message, or NULL on timeout
+ */
+actor_msg_t *actor_receive_match(actor_match_ptr_t match, void *arg, long timeout);
+
+/**
+ * Receive the next message of type `type`, leaving the others queued.
+ * Same as actor_receive_match() with a predicate that compares types.
+ */
+actor_msg_t *actor_receive_type(long type, long timeout);
+
+/**
+ * Receive up to `max` messages at once. Waits as actor_receive_timeout()
+ * does for the first message, then takes whatever else is already in the
+ * mailbox without waiting. Each message must be released as usual.
+ *
+ * @param out      filled with the messages, oldest first
+ * @param max      the number of entries in `out`
+ * @param timeout  in milliseconds, or 0 to wait forever
+ * @return         the number of messages received, 0 on timeout
+ */
+size_t actor_receive_batch(actor_msg_t **out, size_t max, long timeout);
+
 /*
  * Enables or disables trap exit for the executing Actor.
  * If enabled, if you spawn an actor, you will receive an ACTOR_MSG_EXITED message when that actor exits.
@@ -192,17 +632,110 @@ actor_msg_t *actor_receive_timeout(long timeout);
  */
 void actor_trap_exit(int action);
 
+/**
+ * Read an actor's mailbox counters. For a pool they are the sums over its
+ * live workers.
+ *
+ * @param aid    the Actor
+ * @param stats  filled in with the counters
+ * @return       0, or ESRCH if `aid` is not a live actor
+ */
+int actor_mailbox_stats(actor_id aid, actor_mailbox_stats_t *stats);
+
+/**
+ * Read an actor's message statistics. The counters are read one by one
+ * while messages flow, so they need not agree with each other exactly.
+ *
+ * @param aid    the Actor
+ * @param stats  filled in with the statistics
+ * @return       0, ESRCH if `aid` is not a live actor, or ENOTSUP if the
+ *               library was built without ACTOR_STATS
+ */
+int actor_stats_get(actor_id aid, actor_stats_t *stats);
+
+/**
+ * Print the message statistics of every live actor, one line each, with
+ * the message rate and the median and 99th percentile time queued.
+ *
+ * @param out  where to print, or NULL for stderr
+ */
+void actor_stats_dump(FILE *out);
+
+/**
+ * The lowest time in nanoseconds counted by a bucket of
+ * actor_stats_t.latency. Buckets are exact below 8 ns; above, there are
+ * four to each power of two, so each is within 25% of its neighbours.
+ */
+uint64_t actor_stats_bucket_ns(unsigned int bucket);
+
+/**
+ * A percentile of the times in actor_stats_t.latency, rounded up to the
+ * top of its bucket.
+ *
+ * @param percentile  from 0 to 100
+ * @return            nanoseconds, or 0 if no message has been received
+ */
+uint64_t actor_stats_percentile(const actor_stats_t *stats, double percentile);
+
+/**
+ * Start recording spawns, sends, receives, exits, amalloc() and arelease()
+ * to a binary trace file, which tools/trace2json.c converts for
+ * chrome://tracing or Perfetto. Setting ACTOR_TRACE_FILE in the
+ * environment starts a trace in actor_init(). Only available when the
+ * library is built with ACTOR_TRACE.
+ *
+ * @param path  the file to write, replaced if it exists
+ * @return      0, EBUSY if a trace is running, ENOTSUP if the library was
+ *              built without ACTOR_TRACE, or the error from open()
+ */
+int actor_trace_start(const char *path);
+
+/**
+ * Write out the events recorded so far and close the trace file.
+ * actor_destroy_all() stops a running trace.
+ *
+ * @return  0, or ENOTSUP if the library was built without ACTOR_TRACE
+ */
+int actor_trace_stop();
+
 /**
  * Gets the actor_id of the executing Actor.
  *
- * @return  the actor_id of the executing Actor.
+ * @return  the actor_id of the executing Actor, or NULL on a thread that
+ *          is not an actor
  */
 actor_id actor_self();
 
-/* Memory management */
+/*
+ * Memory management. Blocks allocated on a thread that is not an actor are
+ * not released automatically, and must be released with arelease().
+ * amalloc() returns NULL for a size of 0 or when memory runs out.
+ */
 void *amalloc(size_t size);
 void arelease(void *block);
 void aretain(void *block);
 
+/**
+ * Allocation counters for the process. Blocks include message headers and
+ * message data as well as amalloc() calls.
+ */
+typedef struct actor_alloc_stats_struct {
+    unsigned long blocks;        /* blocks handed out */
+    unsigned long bytes;         /* bytes asked for */
+    unsigned long slab_blocks;   /* blocks taken from a slab (message headers) */
+    unsigned long arena_blocks;  /* blocks bumped out of the allocating actor's arena */
+    unsigned long heap_blocks;   /* blocks that needed a malloc() of their own */
+    unsigned long mallocs;       /* calls to malloc(), including slab and arena chunks */
+    unsigned long malloc_bytes;  /* bytes asked of malloc() */
+} actor_alloc_stats_t;
+
+/**
+ * Read the allocation counters, which run from actor_init() and include
+ * actors that have exited.
+ *
+ * @param stats  filled in with the current counts
+ */
+void actor_alloc_stats(actor_alloc_stats_t *stats);
+
 
 #endif  // SRC_ACTOR_H_
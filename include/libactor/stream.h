@@ -0,0 +1,131 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_STREAM_H_
+#define SRC_STREAM_H_
+
+/*
+ * Buffered reading and writing on a socket or pipe for the actor that
+ * opens the stream. Whenever the descriptor is not ready the actor waits
+ * for it through the I/O reactor (see actor_io_watch()), so on the worker
+ * pool no thread blocks. An actor waiting on a stream should not have
+ * other actor_io_watch() calls outstanding, as the stream takes the next
+ * ACTOR_MSG_IO message as its own.
+ *
+ * Writes are buffered until the buffer fills, actor_stream_flush() is
+ * called, or a read has to wait for input, so an answer is always sent
+ * before waiting for the next request.
+ *
+ * Timeouts are in milliseconds, 0 to wait forever, and apply to each call.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "libactor/actor.h"
+
+/**
+ * Bytes buffered in each direction. Buffers come from the owning actor's
+ * allocation arena, so opening a stream does not call malloc().
+ */
+#define ACTOR_STREAM_BUFFER_SIZE 4096
+
+struct actor_stream_struct;
+typedef struct actor_stream_struct actor_stream_t;
+
+/**
+ * Open a stream on `fd`, which is made non-blocking. Only the calling
+ * actor may use the stream.
+ *
+ * @return  the stream, or NULL on a thread that is not an actor
+ */
+actor_stream_t *actor_stream_open(int fd);
+
+/**
+ * Flush the stream, close its descriptor and free it.
+ *
+ * @return  0, or the error that stopped the flush
+ */
+int actor_stream_close(actor_stream_t *s);
+
+/**
+ * Why the last call on the stream failed: 0 at the end of the input,
+ * ETIMEDOUT, EMSGSIZE for a line longer than the buffer, or an errno from
+ * the system.
+ */
+int actor_stream_error(actor_stream_t *s);
+
+/**
+ * The number of bytes read from the descriptor and not consumed yet.
+ */
+size_t actor_stream_buffered(actor_stream_t *s);
+
+/**
+ * Read the next line, which ends with "\n" or "\r\n". The line is returned
+ * without its ending and NUL-terminated. It points into the stream's
+ * buffer where it can, and stays valid until the next read.
+ *
+ * @param len  set to the length of the line
+ * @return     the line, or NULL, see actor_stream_error()
+ */
+const char *actor_stream_read_line(actor_stream_t *s, size_t *len, long timeout);
+
+/**
+ * Read up to `max` bytes into a block from amalloc(), which the caller
+ * owns. Once the buffered bytes are used up, the descriptor is read
+ * straight into the block, so it can be shared with other actors using
+ * actor_send_ref() without the data ever being copied.
+ *
+ * @param len  set to the number of bytes in the block
+ * @return     the block, or NULL, see actor_stream_error()
+ */
+void *actor_stream_read(actor_stream_t *s, size_t max, size_t *len, long timeout);
+
+/**
+ * Buffer `len` bytes for writing. Writes that do not fit in the buffer go
+ * out with the buffered bytes in one writev(2), without being copied.
+ *
+ * @return  0, or an error as for actor_stream_error()
+ */
+int actor_stream_write(actor_stream_t *s, const void *data, size_t len, long timeout);
+
+/**
+ * Same as actor_stream_write() for several pieces of data, such as a header
+ * and a body, in order.
+ */
+int actor_stream_writev(actor_stream_t *s, const struct iovec *iov, int iovcnt, long timeout);
+
+/**
+ * Write out the buffered bytes.
+ *
+ * @return  0, or an error as for actor_stream_error()
+ */
+int actor_stream_flush(actor_stream_t *s, long timeout);
+
+/**
+ * Flush the stream, then send `count` bytes of the file `fd` from `offset`
+ * with sendfile(2), so the data never passes through user space. Falls
+ * back to pread(2) where sendfile(2) cannot send to the descriptor.
+ *
+ * @return  0, or an error as for actor_stream_error()
+ */
+int actor_stream_sendfile(actor_stream_t *s, int fd, off_t offset, size_t count, long timeout);
+
+#endif  // SRC_STREAM_H_
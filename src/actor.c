@@ -18,83 +18,347 @@
 */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
+#ifdef __CHERI_PURE_CAPABILITY__
 #include <sys/sysctl.h>
+#endif
 #include <cheri.h>
 #include <cheri/cheri.h>
 
 #include <sys/resource.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
 #define PTHREAD_HANDLE(_t) _t
 
 #include "libactor/actor.h"
 #include "libactor/list.h"
-
-#define ACCESS_ACTORS_BEGIN pthread_mutex_lock(&actors_mutex)
-#define ACCESS_ACTORS_END pthread_mutex_unlock(&actors_mutex)
+#include "alloc.h"
+#include "epoch.h"
+#include "io.h"
+#include "lockprof.h"
+#include "park.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "threads.h"
+#include "timer.h"
+#include "trace.h"
+
+/* The registry lists: spawn, exit and walks over every actor */
+#define ACCESS_ACTORS_BEGIN ACTOR_LOCK(&actors_mutex, ACTOR_LOCK_ACTORS)
+#define ACCESS_ACTORS_END ACTOR_UNLOCK(&actors_mutex)
+
+/* Resolving an actor_id and queueing messages for it, see epoch.h */
+#define READ_ACTORS_BEGIN _actor_epoch_enter()
+#define READ_ACTORS_END _actor_epoch_exit()
 
 /* Private structs */
 
 struct alloc_info_struct {
     struct alloc_info_struct *next;
     void *block;
-    unsigned int refcount;
+    atomic_uint refcount;
+    actor_slab_t *slab;               /* set if the block came from a slab */
+    struct actor_arena_chunk *chunk;  /* set if it came from an arena, otherwise it was malloc()ed */
 };
 typedef struct alloc_info_struct alloc_info_t;
 
+/*
+ * amalloc() records live in a hash table keyed by block address. The table
+ * is split into shards that each have their own lock and grow on their
+ * own, so retain and release of unrelated blocks do not contend.
+ */
+#define ALLOC_SHARDS 64
+
+struct alloc_shard {
+    pthread_mutex_t lock;
+    alloc_info_t **buckets;
+    size_t nbuckets;
+    size_t count;
+};
+
 struct actor_state_struct;
 typedef struct actor_state_struct actor_state_t;
 
-struct actor_alloc {
-    struct actor_alloc *next;
+/* How _actor_send_msg() hands the data over; SEND_SHARE_HELD shares a reference the caller took for the message */
+enum { SEND_COPY, SEND_SHARE, SEND_MOVE, SEND_SHARE_HELD };
+
+/* _actor_send_msg() flags */
+#define SEND_TRY 0x1    /* never wait for room in the mailbox */
+#define SEND_SYSTEM 0x2 /* library notifications, which ignore the mailbox capacity and use the top lane */
+#define SEND_UNBOUNDED 0x4 /* ignore the mailbox capacity */
+
+/*
+ * Messages are allocated as envelopes with links private to the library.
+ * An actor_msg_t * is always the whole envelope, so it can be cast back.
+ */
+struct actor_envelope {
+    actor_msg_t msg;           /* first; msg.next links the receiver's private list */
+    actor_msg_t *prev;
+    actor_msg_t *type_next;    /* next message of the same type, see actor_type_queue */
+    uint64_t seq;              /* arrival order in the private lists */
+    int lane;                  /* ACTOR_PRIORITY_* */
+    bool counted;              /* holds a place in a bounded mailbox */
+#ifdef ACTOR_STATS
+    uint64_t sent;             /* see _actor_clock_ns() */
+#endif
+};
+#define ACTOR_ENVELOPE(_m) ((struct actor_envelope *)(_m))
+
+/* The messages of one type in one lane's private list, oldest first */
+struct actor_type_queue {
+    actor_msg_t *head; /* NULL if the entry is free */
+    actor_msg_t *tail;
+    long type;
+    int lane;
+};
+
+/* One priority level of a mailbox, see actor_state_struct */
+struct actor_lane {
+    _Atomic(actor_msg_t *) inbox;
+    actor_msg_t *messages;
+    actor_msg_t *messages_tail;
+};
+
+/* Selects messages for actor_receive_match() and actor_receive_type() */
+struct actor_match {
+    actor_match_ptr_t fun; /* NULL to match `type` exactly */
+    void *arg;
+    long type;
+};
+
+/* A sender waiting for room in a full mailbox, on its own stack */
+struct actor_space_waiter {
+    struct actor_space_waiter *next;
+    actor_state_t *st;
+    unsigned int generation;
+    actor_task_t *task; /* NULL for thread-per-actor senders, which wait on space_cond */
+};
+
+/* Allocation counters, kept per actor and folded into alloc_stats when it exits */
+enum {
+    ALLOC_STAT_BLOCKS,
+    ALLOC_STAT_BYTES,
+    ALLOC_STAT_SLAB,
+    ALLOC_STAT_ARENA,
+    ALLOC_STAT_HEAP,
+    ALLOC_STAT_HEAP_BYTES,
+    ALLOC_STAT_COUNT
+};
+
+struct actor_pool;
+
+/* An actor's references to a block, released automatically when the actor exits */
+struct actor_ref {
     void *block;
+    unsigned int count;
 };
 
+/*
+ * Actor states live in type-stable slots: a slot is recycled for a later
+ * actor instead of being freed, and its `generation` is bumped whenever an
+ * actor dies. An actor_id is a sealed capability to the actor's slot whose
+ * offset into the slot is the generation, so resolving an ID is an unseal
+ * plus a comparison, and IDs of dead actors stop resolving even once the
+ * slot has been reused. A slot is reused ACTOR_SLOT_SIZE - 1 times at most:
+ * once its generation reaches ACTOR_SLOT_SIZE, which no offset matches,
+ * it is retired for good rather than let a stale ID alias a later actor.
+ *
+ * The mailbox is an intrusive multi-producer/single-consumer queue per
+ * priority lane. Senders push onto a lane's `inbox` with a
+ * compare-and-swap, newest first. The receiver takes the whole inbox with
+ * one exchange when the lane's `messages` runs dry and reverses it, so
+ * `messages` is oldest first and private to the receiver. Receives look at
+ * the highest lane first.
+ *
+ * A bounded mailbox counts its messages in `depth`; a sender reserves a
+ * place before pushing and the receiver gives it back on taking the
+ * message. With ACTOR_OVERFLOW_DROP_OLDEST senders take the oldest message
+ * themselves, so in that mode `messages` is only touched under msg_mutex.
+ *
+ * The private list is doubly linked through the message envelopes. Once an
+ * actor does a selective receive it also indexes the list by type, so
+ * later selective receives look at each type waiting instead of at each
+ * message.
+ *
+ * A receiver sets `waiting` before it checks its mailbox one last time and
+ * sleeps, and a sender looks at it after pushing, so a sender only makes
+ * the wake call when the receiver may be asleep. Thread-per-actor actors
+ * sleep on `waiting` itself, after spinning for up to `spin` polls.
+ *
+ * A pool has a slot of its own, with `pool` set, whose mailbox is never
+ * used: _actor_send_msg() sends to one of the workers instead. Workers
+ * point at their pool with `in_pool` and count every message in `depth`,
+ * bounded or not, for the strategies that look at it.
+ */
 struct actor_state_struct {
     actor_state_t *next;
-    actor_msg_t *messages;
+    actor_state_t *prev;
+    atomic_uint generation;
+    actor_id id; /* for the current generation, set by spawn_actor_opts() */
+    struct actor_lane lanes[ACTOR_PRIORITY_LANES];
+    uint64_t messages_seq;
+    struct actor_type_queue *types; /* hash table, see _actor_index_add() */
+    size_t types_capacity;
+    size_t types_count;
+    bool indexed;
+    actor_function_ptr_t fun; /* what the actor runs, set by _actor_spawn() */
+    actor_handler_ptr_t handler; /* for handler actors, see spawn_actor_handler() */
+    void *args;
+    bool stackless; /* a handler actor that is a stackless task */
     pthread_t thread;
-    pthread_cond_t msg_cond;
+    actor_task_t *task; /* set instead of `thread` when running on the scheduler */
+    atomic_uint waiting;
+    unsigned int spin; /* adapts to how long replies take, see _actor_receive_spin() */
     pthread_mutex_t msg_mutex;
-    list_item_t *allocs;
+    size_t capacity; /* 0 if unbounded */
+    int overflow;
+    atomic_size_t depth;
+    atomic_ulong rejected;
+    atomic_ulong dropped;
+    struct actor_space_waiter *space_waiters; /* protected by msg_mutex */
+    atomic_uint space_waiting;
+    pthread_cond_t space_cond;
+    struct actor_ref *refs; /* hash table, see _actor_refs_add() */
+    size_t refs_capacity;
+    size_t refs_count;
+    actor_arena_t arena; /* message data and amalloc() blocks */
+    atomic_ulong alloc_stats[ALLOC_STAT_COUNT];
+#ifdef ACTOR_STATS
+    actor_stats_counters_t *stats; /* allocated with the slot's first actor */
+#endif
+    struct actor_pool *pool;    /* for a pool's own slot, see spawn_actor_pool() */
+    struct actor_pool *in_pool; /* for its workers */
     actor_id trap_exit_to;
     char trap_exit;
 };
 
-struct actor_spawn_info {
-    actor_state_t *state;
-    actor_function_ptr_t fun;
-    void *args;
+#define ACTOR_SLOT_SIZE 1024
+#define ACTOR_SLOT_CHUNK 64 /* slots carved from each aligned_alloc() */
+_Static_assert(sizeof(actor_state_t) <= ACTOR_SLOT_SIZE, "actor_state_t does not fit in a slot");
+
+#define ACTOR_SPIN_MIN 16     /* mailbox polls before a receiving thread yields, at the least */
+#define ACTOR_SPIN_MAX 4096   /* and at the most */
+#define ACTOR_SPIN_YIELDS 4   /* sched_yield() calls before it sleeps */
+
+#define ACTOR_HANDLER_BATCH 64 /* messages a stackless handler actor takes before it yields its worker */
+
+/* A point on a pool's hash ring */
+struct actor_pool_point {
+    uint64_t hash;
+    unsigned int worker;
 };
 
+#define ACTOR_POOL_POINTS 64 /* points on the hash ring per worker, so that keys spread evenly */
+
+/*
+ * A pool of workers behind one actor_id. The pool stays until its last
+ * worker exits; `live` counts the workers that have not, plus one for
+ * spawn_actor_pool() while it runs. Senders read `workers` in read
+ * sections and skip the IDs that no longer resolve.
+ */
+struct actor_pool {
+    actor_state_t *state; /* the pool's own slot */
+    int strategy;
+    unsigned int count;
+    atomic_uint live;
+    atomic_uint next;               /* ACTOR_POOL_ROUND_ROBIN's turn */
+    struct actor_pool_point *ring;  /* for ACTOR_POOL_HASH, sorted by hash */
+    _Atomic(actor_id) workers[];    /* NULL until spawned; senders may read them meanwhile */
+};
+
+/*
+ * A message to send later. These live in type-stable slots as actor states
+ * do: an actor_timer_id is a sealed capability to the slot whose offset is
+ * the generation, and the generation is bumped once the timer is cancelled
+ * or commits to its last message. As with actor states, a slot whose
+ * generation reaches ACTOR_TIMER_SLOT_SIZE is not reused.
+ */
+struct actor_send_timer {
+    actor_timer_t timer;
+    struct actor_send_timer *next;      /* every slot */
+    struct actor_send_timer *next_free; /* recycled slots */
+    unsigned int generation;            /* protected by actor_timers_mutex, as are the slot lists */
+    unsigned int armed;                 /* the generation while the timer is pending */
+    actor_id dest;
+    long type;
+    void *data; /* copied once, shared by each message */
+    size_t size;
+    uint64_t interval; /* nanoseconds, 0 for a single message */
+};
+
+#define ACTOR_TIMER_SLOT_SIZE 256
+_Static_assert(sizeof(struct actor_send_timer) <= ACTOR_TIMER_SLOT_SIZE, "actor_send_timer does not fit in a slot");
+
 /* Internal state */
 static pthread_mutex_t actors_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t actors_cond = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t actors_alloc = PTHREAD_MUTEX_INITIALIZER;
 static int actors_ready = 0;
-static list_item_t *actor_list_real;
-static list_item_t **actor_list = &actor_list_real;
+static actor_state_t *actor_list; /* live actors */
+static size_t actor_count;
+static unsigned int actor_spin_max = ACTOR_SPIN_MAX; /* 0 on a single CPU, where spinning cannot help */
+static actor_state_t *actor_free_head; /* recycled slots, reused oldest first */
+static actor_state_t *actor_free_tail;
+static actor_state_t *actor_retired; /* slots whose generations are used up, see actor_state_struct */
+static void **actor_slot_chunks; /* every chunk of slots, freed by actor_destroy_all() */
+static size_t actor_slot_chunks_count;
 
-static list_item_t *alloc_list_real;
-static list_item_t **alloc_list = &alloc_list_real;
+static struct alloc_shard alloc_table[ALLOC_SHARDS];
+static actor_slab_t alloc_info_slab;
+static actor_slab_t msg_slab;
+static atomic_ulong alloc_stats[ALLOC_STAT_COUNT]; /* non-actors and exited actors */
+
+static pthread_mutex_t actor_timers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct actor_send_timer *actor_timer_slots;
+static struct actor_send_timer *actor_timer_free;
+
+static _Thread_local unsigned int actor_pool_seed; /* for ACTOR_POOL_TWO_CHOICES, seeded on first use */
 
 
 /* Only use these functions if you know what you are doing
    (pthreads + concurrent memory access = death)
 */
-static void *_actor_copy_message_data(void *data, size_t size, pthread_t thread);
-static actor_msg_t *_actor_create_msg(long type, void *data, size_t size, bool copy_data, actor_id sender, actor_id dest, pthread_t thread);
-static void *_amalloc_thread(size_t size, pthread_t thread);
-static void _aretain_thread(void *block, pthread_t thread);
-static void _arelease(void *block, pthread_t thread);
-static void _actor_send_msg(actor_id aid, long type, void *data, size_t size, bool copy_data);
+static void *_actor_copy_message_data(void *data, size_t size, actor_state_t *self);
+static actor_msg_t *_actor_create_msg(long type, void *data, size_t size, int how, actor_state_t *self, actor_id dest);
+static void *_amalloc_actor(size_t size, actor_state_t *self, bool tracked);
+static actor_msg_t *_amalloc_msg(actor_state_t *self);
+static actor_msg_t *_actor_mailbox_take(actor_state_t *st, struct actor_match *match);
+static void _actor_mailbox_push(actor_state_t *st, actor_msg_t *newest, actor_msg_t *oldest);
+static void _actor_mailbox_notify(actor_state_t *st);
+static int _actor_has_messages(void *arg);
+static void _actor_adopt_msg(actor_state_t *st, actor_msg_t *msg);
+static void _alloc_free(alloc_info_t *info);
+static void _alloc_table_grow(struct alloc_shard *shard);
+static bool _actor_msg_inline(actor_msg_t *msg);
+static void _actor_mailbox_wake_senders(actor_state_t *st);
+static bool _alloc_retain_n(void *block, unsigned int count);
+static bool _aretain_actor(void *block, actor_state_t *owner);
+static bool _alloc_known(const void *block);
+static void _arelease_actor(const void *block, actor_state_t *owner);
+static void _actor_refs_add(actor_state_t *st, void *block);
+static bool _actor_refs_remove(actor_state_t *st, const void *block);
+static int _actor_send_msg(actor_id aid, long type, void *data, size_t size, int how, int lane, int flags);
+static int _actor_send_msg_shared(actor_id aid, long type, void *data, size_t size, int how, int lane, int flags,
+                                  bool *shared);
 static void _actor_release_memory(actor_state_t *state);
+static void _actor_retire_state(actor_state_t *state);
 static void _actor_destroy_state(actor_state_t *state);
-static void _actor_init_state(actor_state_t **state);
+static void _actor_grow_slots();
+static void _actor_init_state(actor_state_t **state, const actor_opts_t *opts);
+static actor_state_t *_actor_current();
+static actor_state_t *_actor_resolve(actor_id aid);
+static actor_id _actor_id(actor_state_t *st);
 static actor_id _actor_find_by_thread();
+static actor_state_t *_actor_pool_route(struct actor_pool *pool, unsigned long key);
+static void _actor_pool_exit(struct actor_pool *pool);
+static void _actor_pool_free(struct actor_pool *pool);
 
+#ifdef __CHERI_PURE_CAPABILITY__
 // https://capabilitiesforcoders.com/faq/how_to_seal.html
 void * get_system_sealer() {
     void * sealcap;
@@ -117,8 +381,16 @@ void * get_derived_sealer() {
     }
     return sealer;
 }
+#else
+/* Without CHERI sealing does nothing, so any sealer will do */
+void * get_derived_sealer() {
+    static char sealer;
+    return &sealer;
+}
+#endif
 
 static void *actor_id_sealer;
+static void *actor_timer_sealer; /* the next object type, so timer IDs never resolve as actors */
 
 /*------------------------------------------------------------------------------
                            initialization and management
@@ -126,25 +398,42 @@ static void *actor_id_sealer;
 
 void actor_init() {
     actor_id_sealer = get_derived_sealer();
+    actor_timer_sealer = cheri_offset_set(actor_id_sealer, (cheri_offset_get(actor_id_sealer) + 1) % cheri_length_get(actor_id_sealer));
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) actor_spin_max = 0;
+
+    ACTOR_LOCK(&actors_mutex, ACTOR_LOCK_ACTORS);
+    for (size_t x = 0; x < ALLOC_SHARDS; x++) {
+        pthread_mutex_init(&alloc_table[x].lock, NULL);
+        _alloc_table_grow(&alloc_table[x]);
+    }
+    _actor_slab_init(&alloc_info_slab, sizeof(alloc_info_t));
+    _actor_slab_init(&msg_slab, sizeof(struct actor_envelope));
+    actors_ready = 1;
+    ACTOR_UNLOCK(&actors_mutex);
+
+    _actor_trace_init();
+}
 
-    assert(actor_list != NULL);
-    if (actor_list == NULL) {
-        pthread_mutex_lock(&actors_mutex);
-        list_init(actor_list);
-        list_init(alloc_list);
-        actors_ready = 1;
-        pthread_mutex_unlock(&actors_mutex);
+void actor_init_scheduler(unsigned int workers) {
+    actor_init();
+    if (_actor_sched_start(workers) != 0) {
+        fprintf(stderr, "Fatal error. Cannot start the actor scheduler.");
+        exit(1);
     }
 }
 
+int actor_prespawn_threads(unsigned int count, size_t stack_size) {
+    return _actor_thread_prestart(count, stack_size);
+}
+
 void actor_wait_finish() {
     int cont = 1;
     struct timespec ts;
     struct timeval tp;
 
     while (cont == 1) {
-        pthread_mutex_lock(&actors_mutex);
-        if (list_count(actor_list) == 0) {
+        ACTOR_LOCK(&actors_mutex, ACTOR_LOCK_ACTORS);
+        if (actor_count == 0) {
             goto end;
         } else {
             gettimeofday(&tp, NULL);
@@ -152,39 +441,101 @@ void actor_wait_finish() {
             ts.tv_sec = tp.tv_sec;
             ts.tv_nsec = tp.tv_usec * 1000;
             ts.tv_sec += 10;
+            ACTOR_LOCK_COND_BEGIN(&actors_mutex);
             pthread_cond_timedwait(&actors_cond, &actors_mutex, &ts);
+            ACTOR_LOCK_COND_END(&actors_mutex, ACTOR_LOCK_ACTORS);
         }
-        pthread_mutex_unlock(&actors_mutex);
+        ACTOR_UNLOCK(&actors_mutex);
     }
 end:
     actors_ready = 0;
-    pthread_mutex_unlock(&actors_mutex);
+    ACTOR_UNLOCK(&actors_mutex);
+}
+
+static void _actor_free_slot(actor_state_t *st) {
+    /* Pools whose workers were still running */
+    if (st->pool != NULL) _actor_pool_free(st->pool);
+    _actor_arena_release(&st->arena);
+    free(st->types);
+    free(st->refs);
+#ifdef ACTOR_STATS
+    free(st->stats);
+#endif
+    pthread_mutex_destroy(&st->msg_mutex);
+    pthread_cond_destroy(&st->space_cond);
 }
 
 void actor_destroy_all() {
-    void *temp;
+    struct actor_send_timer *timer;
+    actor_state_t *st;
     alloc_info_t *info;
 
-    pthread_mutex_lock(&actors_mutex);
+    /* First, so that no timer fires into a torn-down runtime; their data goes with the other blocks below */
+    _actor_timer_stop();
+    while ((timer = actor_timer_slots) != NULL) {
+        actor_timer_slots = timer->next;
+        free(timer);
+    }
+    actor_timer_free = NULL;
+
+    /* Likewise for the reactor, whose watches need nothing freeing */
+    _actor_io_stop();
+
+    _actor_sched_stop();
+    _actor_thread_stop();
+    _actor_trace_shutdown();
+
+    ACTOR_LOCK(&actors_mutex, ACTOR_LOCK_ACTORS);
 
     /* Clean up actor list */
-    while ((temp = list_pop(actor_list)) != NULL) {
-        free(temp);
+    while ((st = actor_list) != NULL) {
+        actor_list = st->next;
+        _actor_free_slot(st);
     }
+    actor_count = 0;
+    while ((st = actor_free_head) != NULL) {
+        actor_free_head = st->next;
+        _actor_free_slot(st);
+    }
+    actor_free_tail = NULL;
+    while ((st = actor_retired) != NULL) {
+        actor_retired = st->next;
+        _actor_free_slot(st);
+    }
+    for (size_t x = 0; x < actor_slot_chunks_count; x++) free(actor_slot_chunks[x]);
+    free(actor_slot_chunks);
+    actor_slot_chunks = NULL;
+    actor_slot_chunks_count = 0;
 
-    pthread_mutex_unlock(&actors_mutex);
+    ACTOR_UNLOCK(&actors_mutex);
     pthread_mutex_destroy(&actors_mutex);
-    pthread_mutex_destroy(&actors_alloc);
     pthread_cond_destroy(&actors_cond);
 
     /* Clean up memory */
-    for (info = list_pop(alloc_list); info != NULL; info = list_pop(alloc_list)) {
+    for (size_t x = 0; x < ALLOC_SHARDS; x++) {
+        struct alloc_shard *shard = &alloc_table[x];
+        for (size_t y = 0; y < shard->nbuckets; y++) {
+            while ((info = shard->buckets[y]) != NULL) {
 #ifdef DEBUG_MEMORY
-        printf("Unfreed block found.\n");
+                printf("Unfreed block found.\n");
 #endif
-        free(info->block);
-        free(info);
+                shard->buckets[y] = info->next;
+                _alloc_free(info);
+            }
+        }
+        free(shard->buckets);
+        shard->buckets = NULL;
+        shard->nbuckets = 0;
+        shard->count = 0;
+        pthread_mutex_destroy(&shard->lock);
     }
+    _actor_slab_destroy(&msg_slab);
+    _actor_slab_destroy(&alloc_info_slab);
+    for (size_t x = 0; x < ALLOC_STAT_COUNT; x++) atomic_store(&alloc_stats[x], 0);
+
+#ifdef ACTOR_LOCK_PROFILE
+    _actor_lock_report(stderr);
+#endif
 }
 
 
@@ -192,427 +543,2001 @@ void actor_destroy_all() {
                                    spawn_actor
 ------------------------------------------------------------------------------*/
 
-static void *spawn_actor_fun(void *arg) {
-    struct actor_spawn_info *si = (struct actor_spawn_info *)arg;
-
-    ACCESS_ACTORS_BEGIN;
-    si->state->thread = pthread_self();
-    ACCESS_ACTORS_END;
+/* Once the actor's function or handler is done */
+static void _actor_exit(actor_state_t *state) {
+    struct actor_pool *pool = state->in_pool; /* the slot may be reused once destroyed */
 
-    (si->fun)(si->args);
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_EXIT, state->id, NULL, 0);
 
-    ACCESS_ACTORS_BEGIN;
+    if (state->trap_exit_to != 0) {
+        READ_ACTORS_BEGIN;
+        _actor_send_msg(state->trap_exit_to, ACTOR_MSG_EXITED, NULL, 0, SEND_COPY, 0, SEND_SYSTEM);
+        READ_ACTORS_END;
+    }
 
-    if (si->state->trap_exit_to != 0) _actor_send_msg(si->state->trap_exit_to, ACTOR_MSG_EXITED, NULL, 0, true);
-    _actor_release_memory(si->state);
-    _actor_destroy_state(si->state);
-    free(si);
+    /* Once senders that resolved the actor are done, nothing more reaches its mailbox */
+    _actor_retire_state(state);
+    _actor_epoch_synchronize();
 
+    ACCESS_ACTORS_BEGIN;
+    _actor_release_memory(state);
+    _actor_destroy_state(state);
     pthread_cond_signal(&actors_cond);
     ACCESS_ACTORS_END;
 
-    pthread_detach(pthread_self());
-
-    pthread_exit((void *)NULL);
+    if (pool != NULL && atomic_fetch_sub(&pool->live, 1) == 1) _actor_pool_exit(pool);
 }
 
-actor_id spawn_actor(actor_function_ptr_t func, void *args) {
-    actor_state_t *state;
-    actor_id aid;
-    struct actor_spawn_info *si;
-
-    assert(func != NULL);
-
-    ACCESS_ACTORS_BEGIN;
-
-    _actor_init_state(&state);
-
-    assert(state != NULL);
-
-    aid = cheri_seal(state, actor_id_sealer);
-    si = (struct actor_spawn_info *)malloc(sizeof(struct actor_spawn_info));
-    assert(si != NULL);
-    si->state = state;
-    si->fun = func;
-    si->args = args;
+static void _actor_run(actor_state_t *state) {
+    (state->fun)(state->args);
+    _actor_exit(state);
+}
 
+/* satisfies actor_thread_function_ptr_t */
+static void spawn_actor_thread(void *arg) {
+    actor_state_t *state = (actor_state_t *)arg;
 
-    pthread_create(&state->thread, NULL, spawn_actor_fun, si);
+    state->thread = pthread_self();
+    _actor_sched_set_local(state);
 
-    ACCESS_ACTORS_END;
+    _actor_run(state);
 
-    return aid;
+    /* The thread goes back to the cache and may run another actor */
+    _actor_sched_set_local(NULL);
 }
 
+/* satisfies actor_task_function_ptr_t */
+static void spawn_actor_task(void *arg) {
+    actor_state_t *state = (actor_state_t *)arg;
 
-/*------------------------------------------------------------------------------
-                                 helper functions
-------------------------------------------------------------------------------*/
-
+    /* Set here rather than by the spawner, which a worker may beat to it; senders read `task` once it waits */
+    state->task = _actor_sched_current();
+    _actor_sched_set_local(state);
 
-/* satisfies list_filter_func_ptr_t */
-static int find_thread(void *item, void *arg) {
-    int ret = -1;
-    actor_state_t *st = (actor_state_t *)item;
-    if (PTHREAD_HANDLE(st->thread) == arg) ret = 0;
-    return ret;
+    _actor_run(state);
 }
 
-/* satisfies list_filter_func_ptr_t */
-static int find_by_id(void *item, void *arg) {
-    int ret = -1;
-    actor_state_t *st = ((actor_state_t *)item);
-    if (st == cheri_unseal(arg, actor_id_sealer)) ret = 0;
-    return ret;
+/* A handler's message and its data go once the handler returns, unless it retained them */
+static void _actor_handler_release(actor_msg_t *msg) {
+    if (!_actor_msg_inline(msg)) arelease((void *)msg->data);
+    arelease(msg);
 }
 
+/* satisfies actor_function_ptr_t; a handler actor on a thread of its own */
+static void *_actor_handler_loop(void *args) {
+    actor_state_t *state = _actor_current();
+    actor_msg_t *msg;
+    int done;
 
-static actor_id _actor_find_by_thread() {
-    actor_state_t *st = NULL;
-    pthread_t thread = pthread_self();
-
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(thread));
-
-    return cheri_seal(st, actor_id_sealer);
-}
+    do {
+        msg = actor_receive();
+        done = (state->handler)(msg, args);
+        _actor_handler_release(msg);
+    } while (!done);
 
-actor_id actor_self() {
-    actor_id aid = 0;
-    ACCESS_ACTORS_BEGIN;
-    aid = _actor_find_by_thread();
-    ACCESS_ACTORS_END;
-    return aid;
+    return NULL;
 }
 
+/*
+ * satisfies actor_task_function_ptr_t; a handler actor on the worker pool.
+ * Called from the top each time the task runs, it handles what is in the
+ * mailbox and returns, suspended if the mailbox is empty.
+ */
+static void _actor_handler_task(void *arg) {
+    actor_state_t *state = (actor_state_t *)arg;
+    actor_msg_t *msg;
+    int done;
+
+    if (state->task == NULL) {
+        state->task = _actor_sched_current();
+        _actor_sched_set_local(state);
+    }
+    atomic_store_explicit(&state->waiting, 0, memory_order_relaxed);
+
+    for (int x = 0; x < ACTOR_HANDLER_BATCH; x++) {
+        if ((msg = _actor_mailbox_take(state, NULL)) == NULL) {
+            /* As in _actor_receive_wait(), but the worker parks the task once we return */
+            atomic_store_explicit(&state->waiting, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (!_actor_has_messages(state)) {
+                _actor_sched_suspend(&state->msg_mutex, _actor_has_messages, state);
+                return;
+            }
+            atomic_store_explicit(&state->waiting, 0, memory_order_relaxed);
+            continue;
+        }
 
-/*------------------------------------------------------------------------------
-                                state management
-------------------------------------------------------------------------------*/
-
-static actor_id _actor_trapexit_to() {
-    actor_state_t *st;
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(pthread_self()));
-
-    if (st != NULL && st->trap_exit == 1) return cheri_seal(st, actor_id_sealer);
+        _actor_adopt_msg(state, msg);
+        done = (state->handler)(msg, state->args);
+        _actor_handler_release(msg);
+        if (done) {
+            _actor_exit(state);
+            return;
+        }
+    }
 
-    return 0;
+    /* Let the other tasks on this worker run */
+    _actor_sched_yield();
 }
 
-void actor_trap_exit(int action) {
-    actor_state_t *st;
+static actor_id _actor_spawn(actor_function_ptr_t func, actor_handler_ptr_t handler, void *args,
+                             const actor_opts_t *opts, struct actor_pool *pool) {
+    actor_state_t *state;
+    actor_id aid;
+    size_t stack_size = opts != NULL ? opts->stack_size : 0;
+    int err = 0;
 
     ACCESS_ACTORS_BEGIN;
 
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(pthread_self()));
+    _actor_init_state(&state, opts);
 
-    if (st != NULL) st->trap_exit = action == 0 ? 0 : 1;
+    assert(state != NULL);
 
-    ACCESS_ACTORS_END;
-}
+    aid = state->id = _actor_id(state);
+    state->fun = func;
+    state->handler = handler;
+    state->args = args;
+    state->stackless = handler != NULL && _actor_sched_active();
+    if ((state->in_pool = pool) != NULL) state->trap_exit_to = NULL; /* the pool reports its exit instead */
 
-static void _actor_init_state(actor_state_t **state) {
-    actor_state_t *t;
-    assert(state != NULL);
+    ACCESS_ACTORS_END;
 
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_SPAWN, actor_self(), aid, 0);
+
+    /* The state is in the actor list already; the new actor may finish before this returns */
+    if (state->stackless)
+        _actor_sched_spawn_stackless(_actor_handler_task, state);
+    else if (_actor_sched_active())
+        err = _actor_sched_spawn(spawn_actor_task, state, stack_size) == NULL ? errno : 0;
+    else
+        err = _actor_thread_spawn(spawn_actor_thread, state, stack_size);
+
+    if (err != 0) {
+        /* The actor never ran, and only we have its ID */
+        ACTOR_TRACE_EVENT(ACTOR_TRACE_EXIT, aid, NULL, 0);
+        _actor_retire_state(state);
+        ACCESS_ACTORS_BEGIN;
+        _actor_destroy_state(state);
+        pthread_cond_signal(&actors_cond);
+        ACCESS_ACTORS_END;
+        errno = err;
+        return NULL;
+    }
 
-    t = (actor_state_t *)malloc(sizeof(actor_state_t));
-    t->trap_exit_to = _actor_trapexit_to();
-    t->trap_exit = 0;
-    pthread_cond_init(&t->msg_cond, NULL);
-    pthread_mutex_init(&t->msg_mutex, NULL);
-    list_init((list_item_t **)&t->messages);
-    list_init(&t->allocs);
+    return aid;
+}
 
-    list_append(actor_list, t);
+actor_id spawn_actor(actor_function_ptr_t func, void *args) {
+    return spawn_actor_opts(func, args, NULL);
+}
 
+actor_id spawn_actor_opts(actor_function_ptr_t func, void *args, const actor_opts_t *opts) {
+    assert(func != NULL);
 
-    *state = t;
+    return _actor_spawn(func, NULL, args, opts, NULL);
 }
 
-static void _actor_destroy_state(actor_state_t *state) {
-    if (state == NULL) return;
+actor_id spawn_actor_handler(actor_handler_ptr_t handler, void *args, const actor_opts_t *opts) {
+    assert(handler != NULL);
 
-    pthread_cond_destroy(&state->msg_cond);
-    pthread_mutex_destroy(&state->msg_mutex);
-    list_remove(actor_list, state);
-    free(state);
+    return _actor_spawn(_actor_handler_loop, handler, args, opts, NULL);
 }
 
 
 /*------------------------------------------------------------------------------
-                                    messaging
+                                   actor pools
 ------------------------------------------------------------------------------*/
-static void *_actor_copy_message_data(void *data, size_t size, pthread_t thread) {
-    void *newblock = _amalloc_thread(size, thread);
 
-    return memcpy(newblock, data, size);
+static uint64_t _actor_pool_hash(uint64_t x) {
+    /* The splitmix64 finaliser, so that nearby keys land far apart on the ring */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
 }
 
-static actor_msg_t *_actor_create_msg(long type, void *data, size_t size, bool copy_data, actor_id sender, actor_id dest, pthread_t thread) {
-    actor_msg_t *msg = (actor_msg_t *)_amalloc_thread(sizeof(actor_msg_t), thread);
+static int _actor_pool_point_compare(const void *a, const void *b) {
+    const struct actor_pool_point *x = (const struct actor_pool_point *)a, *y = (const struct actor_pool_point *)b;
 
-    if (copy_data) {
-        data = _actor_copy_message_data(data, size, thread);
-    } else {
-        _aretain_thread(data, thread);
-    }
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return 0;
+}
 
-    const void *msgdata = cheri_perms_and(data, CHERI_PERM_LOAD);
+static struct actor_pool_point *_actor_pool_ring(unsigned int count) {
+    struct actor_pool_point *ring;
+    size_t x, points = (size_t)count * ACTOR_POOL_POINTS;
 
-    msg->type = type;
-    msg->data = msgdata;
-    msg->size = size;
-    msg->dest = dest;
-    msg->sender = sender;
+    ring = (struct actor_pool_point *)malloc(points * sizeof(struct actor_pool_point));
+    assert(ring != NULL);
+    for (x = 0; x < points; x++) {
+        ring[x].worker = (unsigned int)(x / ACTOR_POOL_POINTS);
+        ring[x].hash = _actor_pool_hash(((uint64_t)ring[x].worker << 32) | (x % ACTOR_POOL_POINTS));
+    }
+    qsort(ring, points, sizeof(struct actor_pool_point), _actor_pool_point_compare);
 
-    return msg;
+    return ring;
 }
 
-actor_msg_t *actor_receive() {
-    return actor_receive_timeout(0);
+static void _actor_pool_free(struct actor_pool *pool) {
+    free(pool->ring);
+    free(pool);
 }
 
-actor_msg_t *actor_receive_timeout(long timeout) {
-    actor_state_t *st = NULL;
-    actor_msg_t *msg = NULL;
-    pthread_t thread = pthread_self();
-    struct timespec ts;
-    struct timeval tp;
+/* Once the last worker has exited: the pool exits as an actor would */
+static void _actor_pool_exit(struct actor_pool *pool) {
+    actor_state_t *state = pool->state;
+    actor_state_t *to;
+    actor_msg_t *msg;
+
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_EXIT, state->id, NULL, 0);
+
+    /* As _actor_send_msg() would, but from the pool rather than from the worker that exited last */
+    READ_ACTORS_BEGIN;
+    if ((to = _actor_resolve(state->trap_exit_to)) != NULL) {
+        msg = _actor_create_msg(ACTOR_MSG_EXITED, NULL, 0, SEND_COPY, NULL, state->trap_exit_to);
+        msg->sender = state->id;
+        ACTOR_ENVELOPE(msg)->lane = ACTOR_PRIORITY_SYSTEM;
+        ACTOR_STATS_ENQUEUE(to, 1, 0);
+        _actor_mailbox_push(to, msg, msg);
+        _actor_mailbox_notify(to);
+    }
+    READ_ACTORS_END;
 
-    memset(&ts, 0, sizeof(struct timespec));
+    /* Once senders that resolved the pool are done, nothing reads `pool` */
+    _actor_retire_state(state);
+    _actor_epoch_synchronize();
 
     ACCESS_ACTORS_BEGIN;
-    ACTOR_THREAD_PRINT("actor_receive_msg()\n");
+    state->pool = NULL;
+    _actor_destroy_state(state);
+    pthread_cond_signal(&actors_cond);
+    ACCESS_ACTORS_END;
 
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(thread));
+    _actor_pool_free(pool);
+}
 
-    if (st != NULL) {
-        msg = list_pop((list_item_t **)&st->messages);
+actor_id spawn_actor_pool(actor_function_ptr_t func, void *args, unsigned int n, int strategy) {
+    struct actor_pool *pool;
+    actor_state_t *state;
+    actor_id aid, worker;
+    unsigned int spawned = 0;
+    int err = 0;
 
-        pthread_mutex_lock(&st->msg_mutex);
+    assert(func != NULL && n > 0);
 
-        ACCESS_ACTORS_END;
+    pool = (struct actor_pool *)malloc(sizeof(struct actor_pool) + n * sizeof(actor_id));
+    assert(pool != NULL);
+    pool->strategy = strategy;
+    pool->count = n;
+    atomic_init(&pool->live, n + 1);
+    atomic_init(&pool->next, 0);
+    pool->ring = strategy == ACTOR_POOL_HASH ? _actor_pool_ring(n) : NULL;
+    for (unsigned int x = 0; x < n; x++) atomic_init(&pool->workers[x], NULL);
 
-        if (msg == NULL) { /* no messages available, let's wait */
-            if (timeout > 0) {
-                gettimeofday(&tp, NULL);
-                ts.tv_sec = tp.tv_sec;
-                ts.tv_nsec = (tp.tv_usec * 1000) + (timeout * 1000000);
-                if (pthread_cond_timedwait(&st->msg_cond, &st->msg_mutex, &ts) == 0) {
-                    msg = list_pop((list_item_t **)&st->messages);
-                }
-            } else {
-                pthread_cond_wait(&st->msg_cond, &st->msg_mutex);
-            }
-            msg = list_pop((list_item_t **)&st->messages);
+    ACCESS_ACTORS_BEGIN;
+    _actor_init_state(&state, NULL);
+    aid = state->id = _actor_id(state);
+    state->fun = NULL;
+    state->handler = NULL;
+    state->args = NULL;
+    state->stackless = false;
+    state->pool = pool;
+    pool->state = state;
+    ACCESS_ACTORS_END;
+
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_SPAWN, actor_self(), aid, 0);
+
+    for (unsigned int x = 0; x < n; x++) {
+        if ((worker = _actor_spawn(func, NULL, args, NULL, pool)) != NULL) {
+            atomic_store_explicit(&pool->workers[x], worker, memory_order_release);
+            spawned++;
+        } else {
+            /* Not the last reference, which is ours */
+            err = errno;
+            atomic_fetch_sub(&pool->live, 1);
         }
-        pthread_mutex_unlock(&st->msg_mutex);
-    } else {
-        ACCESS_ACTORS_END;
     }
 
-    return msg;
+    /* The workers may all have finished already */
+    if (atomic_fetch_sub(&pool->live, 1) == 1) _actor_pool_exit(pool);
+
+    if (spawned == 0) {
+        errno = err;
+        return NULL;
+    }
+    return aid;
 }
 
-void actor_reply_msg(actor_msg_t *a, long type, void *data, size_t size) {
-    if (a == NULL) return;
-    actor_send_msg(a->sender, type, data, size);
+static unsigned int _actor_pool_random() {
+    if (actor_pool_seed == 0) actor_pool_seed = (unsigned int)(uintptr_t)&actor_pool_seed ^ (unsigned int)time(NULL);
+    return (unsigned int)rand_r(&actor_pool_seed);
 }
 
-void actor_broadcast_msg(long type, void *data, size_t size) {
-    actor_id *lst = NULL;
-    actor_state_t *st;
-    size_t count = 0;
-    size_t x = 0;
+/* Called in a read section. Worker `x`, or NULL if it has exited or is not spawned yet. */
+static actor_state_t *_actor_pool_worker(struct actor_pool *pool, unsigned int x) {
+    return _actor_resolve(atomic_load_explicit(&pool->workers[x], memory_order_acquire));
+}
 
-    ACCESS_ACTORS_BEGIN;
+/* The next live worker from `x` on, or NULL if they have all exited */
+static actor_state_t *_actor_pool_scan(struct actor_pool *pool, unsigned int x) {
+    actor_state_t *st;
 
-    count = list_count(actor_list);
-    lst = _amalloc_thread(sizeof(actor_id) * count, pthread_self());
-    for (st = (actor_state_t *)*actor_list; st != NULL; st = st->next) {
-        lst[x] = cheri_seal(st, actor_id_sealer);
-        x++;
+    for (unsigned int y = 0; y < pool->count; y++) {
+        if ((st = _actor_pool_worker(pool, (x + y) % pool->count)) != NULL) return st;
     }
+    return NULL;
+}
 
-    char *copied_data = _actor_copy_message_data(data, size, NULL);
-
-    for (x = 0; x < count; x++) {
-        _actor_send_msg(lst[x], type, copied_data, size, false);
+/* The worker with the fewest messages queued, starting the search at random so that ties spread out */
+static actor_state_t *_actor_pool_least(struct actor_pool *pool) {
+    actor_state_t *st, *best = NULL;
+    size_t depth, best_depth = SIZE_MAX;
+    unsigned int x = _actor_pool_random();
+
+    for (unsigned int y = 0; y < pool->count && best_depth > 0; y++) {
+        if ((st = _actor_pool_worker(pool, (x + y) % pool->count)) == NULL) continue;
+        if ((depth = atomic_load_explicit(&st->depth, memory_order_relaxed)) < best_depth) {
+            best = st;
+            best_depth = depth;
+        }
     }
+    return best;
+}
 
-    ACCESS_ACTORS_END;
+/* The live worker that owns `key`'s place on the ring, or the next one round */
+static actor_state_t *_actor_pool_owner(struct actor_pool *pool, unsigned long key) {
+    size_t points = (size_t)pool->count * ACTOR_POOL_POINTS;
+    size_t low = 0, high = points, mid;
+    uint64_t hash = _actor_pool_hash(key);
+    actor_state_t *st;
 
-    arelease(lst);
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (pool->ring[mid].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for (size_t x = 0; x < points; x++) {
+        if ((st = _actor_pool_worker(pool, pool->ring[(low + x) % points].worker)) != NULL) return st;
+    }
+    return NULL;
 }
 
-void actor_send_msg(actor_id aid, long type, void *data, size_t size) {
-    ACCESS_ACTORS_BEGIN;
-    _actor_send_msg(aid, type, data, size, true);
-    ACCESS_ACTORS_END;
+/* Called in a read section. The worker to send to, or NULL if they have all exited. */
+static actor_state_t *_actor_pool_route(struct actor_pool *pool, unsigned long key) {
+    actor_state_t *a, *b;
+    unsigned int x, y;
+
+    switch (pool->strategy) {
+        case ACTOR_POOL_LEAST_DEPTH:
+            return _actor_pool_least(pool);
+        case ACTOR_POOL_HASH:
+            return _actor_pool_owner(pool, key);
+        case ACTOR_POOL_TWO_CHOICES:
+            if (pool->count < 2) break;
+            x = _actor_pool_random() % pool->count;
+            y = (x + 1 + _actor_pool_random() % (pool->count - 1)) % pool->count;
+            a = _actor_pool_worker(pool, x);
+            b = _actor_pool_worker(pool, y);
+            if (a == NULL || b == NULL) return a != NULL ? a : b != NULL ? b : _actor_pool_scan(pool, x);
+            return atomic_load_explicit(&b->depth, memory_order_relaxed) <
+                           atomic_load_explicit(&a->depth, memory_order_relaxed)
+                       ? b
+                       : a;
+        default:
+            break;
+    }
+
+    return _actor_pool_scan(pool, atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed));
 }
 
-static void _actor_send_msg(actor_id aid, long type, void *data, size_t size, bool copy_data) {
-    actor_state_t *st = NULL;
-    actor_msg_t *msg = NULL;
-    actor_id myid = _actor_find_by_thread();
-    pthread_t thread;
-    PTHREAD_HANDLE(thread) = NULL;
 
-    if (myid == NULL) return;
+/*------------------------------------------------------------------------------
+                                 helper functions
+------------------------------------------------------------------------------*/
 
-    // TODO: Replace with a cheri_unseal and check that it's still a valid actor
-    st = list_filter(actor_list, find_by_id, (void *)aid);
 
-    if (st != NULL) {
-        pthread_mutex_lock(&st->msg_mutex);
-        msg = _actor_create_msg(type, data, size, copy_data, myid, aid, st->thread);
-        list_append((list_item_t **)&st->messages, msg);
-        pthread_cond_signal(&st->msg_cond);
-        pthread_mutex_unlock(&st->msg_mutex);
-    }
+/*
+ * The state of the executing actor, installed when it starts on its thread
+ * or task. NULL on foreign threads, which are not actors: the thread that
+ * runs main() and any the application creates itself.
+ */
+static actor_state_t *_actor_current() {
+    return (actor_state_t *)_actor_sched_local();
 }
 
+static actor_id _actor_id(actor_state_t *st) {
+    if (st == NULL) return NULL;
+    return cheri_seal((char *)st + atomic_load(&st->generation) % ACTOR_SLOT_SIZE, actor_id_sealer);
+}
 
-/*------------------------------------------------------------------------------
-                                memory management
-------------------------------------------------------------------------------*/
+/* The state of a live actor, or NULL if `aid` is not an actor or has exited */
+static actor_state_t *_actor_resolve(actor_id aid) {
+    char *slot;
+    size_t generation;
+    actor_state_t *st;
 
-static void *_amalloc_thread(size_t size, pthread_t thread) {
-    alloc_info_t *info;
-    void *block = NULL;
-    actor_state_t *st = NULL;
-    struct actor_alloc *al;
+    if (aid == NULL) return NULL;
 
+    slot = cheri_unseal(aid, actor_id_sealer);
+    if (!cheri_tag_get(slot)) return NULL; /* not sealed with our sealer */
 
-    if (size == 0) return NULL;
-    pthread_mutex_lock(&actors_alloc);
-    block = malloc(size);
-    assert(block != NULL);
-    info = (alloc_info_t *)malloc(sizeof(alloc_info_t));
-    info->block = block;
-    info->refcount = 1;
-
-    if (thread != NULL) {
-        st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(thread));
-        if (st != NULL) {
-            al = (struct actor_alloc *)malloc(sizeof(struct actor_alloc));
-            assert(al != NULL);
-            al->block = block;
-            list_append(&st->allocs, al);
-        }
-    }
+    generation = cheri_address_get(slot) % ACTOR_SLOT_SIZE;
+    st = (actor_state_t *)(slot - generation);
+    /* Not modulo: a retired slot's generation matches no ID */
+    if (atomic_load(&st->generation) != generation) return NULL;
 
-    list_append(alloc_list, info);
+    return st;
+}
 
-    pthread_mutex_unlock(&actors_alloc);
+static actor_id _actor_find_by_thread() {
+    actor_state_t *st = _actor_current();
 
-    return block;
+    return st != NULL ? st->id : NULL;
 }
 
-void *amalloc(size_t size) {
-    pthread_t thread = pthread_self();
-    void *block;
-    ACCESS_ACTORS_BEGIN;
-    block = _amalloc_thread(size, thread);
-    ACCESS_ACTORS_END;
-    return block;
+actor_id actor_self() {
+    return _actor_find_by_thread();
 }
 
-/* satisfies list_filter_func_ptr_t */
-static int find_memory(void *info, void *block) {
-    if (((alloc_info_t *)info)->block == block) return 0;
-    return -1;
-}
 
-/* satisfies list_filter_func_ptr_t */
-static int find_actor_block(void *info, void *arg) {
-    return (((struct actor_alloc *)info)->block == arg) ? 0 : -1;
-}
+/*------------------------------------------------------------------------------
+                                state management
+------------------------------------------------------------------------------*/
 
-void aretain(void *block) {
-    pthread_t thread = pthread_self();
-    ACCESS_ACTORS_BEGIN;
-    _aretain_thread(block, thread);
-    ACCESS_ACTORS_END;
+static actor_id _actor_trapexit_to() {
+    actor_state_t *st;
+    st = _actor_current();
+
+    if (st != NULL && st->trap_exit == 1) return st->id;
+
+    return 0;
 }
 
-static void _aretain_thread(void *block, pthread_t thread) {
-    alloc_info_t *info = NULL;
-    actor_state_t *st = NULL;
-    struct actor_alloc *al;
+void actor_trap_exit(int action) {
+    actor_state_t *st = _actor_current();
 
-    if (block == NULL) return;
+    if (st != NULL) st->trap_exit = action == 0 ? 0 : 1;
+}
 
-    if ((info = list_filter(alloc_list, find_memory, block)) != NULL) {
-        info->refcount++;
+/*
+ * Called with actors_mutex held, when no slot is free. Slots come in chunks
+ * so that each costs its own size and no more, for processes with many
+ * actors.
+ */
+static void _actor_grow_slots() {
+    char *chunk;
+    actor_state_t *t;
+    void **chunks;
+
+    /* Aligned so that an actor_id's offset into its slot is the generation */
+    chunk = (char *)aligned_alloc(ACTOR_SLOT_SIZE, ACTOR_SLOT_SIZE * ACTOR_SLOT_CHUNK);
+    assert(chunk != NULL);
+    if ((actor_slot_chunks_count & (actor_slot_chunks_count - 1)) == 0) {
+        chunks = (void **)realloc(actor_slot_chunks, sizeof(void *) * (actor_slot_chunks_count * 2 + 1));
+        assert(chunks != NULL);
+        actor_slot_chunks = chunks;
     }
-
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(thread));
-    if (st != NULL) {
-        al = (struct actor_alloc *)malloc(sizeof(struct actor_alloc));
-        assert(al != NULL);
-        al->block = block;
-        list_append(&st->allocs, al);
+    actor_slot_chunks[actor_slot_chunks_count++] = chunk;
+
+    for (size_t x = 0; x < ACTOR_SLOT_CHUNK; x++) {
+        t = (actor_state_t *)cheri_bounds_set(chunk + x * ACTOR_SLOT_SIZE, ACTOR_SLOT_SIZE);
+        memset(t, 0, sizeof(actor_state_t));
+        atomic_init(&t->generation, 0);
+        pthread_mutex_init(&t->msg_mutex, NULL);
+        pthread_cond_init(&t->space_cond, NULL);
+
+        if (actor_free_tail != NULL)
+            actor_free_tail->next = t;
+        else
+            actor_free_head = t;
+        actor_free_tail = t;
     }
 }
 
-void arelease(void *block) {
-    pthread_t thread = pthread_self();
-    ACCESS_ACTORS_BEGIN;
-    ACTOR_THREAD_PRINT("arelease()");
-    _arelease(block, thread);
+static void _actor_init_state(actor_state_t **state, const actor_opts_t *opts) {
+    actor_state_t *t;
+    assert(state != NULL);
+
+    if (actor_free_head == NULL) _actor_grow_slots();
+    t = actor_free_head;
+    actor_free_head = t->next;
+    if (actor_free_head == NULL) actor_free_tail = NULL;
+
+    memset(&t->thread, 0, sizeof(t->thread));
+    t->task = NULL;
+    atomic_init(&t->waiting, 0);
+    t->spin = actor_spin_max / 4;
+    t->trap_exit_to = _actor_trapexit_to();
+    t->trap_exit = 0;
+    for (int lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) {
+        atomic_init(&t->lanes[lane].inbox, NULL);
+        t->lanes[lane].messages = NULL;
+        t->lanes[lane].messages_tail = NULL;
+    }
+    t->indexed = false;
+    t->types_count = 0;
+    if (t->types != NULL) memset(t->types, 0, t->types_capacity * sizeof(struct actor_type_queue));
+    t->capacity = opts != NULL ? opts->mailbox_capacity : 0;
+    t->overflow = opts != NULL ? opts->mailbox_overflow : ACTOR_OVERFLOW_BLOCK;
+    atomic_store(&t->depth, 0);
+    atomic_store(&t->rejected, 0);
+    atomic_store(&t->dropped, 0);
+    t->refs_count = 0;
+    t->pool = NULL;
+    t->in_pool = NULL;
+    for (size_t x = 0; x < ALLOC_STAT_COUNT; x++) atomic_init(&t->alloc_stats[x], 0);
+#ifdef ACTOR_STATS
+    if (t->stats == NULL) t->stats = (actor_stats_counters_t *)malloc(sizeof(actor_stats_counters_t));
+    assert(t->stats != NULL);
+    _actor_stats_reset(t->stats, _actor_clock_ns());
+#endif
+
+    t->prev = NULL;
+    t->next = actor_list;
+    if (actor_list != NULL) actor_list->prev = t;
+    actor_list = t;
+    actor_count++;
+
+    *state = t;
+}
+
+/* Invalidates every outstanding actor_id for this actor */
+static void _actor_retire_state(actor_state_t *state) {
+    atomic_fetch_add(&state->generation, 1);
+
+    /* Senders waiting for room notice that the actor is gone */
+    _actor_mailbox_wake_senders(state);
+}
+
+/* Called with actors_mutex held, once the actor is retired and its mailbox drained */
+static void _actor_destroy_state(actor_state_t *state) {
+    if (state == NULL) return;
+
+    if (state->prev != NULL)
+        state->prev->next = state->next;
+    else
+        actor_list = state->next;
+    if (state->next != NULL) state->next->prev = state->prev;
+    actor_count--;
+
+    if (atomic_load(&state->generation) >= ACTOR_SLOT_SIZE) {
+        state->next = actor_retired;
+        actor_retired = state;
+        return;
+    }
+
+    state->next = NULL;
+    if (actor_free_tail != NULL)
+        actor_free_tail->next = state;
+    else
+        actor_free_head = state;
+    actor_free_tail = state;
+}
+
+
+/*------------------------------------------------------------------------------
+                                     mailbox
+------------------------------------------------------------------------------*/
+
+/* Pushes a chain of messages of one lane, linked newest to oldest. Safe to call from any thread. */
+static void _actor_mailbox_push(actor_state_t *st, actor_msg_t *newest, actor_msg_t *oldest) {
+    struct actor_lane *lane = &st->lanes[ACTOR_ENVELOPE(oldest)->lane];
+    actor_msg_t *head = atomic_load_explicit(&lane->inbox, memory_order_relaxed);
+
+    do {
+        oldest->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&lane->inbox, &head, newest, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static size_t _actor_type_hash(long type, int lane) {
+    uint64_t h = ((uint64_t)type * ACTOR_PRIORITY_LANES + lane) * 0x9e3779b97f4a7c15ull;
+
+    return (size_t)(h ^ (h >> 32));
+}
+
+/* Open addressing with linear probing; the queue is there or the returned entry is free */
+static size_t _actor_index_probe(actor_state_t *st, long type, int lane) {
+    size_t mask = st->types_capacity - 1;
+    size_t x = _actor_type_hash(type, lane) & mask;
+
+    while (st->types[x].head != NULL && (st->types[x].type != type || st->types[x].lane != lane)) x = (x + 1) & mask;
+    return x;
+}
+
+/* Appends `msg` to the queue of its type and lane */
+static void _actor_index_add(actor_state_t *st, actor_msg_t *msg) {
+    struct actor_type_queue *old = st->types, *q;
+    size_t x, capacity = st->types_capacity;
+    int lane = ACTOR_ENVELOPE(msg)->lane;
+
+    if ((st->types_count + 1) * 4 > st->types_capacity * 3) {
+        st->types_capacity = capacity == 0 ? 16 : capacity * 2;
+        st->types = (struct actor_type_queue *)calloc(st->types_capacity, sizeof(struct actor_type_queue));
+        assert(st->types != NULL);
+        for (x = 0; x < capacity; x++) {
+            if (old[x].head != NULL) st->types[_actor_index_probe(st, old[x].type, old[x].lane)] = old[x];
+        }
+        free(old);
+    }
+
+    ACTOR_ENVELOPE(msg)->type_next = NULL;
+    q = &st->types[_actor_index_probe(st, msg->type, lane)];
+    if (q->head == NULL) {
+        q->head = msg;
+        q->type = msg->type;
+        q->lane = lane;
+        st->types_count++;
+    } else {
+        ACTOR_ENVELOPE(q->tail)->type_next = msg;
+    }
+    q->tail = msg;
+}
+
+/* Removes `msg` from the index; it is the oldest of its type in its lane unless a sender dropped it */
+static void _actor_index_remove(actor_state_t *st, actor_msg_t *msg) {
+    size_t mask = st->types_capacity - 1;
+    size_t x = _actor_index_probe(st, msg->type, ACTOR_ENVELOPE(msg)->lane), y, home;
+    actor_msg_t *prev;
+
+    assert(st->types[x].head != NULL);
+    if (st->types[x].head != msg) {
+        /* Dropped from behind uncounted messages of its type; see _actor_mailbox_drop_oldest() */
+        for (prev = st->types[x].head; ACTOR_ENVELOPE(prev)->type_next != msg; prev = ACTOR_ENVELOPE(prev)->type_next)
+            assert(ACTOR_ENVELOPE(prev)->type_next != NULL);
+        if ((ACTOR_ENVELOPE(prev)->type_next = ACTOR_ENVELOPE(msg)->type_next) == NULL) st->types[x].tail = prev;
+        return;
+    }
+    if ((st->types[x].head = ACTOR_ENVELOPE(msg)->type_next) != NULL) return;
+
+    /* Backward-shift deletion, as for the reference table */
+    for (y = (x + 1) & mask; st->types[y].head != NULL; y = (y + 1) & mask) {
+        home = _actor_type_hash(st->types[y].type, st->types[y].lane) & mask;
+        if (((y - home) & mask) >= ((y - x) & mask)) {
+            st->types[x] = st->types[y];
+            x = y;
+        }
+    }
+    memset(&st->types[x], 0, sizeof(struct actor_type_queue));
+    st->types_count--;
+}
+
+/* Moves a lane's inbox onto the end of its private list. Only the receiver may call this. */
+static void _actor_mailbox_fill(actor_state_t *st, struct actor_lane *lane) {
+    actor_msg_t *batch, *next, *first = NULL, *last, *prev;
+
+    if (atomic_load_explicit(&lane->inbox, memory_order_relaxed) == NULL) return;
+    if ((batch = atomic_exchange_explicit(&lane->inbox, NULL, memory_order_acquire)) == NULL) return;
+
+    /* The inbox is newest first */
+    for (last = batch; batch != NULL; batch = next) {
+        next = batch->next;
+        batch->next = first;
+        first = batch;
+    }
+
+    prev = lane->messages_tail;
+    if (prev != NULL)
+        prev->next = first;
+    else
+        lane->messages = first;
+    for (; first != NULL; prev = first, first = first->next) {
+        ACTOR_ENVELOPE(first)->prev = prev;
+        ACTOR_ENVELOPE(first)->seq = st->messages_seq++;
+        if (st->indexed) _actor_index_add(st, first);
+    }
+    lane->messages_tail = last;
+}
+
+static void _actor_mailbox_unlink(actor_state_t *st, actor_msg_t *msg) {
+    struct actor_lane *lane = &st->lanes[ACTOR_ENVELOPE(msg)->lane];
+    actor_msg_t *prev = ACTOR_ENVELOPE(msg)->prev;
+
+    if (prev != NULL)
+        prev->next = msg->next;
+    else
+        lane->messages = msg->next;
+    if (msg->next != NULL)
+        ACTOR_ENVELOPE(msg->next)->prev = prev;
+    else
+        lane->messages_tail = prev;
+
+    if (st->indexed) _actor_index_remove(st, msg);
+}
+
+/* The first message that `match` selects, highest lane first, left in the mailbox */
+static actor_msg_t *_actor_mailbox_find(actor_state_t *st, struct actor_match *match) {
+    actor_msg_t *msg, *best = NULL;
+    struct actor_envelope *e, *b;
+    size_t x;
+    int lane;
+
+    if (!st->indexed) {
+        for (lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) {
+            for (msg = st->lanes[lane].messages; msg != NULL; msg = msg->next) _actor_index_add(st, msg);
+        }
+        st->indexed = true;
+    }
+    if (st->types_count == 0) return NULL;
+
+    if (match->fun == NULL) {
+        for (lane = ACTOR_PRIORITY_LANES - 1; lane >= 0 && best == NULL; lane--)
+            best = st->types[_actor_index_probe(st, match->type, lane)].head;
+        return best;
+    }
+
+    for (x = 0; x < st->types_capacity; x++) {
+        if ((msg = st->types[x].head) == NULL) continue;
+        if (best != NULL) {
+            e = ACTOR_ENVELOPE(msg);
+            b = ACTOR_ENVELOPE(best);
+            if (e->lane < b->lane || (e->lane == b->lane && e->seq > b->seq)) continue;
+        }
+        if (match->fun(msg->type, match->arg)) best = msg;
+    }
+
+    return best;
+}
+
+/* Wakes the receiver after a push, if it may be asleep. One sender wakes it and the rest return. */
+static void _actor_mailbox_notify(actor_state_t *st) {
+    /* Pairs with the fence in _actor_receive_wait(): the receiver sees the push or we see it waiting */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&st->waiting, memory_order_relaxed) == 0) return;
+    if (atomic_exchange_explicit(&st->waiting, 0, memory_order_acquire) == 0) return;
+
+    if (st->task != NULL) {
+        /* The worker parks the task under msg_mutex */
+        ACTOR_LOCK(&st->msg_mutex, ACTOR_LOCK_MSG);
+        _actor_sched_wake(st->task);
+        ACTOR_UNLOCK(&st->msg_mutex);
+    } else {
+        _actor_park_wake(&st->waiting);
+    }
+}
+
+/* Only the receiving actor may call this */
+static actor_msg_t *_actor_mailbox_pop_lane(actor_state_t *st, int lane) {
+    actor_msg_t *msg;
+
+    if (st->lanes[lane].messages == NULL) _actor_mailbox_fill(st, &st->lanes[lane]);
+
+    msg = st->lanes[lane].messages;
+    if (msg != NULL) _actor_mailbox_unlink(st, msg);
+
+    return msg;
+}
+
+/*
+ * Unlinks the oldest counted message of the lowest lane that has one, so
+ * control messages survive bulk traffic. Uncounted messages never took a
+ * place and stay where they are. Only a sender holding msg_mutex for
+ * ACTOR_OVERFLOW_DROP_OLDEST may call this.
+ */
+static actor_msg_t *_actor_mailbox_drop_oldest(actor_state_t *st) {
+    actor_msg_t *msg;
+    int lane;
+
+    for (lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) {
+        _actor_mailbox_fill(st, &st->lanes[lane]);
+        for (msg = st->lanes[lane].messages; msg != NULL; msg = msg->next) {
+            if (ACTOR_ENVELOPE(msg)->counted) {
+                _actor_mailbox_unlink(st, msg);
+                return msg;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* The oldest message of the highest lane that has one */
+static actor_msg_t *_actor_mailbox_pop(actor_state_t *st) {
+    actor_msg_t *msg = NULL;
+    int lane;
+
+    for (lane = ACTOR_PRIORITY_LANES - 1; lane >= 0 && msg == NULL; lane--) msg = _actor_mailbox_pop_lane(st, lane);
+
+    return msg;
+}
+
+static bool _actor_mailbox_has_new(actor_state_t *st) {
+    int lane;
+
+    for (lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) {
+        if (atomic_load(&st->lanes[lane].inbox) != NULL) return true;
+    }
+    return false;
+}
+
+static bool _actor_mailbox_empty(actor_state_t *st) {
+    int lane;
+
+    for (lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) {
+        if (st->lanes[lane].messages != NULL) return false;
+    }
+    return !_actor_mailbox_has_new(st);
+}
+
+/* Releases a message that will never be received */
+static void _actor_msg_discard(actor_msg_t *msg) {
+    if (!_actor_msg_inline(msg)) _arelease_actor(msg->data, NULL);
+    _arelease_actor(msg, NULL);
+}
+
+/* satisfies actor_task_check_ptr_t, called with msg_mutex held */
+static int _actor_mailbox_has_space(void *arg) {
+    struct actor_space_waiter *w = (struct actor_space_waiter *)arg;
+
+    return atomic_load(&w->st->depth) < w->st->capacity || atomic_load(&w->st->generation) != w->generation;
+}
+
+static void _actor_mailbox_wake_senders(actor_state_t *st) {
+    struct actor_space_waiter *w;
+
+    if (atomic_load(&st->space_waiting) == 0) return;
+
+    ACTOR_LOCK(&st->msg_mutex, ACTOR_LOCK_MSG);
+    for (w = st->space_waiters; w != NULL; w = w->next) {
+        if (w->task != NULL) _actor_sched_wake(w->task);
+    }
+    pthread_cond_broadcast(&st->space_cond);
+    ACTOR_UNLOCK(&st->msg_mutex);
+}
+
+/*
+ * Called in a read section by a sender that found the mailbox full. Leaves
+ * the read section and waits until the mailbox may have room or the actor
+ * has exited; wakeups may be spurious.
+ */
+static void _actor_mailbox_wait_space(actor_state_t *st, actor_state_t *self) {
+    struct actor_space_waiter w, **link;
+
+    w.st = st;
+    w.generation = atomic_load(&st->generation);
+    w.task = self != NULL && !self->stackless ? self->task : NULL;
+
+    ACTOR_LOCK(&st->msg_mutex, ACTOR_LOCK_MSG);
+    w.next = st->space_waiters;
+    st->space_waiters = &w;
+    atomic_fetch_add(&st->space_waiting, 1);
+    READ_ACTORS_END;
+
+    if (w.task != NULL) {
+        ACTOR_UNLOCK(&st->msg_mutex);
+        _actor_sched_park(0, &st->msg_mutex, _actor_mailbox_has_space, &w);
+        ACTOR_LOCK(&st->msg_mutex, ACTOR_LOCK_MSG);
+    } else {
+        ACTOR_LOCK_COND_BEGIN(&st->msg_mutex);
+        while (!_actor_mailbox_has_space(&w)) pthread_cond_wait(&st->space_cond, &st->msg_mutex);
+        ACTOR_LOCK_COND_END(&st->msg_mutex, ACTOR_LOCK_MSG);
+    }
+
+    for (link = &st->space_waiters; *link != &w; link = &(*link)->next) continue;
+    *link = w.next;
+    atomic_fetch_sub(&st->space_waiting, 1);
+    ACTOR_UNLOCK(&st->msg_mutex);
+
+    READ_ACTORS_BEGIN;
+}
+
+/* Only the receiving actor may call this. Takes the next message, or the next that `match` selects. */
+static actor_msg_t *_actor_mailbox_take(actor_state_t *st, struct actor_match *match) {
+    bool lock = st->capacity > 0 && st->overflow == ACTOR_OVERFLOW_DROP_OLDEST;
+    actor_msg_t *msg;
+    int lane;
+
+    if (lock) ACTOR_LOCK(&st->msg_mutex, ACTOR_LOCK_MSG);
+    if (match == NULL) {
+        msg = _actor_mailbox_pop(st);
+    } else {
+        for (lane = 0; lane < ACTOR_PRIORITY_LANES; lane++) _actor_mailbox_fill(st, &st->lanes[lane]);
+        if ((msg = _actor_mailbox_find(st, match)) != NULL) _actor_mailbox_unlink(st, msg);
+    }
+    if (lock) ACTOR_UNLOCK(&st->msg_mutex);
+
+    /* Exit notifications and reactor messages never took a place */
+    if (msg != NULL) {
+        ACTOR_STATS_DEQUEUE(st, msg);
+        ACTOR_TRACE_EVENT(ACTOR_TRACE_RECEIVE, st->id, msg, msg->type);
+    }
+    if (msg != NULL && ACTOR_ENVELOPE(msg)->counted) {
+        atomic_fetch_sub(&st->depth, 1);
+        _actor_mailbox_wake_senders(st);
+    }
+
+    return msg;
+}
+
+/*
+ * Called in a read section, which ACTOR_OVERFLOW_BLOCK may leave while it
+ * waits. Returns 0 once a place is reserved in `*st`'s mailbox, or the
+ * error for _actor_send_msg() to return; `*st` is NULL if the actor exited.
+ */
+static int _actor_mailbox_reserve(actor_state_t **st, actor_id aid, actor_state_t *self, int flags) {
+    actor_msg_t *oldest;
+    int overflow;
+
+    while (atomic_fetch_add(&(*st)->depth, 1) >= (*st)->capacity) {
+        atomic_fetch_sub(&(*st)->depth, 1);
+
+        overflow = (*st)->overflow;
+        if (overflow == ACTOR_OVERFLOW_BLOCK && (flags & SEND_TRY)) overflow = ACTOR_OVERFLOW_REJECT;
+
+        switch (overflow) {
+            case ACTOR_OVERFLOW_REJECT:
+                atomic_fetch_add(&(*st)->rejected, 1);
+                return EAGAIN;
+            case ACTOR_OVERFLOW_DROP_NEWEST:
+                atomic_fetch_add(&(*st)->dropped, 1);
+                return -1;
+            case ACTOR_OVERFLOW_DROP_OLDEST:
+                ACTOR_LOCK(&(*st)->msg_mutex, ACTOR_LOCK_MSG);
+                oldest = _actor_mailbox_drop_oldest(*st);
+                ACTOR_UNLOCK(&(*st)->msg_mutex);
+                if (oldest != NULL) {
+                    atomic_fetch_sub(&(*st)->depth, 1);
+                    atomic_fetch_add(&(*st)->dropped, 1);
+                    ACTOR_STATS_DISCARD(*st);
+                    _actor_msg_discard(oldest);
+                    break;
+                }
+                /*
+                 * Every place is held by a send that has not pushed its message yet. The receiver
+                 * makes room once it takes one, unless the receiver is the one sending.
+                 */
+                if (*st == self) {
+                    atomic_fetch_add(&(*st)->rejected, 1);
+                    return EAGAIN;
+                }
+                _actor_mailbox_wait_space(*st, self);
+                if ((*st = _actor_resolve(aid)) == NULL) return ESRCH;
+                break;
+            default:
+                _actor_mailbox_wait_space(*st, self);
+                if ((*st = _actor_resolve(aid)) == NULL) return ESRCH;
+                break;
+        }
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------------
+                                    messaging
+------------------------------------------------------------------------------*/
+static void *_actor_copy_message_data(void *data, size_t size, actor_state_t *self) {
+    void *newblock = _amalloc_actor(size, self, false);
+
+    assert(newblock != NULL || size == 0);
+    return memcpy(newblock, data, size);
+}
+
+/* A message in flight holds its own, untracked, references; the receiver adopts them */
+static actor_msg_t *_actor_create_msg(long type, void *data, size_t size, int how, actor_state_t *self, actor_id dest) {
+    actor_msg_t *msg = _amalloc_msg(self);
+    const void *msgdata;
+
+    /*
+     * Only amalloc() blocks can be shared, and only the sender's own reference can be moved.
+     * Foreign threads do not track their references, so theirs is assumed.
+     */
+    if (how == SEND_MOVE && (data == NULL || !(self != NULL ? _actor_refs_remove(self, data) : _alloc_known(data))))
+        how = SEND_COPY;
+    if (how == SEND_SHARE && !_aretain_actor(data, NULL)) how = SEND_COPY;
+    if (how == SEND_SHARE_HELD) how = SEND_SHARE;
+
+    if (how == SEND_COPY && size > 0 && size <= ACTOR_MSG_INLINE_SIZE) {
+        memcpy(msg->inline_data, data, size);
+        msgdata = cheri_perms_and(cheri_bounds_set(msg->inline_data, size), CHERI_PERM_LOAD);
+    } else if (how == SEND_COPY) {
+        data = _actor_copy_message_data(data, size, self);
+        msgdata = cheri_perms_and(data, CHERI_PERM_LOAD);
+    } else if (how == SEND_SHARE) {
+        msgdata = cheri_perms_and(cheri_bounds_set(data, size), CHERI_PERM_LOAD);
+    } else {
+        /* The sender gave its reference up, so the receiver may write to a moved block */
+        msgdata = cheri_bounds_set(data, size);
+    }
+
+    msg->type = type;
+    msg->data = msgdata;
+    msg->size = size;
+    msg->dest = dest;
+    msg->sender = self != NULL ? self->id : NULL;
+    ACTOR_ENVELOPE(msg)->counted = false;
+    ACTOR_STATS_STAMP(msg);
+
+    return msg;
+}
+
+/* Data copied into the message itself has no allocation of its own */
+static bool _actor_msg_inline(actor_msg_t *msg) {
+    return cheri_address_get(msg->data) - cheri_address_get(msg->inline_data) < ACTOR_MSG_INLINE_SIZE;
+}
+
+actor_msg_t *actor_receive() {
+    return actor_receive_timeout(0);
+}
+
+/* satisfies actor_task_check_ptr_t */
+static int _actor_has_messages(void *arg) {
+    return !_actor_mailbox_empty((actor_state_t *)arg);
+}
+
+/* satisfies actor_task_check_ptr_t; a selective receive waits for messages it has not looked at yet */
+static int _actor_has_new_messages(void *arg) {
+    return _actor_mailbox_has_new((actor_state_t *)arg);
+}
+
+/*
+ * Sleeps until `check` passes, a sender wakes us or `deadline` passes. Tasks
+ * park instead of blocking their worker thread; threads sleep on `waiting`.
+ */
+static void _actor_receive_wait(actor_state_t *st, uint64_t deadline, actor_task_check_ptr_t check) {
+    atomic_store_explicit(&st->waiting, 1, memory_order_relaxed);
+    /* Pairs with the fence in _actor_mailbox_notify() */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!check(st)) {
+        if (st->task != NULL)
+            _actor_sched_park(deadline, &st->msg_mutex, check, st);
+        else
+            _actor_park_wait(&st->waiting, 1, deadline);
+    }
+
+    atomic_store_explicit(&st->waiting, 0, memory_order_relaxed);
+}
+
+/*
+ * A thread polls its mailbox for up to `spin` rounds, then yields a few
+ * times, before it sleeps: a reply that comes quickly then costs no system
+ * call on either side. `spin` doubles each time polling pays off and halves
+ * each time it does not.
+ */
+static actor_msg_t *_actor_receive_spin(actor_state_t *st, struct actor_match *match, actor_task_check_ptr_t check) {
+    actor_msg_t *msg;
+    unsigned int x;
+
+    for (x = 0; x < st->spin; x++) {
+        if (check(st) && (msg = _actor_mailbox_take(st, match)) != NULL) {
+            st->spin = st->spin * 2 < actor_spin_max ? st->spin * 2 : actor_spin_max;
+            return msg;
+        }
+        _actor_cpu_relax();
+    }
+    if (actor_spin_max > 0) st->spin = st->spin / 2 > ACTOR_SPIN_MIN ? st->spin / 2 : ACTOR_SPIN_MIN;
+
+    for (x = 0; x < ACTOR_SPIN_YIELDS; x++) {
+        sched_yield();
+        if (check(st) && (msg = _actor_mailbox_take(st, match)) != NULL) return msg;
+    }
+
+    return NULL;
+}
+
+static actor_msg_t *_actor_receive(actor_state_t *st, long timeout, struct actor_match *match) {
+    actor_task_check_ptr_t check = match == NULL ? _actor_has_messages : _actor_has_new_messages;
+    actor_msg_t *msg = NULL;
+    uint64_t deadline = 0;
+
+    if ((msg = _actor_mailbox_take(st, match)) != NULL) return msg;
+
+    /* A stackless handler actor cannot wait */
+    if (st->stackless) return NULL;
+
+    if (timeout > 0) deadline = _actor_clock_ns() + (uint64_t)timeout * 1000000ull;
+
+    if (st->task == NULL && (msg = _actor_receive_spin(st, match, check)) != NULL) return msg;
+
+    while ((msg = _actor_mailbox_take(st, match)) == NULL) {
+        if (deadline != 0 && _actor_clock_ns() >= deadline) break;
+        _actor_receive_wait(st, deadline, check);
+    }
+
+    return msg;
+}
+
+/* The message and its data now belong to the receiver */
+static void _actor_adopt_msg(actor_state_t *st, actor_msg_t *msg) {
+    _actor_refs_add(st, msg);
+    if (msg->data != NULL && !_actor_msg_inline(msg)) _actor_refs_add(st, (void *)msg->data);
+}
+
+actor_msg_t *actor_receive_timeout(long timeout) {
+    actor_state_t *st = NULL;
+    actor_msg_t *msg = NULL;
+
+    ACTOR_THREAD_PRINT("actor_receive_msg()\n");
+    st = _actor_current();
+
+    if (st == NULL) return NULL;
+
+    if ((msg = _actor_receive(st, timeout, NULL)) != NULL) _actor_adopt_msg(st, msg);
+
+    return msg;
+}
+
+static actor_msg_t *_actor_receive_selective(struct actor_match *match, long timeout) {
+    actor_state_t *st = NULL;
+    actor_msg_t *msg = NULL;
+
+    st = _actor_current();
+
+    if (st == NULL) return NULL;
+
+    if ((msg = _actor_receive(st, timeout, match)) != NULL) _actor_adopt_msg(st, msg);
+
+    return msg;
+}
+
+actor_msg_t *actor_receive_match(actor_match_ptr_t match, void *arg, long timeout) {
+    struct actor_match m = {match, arg, 0};
+
+    if (match == NULL) return actor_receive_timeout(timeout);
+
+    return _actor_receive_selective(&m, timeout);
+}
+
+actor_msg_t *actor_receive_type(long type, long timeout) {
+    struct actor_match m = {NULL, NULL, type};
+
+    return _actor_receive_selective(&m, timeout);
+}
+
+size_t actor_receive_batch(actor_msg_t **out, size_t max, long timeout) {
+    actor_state_t *st = NULL;
+    size_t count = 0;
+
+    if (out == NULL || max == 0) return 0;
+
+    st = _actor_current();
+
+    if (st == NULL) return 0;
+
+    /* Wait for the first message only, then take whatever else has arrived */
+    if ((out[0] = _actor_receive(st, timeout, NULL)) == NULL) return 0;
+    for (count = 1; count < max && (out[count] = _actor_mailbox_take(st, NULL)) != NULL; count++) continue;
+
+    for (size_t x = 0; x < count; x++) _actor_adopt_msg(st, out[x]);
+
+    return count;
+}
+
+void actor_reply_msg(actor_msg_t *a, long type, void *data, size_t size) {
+    if (a == NULL) return;
+    actor_send_msg(a->sender, type, data, size);
+}
+
+/*
+ * Takes a snapshot of the live actors' IDs in one pass under actors_mutex,
+ * then sends outside of it; each ID resolves in constant time, and those of
+ * actors that exited since no longer do. Data too big to go inline is
+ * copied once and shared: its references are all taken with one lookup.
+ */
+void actor_broadcast_msg(long type, void *data, size_t size) {
+    actor_id *lst = NULL;
+    actor_state_t *st, *self;
+    size_t count = 0;
+    size_t x = 0;
+    void *shared = NULL;
+    int how = SEND_COPY;
+
+    self = _actor_current();
+
+    ACCESS_ACTORS_BEGIN;
+    count = actor_count;
+    lst = (actor_id *)malloc(sizeof(actor_id) * (count > 0 ? count : 1));
+    assert(lst != NULL);
+    for (st = actor_list; st != NULL; st = st->next) {
+        /* A pool's workers are on the list themselves */
+        if (st->pool == NULL) lst[x++] = st->id;
+    }
+    count = x;
     ACCESS_ACTORS_END;
+
+    if (data != NULL && size > ACTOR_MSG_INLINE_SIZE && count > 0) {
+        shared = _actor_copy_message_data(data, size, self);
+        /* The copy's own reference goes to the first message */
+        if (count > 1) _alloc_retain_n(shared, (unsigned int)(count - 1));
+        data = shared;
+        how = SEND_SHARE_HELD;
+    }
+
+    READ_ACTORS_BEGIN;
+    for (x = 0; x < count; x++) _actor_send_msg(lst[x], type, data, size, how, ACTOR_PRIORITY_NORMAL, 0);
+    READ_ACTORS_END;
+
+    free(lst);
 }
 
-static void _arelease(void *block, pthread_t thread) {
-    alloc_info_t *info = NULL;
+void actor_send_msg(actor_id aid, long type, void *data, size_t size) {
+    READ_ACTORS_BEGIN;
+    _actor_send_msg(aid, type, data, size, SEND_COPY, ACTOR_PRIORITY_NORMAL, 0);
+    READ_ACTORS_END;
+}
+
+void actor_send_priority_msg(actor_id aid, int priority, long type, void *data, size_t size) {
+    if (priority < 0 || priority >= ACTOR_PRIORITY_LANES) priority = ACTOR_PRIORITY_NORMAL;
+
+    READ_ACTORS_BEGIN;
+    _actor_send_msg(aid, type, data, size, SEND_COPY, priority, 0);
+    READ_ACTORS_END;
+}
+
+int actor_try_send_msg(actor_id aid, long type, void *data, size_t size) {
+    int err;
+
+    READ_ACTORS_BEGIN;
+    err = _actor_send_msg(aid, type, data, size, SEND_COPY, ACTOR_PRIORITY_NORMAL, SEND_TRY);
+    READ_ACTORS_END;
+
+    return err;
+}
+
+void actor_send_key_msg(actor_id aid, unsigned long key, long type, void *data, size_t size) {
+    actor_state_t *st;
+
+    READ_ACTORS_BEGIN;
+    if ((st = _actor_resolve(aid)) != NULL && st->pool != NULL)
+        aid = (st = _actor_pool_route(st->pool, key)) != NULL ? st->id : NULL;
+    _actor_send_msg(aid, type, data, size, SEND_COPY, ACTOR_PRIORITY_NORMAL, 0);
+    READ_ACTORS_END;
+}
+
+void actor_send_batch(actor_id aid, actor_batch_msg_t *msgs, size_t count) {
     actor_state_t *st = NULL;
-    struct actor_alloc *al;
+    actor_state_t *self = NULL;
+    actor_msg_t *newest = NULL, *oldest = NULL, *msg;
+    size_t x, bytes = 0;
+
+    if (msgs == NULL || count == 0) return;
+
+    READ_ACTORS_BEGIN;
+
+    self = _actor_current();
+    if ((st = _actor_resolve(aid)) != NULL && (st->capacity > 0 || st->pool != NULL || st->in_pool != NULL)) {
+        /* Each message needs a place of its own, is counted, or may go to a different worker */
+        for (x = 0; x < count; x++) _actor_send_msg(aid, msgs[x].type, msgs[x].data, msgs[x].size, SEND_COPY, ACTOR_PRIORITY_NORMAL, 0);
+    } else if (st != NULL) {
+        for (x = 0; x < count; x++) {
+            msg = _actor_create_msg(msgs[x].type, msgs[x].data, msgs[x].size, SEND_COPY, self, aid);
+            ACTOR_ENVELOPE(msg)->lane = ACTOR_PRIORITY_NORMAL;
+            ACTOR_TRACE_EVENT(ACTOR_TRACE_SEND, self != NULL ? self->id : NULL, msg, msgs[x].type);
+            msg->next = newest;
+            newest = msg;
+            if (oldest == NULL) oldest = msg;
+            bytes += msgs[x].size;
+        }
 
-    if (block == NULL) return;
+        /* One push and one wakeup for the whole batch */
+        ACTOR_STATS_ENQUEUE(st, count, bytes);
+        _actor_mailbox_push(st, newest, oldest);
+        _actor_mailbox_notify(st);
+    }
+
+    READ_ACTORS_END;
+}
+
+void actor_send_move(actor_id aid, long type, void **data, size_t size) {
+    if (data == NULL) return;
+
+    READ_ACTORS_BEGIN;
+    _actor_send_msg(aid, type, *data, size, SEND_MOVE, ACTOR_PRIORITY_NORMAL, 0);
+    READ_ACTORS_END;
 
-    pthread_mutex_lock(&actors_alloc);
+    *data = NULL;
+}
+
+void actor_send_ref(actor_id aid, long type, void **data, size_t size) {
+    bool shared;
+
+    if (data == NULL) return;
+
+    READ_ACTORS_BEGIN;
+    _actor_send_msg_shared(aid, type, *data, size, SEND_SHARE, ACTOR_PRIORITY_NORMAL, 0, &shared);
+    READ_ACTORS_END;
+
+    /* Shared blocks are immutable, for the sender too; a copy, or a send that failed, leaves the block private */
+    if (shared) *data = cheri_perms_and(*data, CHERI_PERM_LOAD | CHERI_PERM_LOAD_CAP);
+}
+
+/* Called in a read section. Returns 0 or an error as for actor_try_send_msg(). */
+static int _actor_send_msg(actor_id aid, long type, void *data, size_t size, int how, int lane, int flags) {
+    return _actor_send_msg_shared(aid, type, data, size, how, lane, flags, NULL);
+}
+
+/* Same as _actor_send_msg(), and sets `*shared` if the message holds `data` itself rather than a copy */
+static int _actor_send_msg_shared(actor_id aid, long type, void *data, size_t size, int how, int lane, int flags,
+                                  bool *shared) {
+    actor_state_t *st = NULL;
+    actor_msg_t *msg = NULL;
+    actor_state_t *self = _actor_current(); /* NULL on a foreign thread, which sends anonymously */
+    bool counted = false;
+    int err = 0;
+
+    if (shared != NULL) *shared = false;
+
+    /* A pool picks a worker; hashing pools key plain sends by type, see actor_send_key_msg() */
+    if ((st = _actor_resolve(aid)) != NULL && st->pool != NULL)
+        aid = (st = _actor_pool_route(st->pool, (unsigned long)type)) != NULL ? st->id : NULL;
+
+    if (st == NULL) {
+        err = ESRCH;
+    } else if (st->capacity > 0 && !(flags & (SEND_SYSTEM | SEND_UNBOUNDED))) {
+        err = _actor_mailbox_reserve(&st, aid, self, flags);
+        counted = true;
+    } else if (st->capacity == 0 && st->in_pool != NULL) {
+        atomic_fetch_add(&st->depth, 1);
+        counted = true;
+    }
+
+    if (err == 0) {
+        msg = _actor_create_msg(type, data, size, how, self, aid);
+        /* Copies, inline or not, never land at the same address */
+        if (shared != NULL) *shared = data != NULL && cheri_address_get(msg->data) == cheri_address_get(data);
+        ACTOR_ENVELOPE(msg)->lane = (flags & SEND_SYSTEM) ? ACTOR_PRIORITY_SYSTEM : lane;
+        ACTOR_ENVELOPE(msg)->counted = counted;
+        /* Counted first, so the receiver never takes a message the statistics have not seen */
+        ACTOR_STATS_ENQUEUE(st, 1, size);
+        ACTOR_TRACE_EVENT(ACTOR_TRACE_SEND, self != NULL ? self->id : NULL, msg, type);
+        _actor_mailbox_push(st, msg, msg);
+        _actor_mailbox_notify(st);
+    } else if (how == SEND_MOVE) {
+        _arelease_actor(data, self);
+    } else if (how == SEND_SHARE_HELD) {
+        _arelease_actor(data, NULL);
+    }
+
+    return err < 0 ? 0 : err; /* dropped by the mailbox's policy */
+}
 
-    if ((info = list_filter(alloc_list, find_memory, block)) != NULL) {
-        info->refcount--;
-        if (info->refcount == 0) { /* time to destroy this block */
-            free(info->block);
-            list_remove(alloc_list, info);
-            free(info);
+int actor_mailbox_stats(actor_id aid, actor_mailbox_stats_t *stats) {
+    actor_state_t *st, *worker;
+    int err = 0;
+
+    if (stats == NULL) return EINVAL;
+
+    READ_ACTORS_BEGIN;
+    if ((st = _actor_resolve(aid)) != NULL && st->pool != NULL) {
+        memset(stats, 0, sizeof(actor_mailbox_stats_t));
+        for (unsigned int x = 0; x < st->pool->count; x++) {
+            if ((worker = _actor_pool_worker(st->pool, x)) == NULL) continue;
+            stats->capacity += worker->capacity;
+            stats->depth += atomic_load(&worker->depth);
+            stats->rejected += atomic_load(&worker->rejected);
+            stats->dropped += atomic_load(&worker->dropped);
         }
+    } else if (st != NULL) {
+        stats->capacity = st->capacity;
+        stats->depth = atomic_load(&st->depth);
+        stats->rejected = atomic_load(&st->rejected);
+        stats->dropped = atomic_load(&st->dropped);
+    } else {
+        err = ESRCH;
+    }
+    READ_ACTORS_END;
+
+    return err;
+}
+
+int actor_stats_get(actor_id aid, actor_stats_t *stats) {
+#ifdef ACTOR_STATS
+    actor_state_t *st;
+    int err = 0;
+
+    if (stats == NULL) return EINVAL;
+
+    READ_ACTORS_BEGIN;
+    if ((st = _actor_resolve(aid)) != NULL) {
+        _actor_stats_read(st->stats, stats, _actor_clock_ns());
+        stats->dropped = atomic_load(&st->dropped);
+        stats->rejected = atomic_load(&st->rejected);
+    } else {
+        err = ESRCH;
+    }
+    READ_ACTORS_END;
+
+    return err;
+#else
+    (void)aid;
+    (void)stats;
+    return ENOTSUP;
+#endif
+}
+
+/* Snapshots the IDs under actors_mutex as actor_broadcast_msg() does, then reads each actor on its own */
+void actor_stats_dump(FILE *out) {
+    actor_stats_t stats;
+    actor_id *lst;
+    actor_state_t *st;
+    size_t count, x = 0;
+
+    if (out == NULL) out = stderr;
+#ifndef ACTOR_STATS
+    fprintf(out, "actor statistics are not kept; build with ACTOR_STATS\n");
+    return;
+#endif
+
+    ACCESS_ACTORS_BEGIN;
+    count = actor_count;
+    lst = (actor_id *)malloc(sizeof(actor_id) * (count > 0 ? count : 1));
+    assert(lst != NULL);
+    for (st = actor_list; st != NULL; st = st->next) lst[x++] = st->id;
+    ACCESS_ACTORS_END;
+
+    fprintf(out, "%-18s %10s %10s %8s %8s %12s %7s %7s %10s %9s %9s\n", "actor", "enqueued", "dequeued", "dropped",
+            "rejected", "bytes", "depth", "max", "msgs/s", "p50 us", "p99 us");
+    for (x = 0; x < count; x++) {
+        if (actor_stats_get(lst[x], &stats) != 0) continue;
+        fprintf(out, "%-18p %10lu %10lu %8lu %8lu %12lu %7zu %7zu %10.0f %9.1f %9.1f\n", lst[x], stats.enqueued,
+                stats.dequeued, stats.dropped, stats.rejected, stats.bytes, stats.depth, stats.max_depth,
+                stats.uptime_ns > 0 ? stats.dequeued / (stats.uptime_ns / 1e9) : 0.0,
+                actor_stats_percentile(&stats, 50) / 1e3, actor_stats_percentile(&stats, 99) / 1e3);
+    }
+
+    free(lst);
+}
+
+
+/*------------------------------------------------------------------------------
+                                     timers
+------------------------------------------------------------------------------*/
+
+/* Called with actor_timers_mutex held */
+static actor_timer_id _actor_send_timer_id(struct actor_send_timer *t) {
+    return cheri_seal((char *)t + t->generation % ACTOR_TIMER_SLOT_SIZE, actor_timer_sealer);
+}
+
+/* Called with actor_timers_mutex held. The pending timer, or NULL. */
+static struct actor_send_timer *_actor_send_timer_resolve(actor_timer_id tid) {
+    struct actor_send_timer *t;
+    char *slot;
+    size_t generation;
+
+    if (tid == NULL) return NULL;
+
+    slot = cheri_unseal(tid, actor_timer_sealer);
+    if (!cheri_tag_get(slot)) return NULL;
+
+    generation = cheri_address_get(slot) % ACTOR_TIMER_SLOT_SIZE;
+    t = (struct actor_send_timer *)(slot - generation);
+    if (t->generation != generation) return NULL;
+
+    return t;
+}
+
+/* Called with actor_timers_mutex held, once the timer is retired and neither armed nor firing */
+static void _actor_send_timer_free(struct actor_send_timer *t) {
+    _arelease_actor(t->data, NULL);
+    t->data = NULL;
+    /* Retired slots stay on actor_timer_slots until actor_destroy_all() */
+    if (t->generation >= ACTOR_TIMER_SLOT_SIZE) return;
+    t->next_free = actor_timer_free;
+    actor_timer_free = t;
+}
+
+/* satisfies actor_timer_fire_ptr_t; runs on the timer thread */
+static void _actor_send_timer_fire(actor_timer_t *timer, void *arg) {
+    struct actor_send_timer *t = (struct actor_send_timer *)arg;
+    uint64_t deadline, now;
+    int err;
+
+    (void)timer;
+
+    /*
+     * A cancel may have retired the timer while we waited for the lock; it
+     * is waiting for us to return and frees the slot itself. Otherwise the
+     * last message is committed to before it goes, so a cancel either stops
+     * it or fails.
+     */
+    ACTOR_LOCK(&actor_timers_mutex, ACTOR_LOCK_TIMERS);
+    if (t->generation != t->armed) {
+        ACTOR_UNLOCK(&actor_timers_mutex);
+        return;
+    }
+    if (t->interval == 0) t->generation++;
+    ACTOR_UNLOCK(&actor_timers_mutex);
+
+    /* Never blocks the timer thread on a full mailbox */
+    READ_ACTORS_BEGIN;
+    err = _actor_send_msg(t->dest, t->type, t->data, t->size, SEND_SHARE, ACTOR_PRIORITY_NORMAL, SEND_TRY);
+    READ_ACTORS_END;
+
+    ACTOR_LOCK(&actor_timers_mutex, ACTOR_LOCK_TIMERS);
+    if (t->interval == 0) {
+        _actor_send_timer_free(t);
+    } else if (t->generation != t->armed) {
+        /* Cancelled meanwhile; actor_cancel_timer() frees it once we return */
+    } else if (err == ESRCH) {
+        t->generation++;
+        _actor_send_timer_free(t);
+    } else {
+        /* Keeps to the original schedule, skipping the intervals already missed */
+        now = _actor_clock_ns();
+        deadline = t->timer.deadline + t->interval;
+        if (deadline <= now) deadline += (now - deadline) / t->interval * t->interval + t->interval;
+        _actor_timer_arm(&t->timer, deadline, _actor_send_timer_fire, t);
+    }
+    ACTOR_UNLOCK(&actor_timers_mutex);
+}
+
+static actor_timer_id _actor_send_timer(actor_id aid, long delay, long interval, long type, void *data, size_t size) {
+    actor_state_t *self = _actor_current();
+    struct actor_send_timer *t;
+    actor_timer_id tid;
+
+    if (delay < 0) delay = 0;
+
+    ACTOR_LOCK(&actor_timers_mutex, ACTOR_LOCK_TIMERS);
+    if ((t = actor_timer_free) != NULL) {
+        actor_timer_free = t->next_free;
+    } else {
+        /* Aligned so that an actor_timer_id's offset into its slot is the generation */
+        t = (struct actor_send_timer *)aligned_alloc(ACTOR_TIMER_SLOT_SIZE, ACTOR_TIMER_SLOT_SIZE);
+        assert(t != NULL);
+        memset(t, 0, sizeof(struct actor_send_timer));
+        t->next = actor_timer_slots;
+        actor_timer_slots = t;
+    }
+
+    t->dest = aid;
+    t->type = type;
+    t->data = size > 0 ? _actor_copy_message_data(data, size, self) : NULL;
+    t->size = size;
+    t->interval = (uint64_t)interval * 1000000ull;
+    t->armed = t->generation;
+    tid = _actor_send_timer_id(t);
+    _actor_timer_arm(&t->timer, _actor_clock_ns() + (uint64_t)delay * 1000000ull, _actor_send_timer_fire, t);
+    ACTOR_UNLOCK(&actor_timers_mutex);
+
+    return tid;
+}
+
+actor_timer_id actor_send_after(actor_id aid, long delay, long type, void *data, size_t size) {
+    return _actor_send_timer(aid, delay, 0, type, data, size);
+}
+
+actor_timer_id actor_send_interval(actor_id aid, long interval, long type, void *data, size_t size) {
+    if (interval <= 0) return NULL;
+
+    return _actor_send_timer(aid, interval, interval, type, data, size);
+}
+
+int actor_cancel_timer(actor_timer_id tid) {
+    struct actor_send_timer *t;
+
+    ACTOR_LOCK(&actor_timers_mutex, ACTOR_LOCK_TIMERS);
+    if ((t = _actor_send_timer_resolve(tid)) != NULL) t->generation++;
+    ACTOR_UNLOCK(&actor_timers_mutex);
+
+    if (t == NULL) return ESRCH;
+
+    /* Waits out a callback in progress; it sees the new generation and leaves the timer alone */
+    _actor_timer_cancel(&t->timer);
+
+    ACTOR_LOCK(&actor_timers_mutex, ACTOR_LOCK_TIMERS);
+    _actor_send_timer_free(t);
+    ACTOR_UNLOCK(&actor_timers_mutex);
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------------
+                                      I/O
+------------------------------------------------------------------------------*/
+
+/* satisfies actor_io_fire_ptr_t; runs on the reactor thread. `req->arg` is the watching actor. */
+static void _actor_io_fire(int fd, int events, const actor_io_request_t *req) {
+    size_t header = offsetof(actor_io_event_t, data);
+    actor_io_event_t ready, *ev;
+    ssize_t n;
+
+    if (req->size == 0) {
+        memset(&ready, 0, sizeof(ready));
+        ready.fd = fd;
+        ready.events = events;
+
+        READ_ACTORS_BEGIN;
+        _actor_send_msg(req->arg, ACTOR_MSG_IO, &ready, header, SEND_COPY, ACTOR_PRIORITY_NORMAL, SEND_UNBOUNDED);
+        READ_ACTORS_END;
+        return;
     }
 
-    pthread_mutex_unlock(&actors_alloc);
+    /* Read straight into the block that the message carries */
+    if ((ev = (actor_io_event_t *)_amalloc_actor(header + req->size, NULL, false)) == NULL) {
+        memset(&ready, 0, sizeof(ready));
+        ready.fd = fd;
+        ready.events = events;
+        ready.error = ENOMEM;
+
+        READ_ACTORS_BEGIN;
+        _actor_send_msg(req->arg, ACTOR_MSG_IO_READ, &ready, header, SEND_COPY, ACTOR_PRIORITY_NORMAL,
+                        SEND_UNBOUNDED);
+        READ_ACTORS_END;
+        return;
+    }
+    while ((n = read(fd, ev->data, req->size)) < 0 && errno == EINTR) continue;
 
-    st = list_filter(actor_list, find_thread, (void *)PTHREAD_HANDLE(thread));
-    if (st != NULL) {
-        if ((al = list_filter(&st->allocs, find_actor_block, block)) != NULL) {
-            list_remove(&st->allocs, al);
-            free(al);
+    /* Readiness can be spurious; wait for the next */
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && (errno = _actor_io_arm(fd, ACTOR_IO_READ, req)) == 0) {
+        _arelease_actor(ev, NULL);
+        return;
+    }
+
+    ev->fd = fd;
+    ev->events = events;
+    ev->error = n < 0 ? errno : 0;
+    ev->length = n > 0 ? (size_t)n : 0;
+
+    READ_ACTORS_BEGIN;
+    _actor_send_msg(req->arg, ACTOR_MSG_IO_READ, ev, header + ev->length, SEND_MOVE, ACTOR_PRIORITY_NORMAL,
+                    SEND_UNBOUNDED);
+    READ_ACTORS_END;
+}
+
+static int _actor_io_request(int fd, int events, size_t max) {
+    actor_state_t *self = _actor_current();
+    actor_io_request_t req;
+    int flags;
+
+    if (self == NULL) return EINVAL;
+
+    /* The reactor thread must never block on the descriptor */
+    if ((flags = fcntl(fd, F_GETFL)) < 0) return errno;
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return errno;
+
+    req.fire = _actor_io_fire;
+    req.arg = self->id;
+    req.size = max;
+
+    return _actor_io_arm(fd, events, &req);
+}
+
+int actor_io_watch(int fd, int events) {
+    return _actor_io_request(fd, events, 0);
+}
+
+int actor_io_read(int fd, size_t max) {
+    if (max == 0) return EINVAL;
+
+    return _actor_io_request(fd, ACTOR_IO_READ, max);
+}
+
+int actor_io_unwatch(int fd) {
+    return _actor_io_disarm(fd, NULL) ? 0 : ESRCH;
+}
+
+
+/*------------------------------------------------------------------------------
+                                memory management
+------------------------------------------------------------------------------*/
+
+static size_t _alloc_hash(const void *block) {
+    uint64_t h = (uint64_t)cheri_address_get(block);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+/* Called with the shard locked; returns the link pointing at `block`'s record, or at the chain's NULL */
+static alloc_info_t **_alloc_table_link(struct alloc_shard *shard, size_t hash, const void *block) {
+    alloc_info_t **link = &shard->buckets[(hash / ALLOC_SHARDS) & (shard->nbuckets - 1)];
+
+    while (*link != NULL && (*link)->block != block) link = &(*link)->next;
+    return link;
+}
+
+/* Called with the shard locked */
+static void _alloc_table_grow(struct alloc_shard *shard) {
+    alloc_info_t **old = shard->buckets, *info, *next;
+    size_t x, nbuckets = shard->nbuckets;
+
+    shard->nbuckets = nbuckets == 0 ? 64 : nbuckets * 2;
+    shard->buckets = (alloc_info_t **)calloc(shard->nbuckets, sizeof(alloc_info_t *));
+    assert(shard->buckets != NULL);
+
+    for (x = 0; x < nbuckets; x++) {
+        for (info = old[x]; info != NULL; info = next) {
+            alloc_info_t **link = &shard->buckets[(_alloc_hash(info->block) / ALLOC_SHARDS) & (shard->nbuckets - 1)];
+            next = info->next;
+            info->next = *link;
+            *link = info;
+        }
+    }
+    free(old);
+}
+
+/* Open addressing with linear probing; `block` is present or the returned slot is empty */
+static size_t _actor_refs_probe(actor_state_t *st, const void *block) {
+    size_t mask = st->refs_capacity - 1;
+    size_t x = _alloc_hash(block) & mask;
+
+    while (st->refs[x].block != NULL && st->refs[x].block != block) x = (x + 1) & mask;
+    return x;
+}
+
+/* Records that `st` holds a reference to `block`, released when it exits. Only `st` may call this. */
+static void _actor_refs_add(actor_state_t *st, void *block) {
+    struct actor_ref *old = st->refs;
+    size_t x, capacity = st->refs_capacity;
+
+    if ((st->refs_count + 1) * 4 > st->refs_capacity * 3) {
+        st->refs_capacity = capacity == 0 ? 16 : capacity * 2;
+        st->refs = (struct actor_ref *)calloc(st->refs_capacity, sizeof(struct actor_ref));
+        assert(st->refs != NULL);
+        for (x = 0; x < capacity; x++) {
+            if (old[x].block != NULL) st->refs[_actor_refs_probe(st, old[x].block)] = old[x];
         }
+        free(old);
+    }
+
+    x = _actor_refs_probe(st, block);
+    if (st->refs[x].block == NULL) {
+        st->refs[x].block = block;
+        st->refs_count++;
     }
+    st->refs[x].count++;
+}
+
+/* Drops one reference recorded by _actor_refs_add(); false if `st` holds none */
+static bool _actor_refs_remove(actor_state_t *st, const void *block) {
+    size_t mask = st->refs_capacity - 1;
+    size_t x, y, home;
+
+    if (st->refs_count == 0) return false;
+
+    x = _actor_refs_probe(st, block);
+    if (st->refs[x].block == NULL) return false;
+    if (--st->refs[x].count > 0) return true;
+
+    /* Backward-shift deletion keeps probe sequences intact without tombstones */
+    for (y = (x + 1) & mask; st->refs[y].block != NULL; y = (y + 1) & mask) {
+        home = _alloc_hash(st->refs[y].block) & mask;
+        if (((y - home) & mask) >= ((y - x) & mask)) {
+            st->refs[x] = st->refs[y];
+            x = y;
+        }
+    }
+    st->refs[x].block = NULL;
+    st->refs[x].count = 0;
+    st->refs_count--;
+
+    return true;
+}
+
+/* Counts against the allocating actor without atomic read-modify-writes, or globally outside of actors */
+static void _alloc_count(actor_state_t *self, int stat, unsigned long n) {
+    if (self == NULL)
+        atomic_fetch_add_explicit(&alloc_stats[stat], n, memory_order_relaxed);
+    else
+        atomic_store_explicit(&self->alloc_stats[stat],
+                              atomic_load_explicit(&self->alloc_stats[stat], memory_order_relaxed) + n,
+                              memory_order_relaxed);
+}
+
+/* Makes `block` known to aretain()/arelease() with one reference */
+static void _alloc_register(void *block, actor_slab_t *slab, struct actor_arena_chunk *chunk) {
+    alloc_info_t *info, **link;
+    struct alloc_shard *shard;
+    size_t hash;
+
+    info = (alloc_info_t *)_actor_slab_alloc(&alloc_info_slab);
+    info->block = block;
+    info->slab = slab;
+    info->chunk = chunk;
+    info->next = NULL;
+    atomic_init(&info->refcount, 1);
+
+    hash = _alloc_hash(block);
+    shard = &alloc_table[hash % ALLOC_SHARDS];
+    ACTOR_LOCK(&shard->lock, ACTOR_LOCK_ALLOC);
+    if (shard->count >= shard->nbuckets) _alloc_table_grow(shard);
+    link = _alloc_table_link(shard, hash, block);
+    *link = info;
+    shard->count++;
+    ACTOR_UNLOCK(&shard->lock);
 }
 
-/* satisfies list_filter_func_ptr_t */
-static int find_memory_actor(void *owner, void *arg) {
-    return (owner == arg) ? 0 : -1;
+static void _alloc_free(alloc_info_t *info) {
+    if (info->chunk != NULL)
+        _actor_arena_free(info->chunk);
+    else if (info->slab != NULL)
+        _actor_slab_free(info->slab, info->block);
+    else
+        free(info->block);
+
+    _actor_slab_free(&alloc_info_slab, info);
+}
+
+/*
+ * `self` is the calling actor, or NULL. Small blocks come from its arena.
+ * If `tracked`, the reference is released when `self` exits.
+ */
+static void *_amalloc_actor(size_t size, actor_state_t *self, bool tracked) {
+    struct actor_arena_chunk *chunk = NULL;
+    void *block = NULL;
+
+    if (size == 0) return NULL;
+
+    if (self != NULL && (block = _actor_arena_alloc(&self->arena, size, &chunk)) != NULL) {
+        _alloc_count(self, ALLOC_STAT_ARENA, 1);
+    } else {
+        if ((block = malloc(size)) == NULL) return NULL;
+        _alloc_count(self, ALLOC_STAT_HEAP, 1);
+        _alloc_count(self, ALLOC_STAT_HEAP_BYTES, size);
+    }
+    _alloc_count(self, ALLOC_STAT_BLOCKS, 1);
+    _alloc_count(self, ALLOC_STAT_BYTES, size);
+
+    _alloc_register(block, NULL, chunk);
+
+    if (tracked && self != NULL) _actor_refs_add(self, block);
+
+    return block;
+}
+
+/* A message header from the slab, untracked */
+static actor_msg_t *_amalloc_msg(actor_state_t *self) {
+    void *block = _actor_slab_alloc(&msg_slab);
+
+    _alloc_count(self, ALLOC_STAT_SLAB, 1);
+    _alloc_count(self, ALLOC_STAT_BLOCKS, 1);
+    _alloc_count(self, ALLOC_STAT_BYTES, sizeof(actor_msg_t));
+
+    _alloc_register(block, &msg_slab, NULL);
+
+    return (actor_msg_t *)block;
+}
+
+void *amalloc(size_t size) {
+    actor_state_t *self = _actor_current();
+    void *block = _amalloc_actor(size, self, true);
+
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_AMALLOC, self != NULL ? self->id : NULL, block, size);
+    return block;
+}
+
+/* True if `block` came from amalloc() and is still allocated */
+static bool _alloc_known(const void *block) {
+    struct alloc_shard *shard;
+    size_t hash;
+    bool known;
+
+    if (block == NULL) return false;
+
+    hash = _alloc_hash(block);
+    shard = &alloc_table[hash % ALLOC_SHARDS];
+    ACTOR_LOCK(&shard->lock, ACTOR_LOCK_ALLOC);
+    known = *_alloc_table_link(shard, hash, block) != NULL;
+    ACTOR_UNLOCK(&shard->lock);
+
+    return known;
+}
+
+void aretain(void *block) {
+    _aretain_actor(block, _actor_current());
+}
+
+/* Takes `count` untracked references with one lookup. False if `block` is not an amalloc() block. */
+static bool _alloc_retain_n(void *block, unsigned int count) {
+    alloc_info_t *info = NULL;
+    struct alloc_shard *shard;
+    size_t hash;
+
+    if (block == NULL) return false;
+
+    hash = _alloc_hash(block);
+    shard = &alloc_table[hash % ALLOC_SHARDS];
+    ACTOR_LOCK(&shard->lock, ACTOR_LOCK_ALLOC);
+    if ((info = *_alloc_table_link(shard, hash, block)) != NULL) atomic_fetch_add(&info->refcount, count);
+    ACTOR_UNLOCK(&shard->lock);
+
+    return info != NULL;
+}
+
+/* False if `block` did not come from amalloc() */
+static bool _aretain_actor(void *block, actor_state_t *owner) {
+    if (!_alloc_retain_n(block, 1)) return false;
+
+    if (owner != NULL) _actor_refs_add(owner, block);
+
+    return true;
+}
+
+void arelease(void *block) {
+    actor_state_t *self = _actor_current();
+
+    ACTOR_THREAD_PRINT("arelease()");
+    ACTOR_TRACE_EVENT(ACTOR_TRACE_ARELEASE, self != NULL ? self->id : NULL, block, 0);
+    _arelease_actor(block, self);
+}
+
+static void _arelease_actor(const void *block, actor_state_t *owner) {
+    alloc_info_t *info = NULL, **link;
+    struct alloc_shard *shard;
+    size_t hash;
+
+    if (block == NULL) return;
+
+    if (owner != NULL) _actor_refs_remove(owner, block);
+
+    hash = _alloc_hash(block);
+    shard = &alloc_table[hash % ALLOC_SHARDS];
+    ACTOR_LOCK(&shard->lock, ACTOR_LOCK_ALLOC);
+    link = _alloc_table_link(shard, hash, block);
+    if ((info = *link) != NULL && atomic_fetch_sub(&info->refcount, 1) == 1) { /* time to destroy this block */
+        *link = info->next;
+        shard->count--;
+    } else {
+        info = NULL;
+    }
+    ACTOR_UNLOCK(&shard->lock);
+
+    if (info != NULL) _alloc_free(info);
 }
 
 static void _actor_release_memory(actor_state_t *state) {
-    struct actor_alloc *info, *tmp;
+    struct actor_ref ref;
+    actor_msg_t *msg;
+    size_t x;
 #ifdef DEBUG_MEMORY
-    int count = list_count(&state->allocs);
-    if (count > 0) {
+    if (state->refs_count > 0) {
         printf(
             "_actor_release_memory(): "
-            "automatically releasing %d allocations. "
-            "(actor_id = %d)\n",
-            count, (int)state->myid);
+            "automatically releasing %zu allocations. "
+            "(actor_id = %p)\n",
+            state->refs_count, _actor_id(state));
     }
 #endif
-    for (info = (struct actor_alloc *)state->allocs; info != NULL;) {
-        tmp = info->next;
-        _arelease(info->block, pthread_self());
-        info = tmp;
+    for (x = 0; x < state->refs_capacity; x++) {
+        ref = state->refs[x];
+        while (ref.block != NULL && ref.count-- > 0) _arelease_actor(ref.block, NULL);
+        state->refs[x].block = NULL;
+        state->refs[x].count = 0;
     }
+    state->refs_count = 0;
+
+    /* Messages that were never received */
+    while ((msg = _actor_mailbox_pop(state)) != NULL) _actor_msg_discard(msg);
+
+    /* Chunks are freed whole once the blocks still out there are released */
+    _actor_arena_release(&state->arena);
+
+    for (x = 0; x < ALLOC_STAT_COUNT; x++) {
+        atomic_fetch_add_explicit(&alloc_stats[x], atomic_load_explicit(&state->alloc_stats[x], memory_order_relaxed),
+                                  memory_order_relaxed);
+        atomic_store_explicit(&state->alloc_stats[x], 0, memory_order_relaxed);
+    }
+}
+
+void actor_alloc_stats(actor_alloc_stats_t *stats) {
+    unsigned long totals[ALLOC_STAT_COUNT], mallocs, bytes;
+    actor_state_t *st;
+    size_t x;
+
+    if (stats == NULL) return;
+
+    ACCESS_ACTORS_BEGIN;
+    for (x = 0; x < ALLOC_STAT_COUNT; x++) {
+        totals[x] = atomic_load_explicit(&alloc_stats[x], memory_order_relaxed);
+        for (st = actor_list; st != NULL; st = st->next)
+            totals[x] += atomic_load_explicit(&st->alloc_stats[x], memory_order_relaxed);
+    }
+    ACCESS_ACTORS_END;
+
+    _actor_alloc_chunk_stats(&mallocs, &bytes);
+
+    stats->blocks = totals[ALLOC_STAT_BLOCKS];
+    stats->bytes = totals[ALLOC_STAT_BYTES];
+    stats->slab_blocks = totals[ALLOC_STAT_SLAB];
+    stats->arena_blocks = totals[ALLOC_STAT_ARENA];
+    stats->heap_blocks = totals[ALLOC_STAT_HEAP];
+    stats->mallocs = totals[ALLOC_STAT_HEAP] + mallocs;
+    stats->malloc_bytes = totals[ALLOC_STAT_HEAP_BYTES] + bytes;
 }
@@ -0,0 +1,266 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <cheriintrin.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "lockprof.h"
+
+#define ALLOC_ALIGN alignof(max_align_t)
+#define ALLOC_ROUND(_n) (((_n) + ALLOC_ALIGN - 1) & ~(size_t)(ALLOC_ALIGN - 1))
+
+/* Private structs */
+
+/* A free object; the first object of a batch also links the batches together */
+struct actor_slab_object {
+    struct actor_slab_object *next;
+    struct actor_slab_object *next_batch;
+    size_t count; /* objects in the batch */
+};
+
+struct actor_slab_chunk {
+    struct actor_slab_chunk *next;
+    alignas(max_align_t) char objects[];
+};
+
+/* A thread's free list for one slab, newest first */
+struct slab_local {
+    struct actor_slab_object *head;
+    size_t count;
+    unsigned int epoch;
+};
+
+struct actor_arena_chunk {
+    atomic_uint live; /* unreleased blocks, plus one while the owner bumps from the chunk */
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+/* Internal state */
+static actor_slab_t *slabs[ACTOR_SLAB_MAX];
+static atomic_uint slab_count;
+static atomic_uint slab_epoch = 1; /* bumped by _actor_slab_destroy(), invalidates the free lists */
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key; /* set on threads that have free lists, to give them back at exit */
+static _Thread_local struct slab_local slab_local[ACTOR_SLAB_MAX];
+
+static atomic_ulong chunk_mallocs;
+static atomic_ulong chunk_malloc_bytes;
+
+
+/*------------------------------------------------------------------------------
+                                      slab
+------------------------------------------------------------------------------*/
+
+/* Called with the slab locked */
+static void _slab_push_batch(actor_slab_t *slab, struct actor_slab_object *batch, size_t count) {
+    batch->count = count;
+    batch->next_batch = slab->batches;
+    slab->batches = batch;
+}
+
+/* Hands the first `count` objects of the local list to the other threads */
+static void _slab_give_back(actor_slab_t *slab, struct slab_local *local, size_t count) {
+    struct actor_slab_object *batch = local->head, *last = batch;
+    size_t x;
+
+    if (count == 0) return;
+
+    for (x = 1; x < count; x++) last = last->next;
+    local->head = last->next;
+    local->count -= count;
+    last->next = NULL;
+
+    ACTOR_LOCK(&slab->lock, ACTOR_LOCK_SLAB);
+    _slab_push_batch(slab, batch, count);
+    ACTOR_UNLOCK(&slab->lock);
+}
+
+/* pthread_key_t destructor */
+static void _slab_thread_exit(void *arg) {
+    unsigned int x, epoch = atomic_load(&slab_epoch);
+
+    (void)arg;
+    for (x = 0; x < ACTOR_SLAB_MAX; x++) {
+        if (slabs[x] != NULL && slab_local[x].epoch == epoch)
+            _slab_give_back(slabs[x], &slab_local[x], slab_local[x].count);
+    }
+}
+
+static void _slab_key_create() {
+    pthread_key_create(&slab_key, _slab_thread_exit);
+}
+
+static struct slab_local *_slab_local(actor_slab_t *slab) {
+    struct slab_local *local = &slab_local[slab->index];
+    unsigned int epoch = atomic_load_explicit(&slab_epoch, memory_order_acquire);
+
+    if (local->epoch != epoch) {
+        if (pthread_getspecific(slab_key) == NULL) pthread_setspecific(slab_key, slab_local);
+        local->head = NULL;
+        local->count = 0;
+        local->epoch = epoch;
+    }
+
+    return local;
+}
+
+/* Refills an empty local list from a batch given back by another thread, or a new chunk */
+static void _slab_refill(actor_slab_t *slab, struct slab_local *local) {
+    struct actor_slab_chunk *chunk = NULL;
+    struct actor_slab_object *object;
+    size_t bytes = sizeof(struct actor_slab_chunk) + slab->size * ACTOR_SLAB_CHUNK_OBJECTS;
+    int x;
+
+    ACTOR_LOCK(&slab->lock, ACTOR_LOCK_SLAB);
+    if ((object = slab->batches) != NULL) {
+        slab->batches = object->next_batch;
+        local->head = object;
+        local->count = object->count;
+    }
+    ACTOR_UNLOCK(&slab->lock);
+
+    if (local->head != NULL) return;
+
+    chunk = (struct actor_slab_chunk *)malloc(bytes);
+    assert(chunk != NULL);
+    atomic_fetch_add_explicit(&chunk_mallocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&chunk_malloc_bytes, bytes, memory_order_relaxed);
+
+    ACTOR_LOCK(&slab->lock, ACTOR_LOCK_SLAB);
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    ACTOR_UNLOCK(&slab->lock);
+
+    for (x = ACTOR_SLAB_CHUNK_OBJECTS - 1; x >= 0; x--) {
+        object = (struct actor_slab_object *)cheri_bounds_set(chunk->objects + slab->size * x, slab->size);
+        object->next = local->head;
+        local->head = object;
+    }
+    local->count = ACTOR_SLAB_CHUNK_OBJECTS;
+}
+
+void _actor_slab_init(actor_slab_t *slab, size_t size) {
+    pthread_once(&slab_key_once, _slab_key_create);
+
+    if (slab->size == 0) {
+        slab->index = atomic_fetch_add(&slab_count, 1);
+        assert(slab->index < ACTOR_SLAB_MAX);
+        slabs[slab->index] = slab;
+    }
+
+    slab->size = ALLOC_ROUND(size < sizeof(struct actor_slab_object) ? sizeof(struct actor_slab_object) : size);
+    pthread_mutex_init(&slab->lock, NULL);
+    slab->batches = NULL;
+    slab->chunks = NULL;
+}
+
+void _actor_slab_destroy(actor_slab_t *slab) {
+    struct actor_slab_chunk *chunk;
+
+    atomic_fetch_add(&slab_epoch, 1);
+
+    while ((chunk = slab->chunks) != NULL) {
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->batches = NULL;
+    pthread_mutex_destroy(&slab->lock);
+}
+
+void *_actor_slab_alloc(actor_slab_t *slab) {
+    struct slab_local *local = _slab_local(slab);
+    struct actor_slab_object *object;
+
+    if (local->head == NULL) _slab_refill(slab, local);
+
+    object = local->head;
+    local->head = object->next;
+    local->count--;
+
+    return object;
+}
+
+void _actor_slab_free(actor_slab_t *slab, void *object) {
+    struct slab_local *local = _slab_local(slab);
+    struct actor_slab_object *o = (struct actor_slab_object *)object;
+
+    o->next = local->head;
+    local->head = o;
+
+    if (++local->count >= ACTOR_SLAB_LOCAL_MAX) _slab_give_back(slab, local, ACTOR_SLAB_LOCAL_MAX / 2);
+}
+
+
+/*------------------------------------------------------------------------------
+                                      arena
+------------------------------------------------------------------------------*/
+
+void *_actor_arena_alloc(actor_arena_t *arena, size_t size, struct actor_arena_chunk **chunk) {
+    struct actor_arena_chunk *c = arena->chunk;
+    size_t length, mask, base, offset;
+    size_t bytes = sizeof(struct actor_arena_chunk) + ACTOR_ARENA_CHUNK_SIZE;
+
+    if (size > ACTOR_ARENA_MAX_BLOCK) return NULL;
+
+    /* Blocks are bounded exactly, which may take padding and alignment */
+    length = ALLOC_ROUND(cheri_representable_length(size));
+    mask = cheri_representable_alignment_mask(size) & ~(size_t)(ALLOC_ALIGN - 1);
+
+    for (;;) {
+        if (c != NULL) {
+            base = cheri_address_get(c->data);
+            offset = ((base + c->used + ~mask) & mask) - base;
+            if (offset + length <= ACTOR_ARENA_CHUNK_SIZE) break;
+            _actor_arena_release(arena);
+        }
+
+        c = (struct actor_arena_chunk *)malloc(bytes);
+        assert(c != NULL);
+        atomic_fetch_add_explicit(&chunk_mallocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&chunk_malloc_bytes, bytes, memory_order_relaxed);
+        atomic_init(&c->live, 1);
+        c->used = 0;
+        arena->chunk = c;
+    }
+
+    c->used = offset + length;
+    atomic_fetch_add_explicit(&c->live, 1, memory_order_relaxed);
+    *chunk = c;
+
+    return cheri_bounds_set(c->data + offset, size);
+}
+
+void _actor_arena_free(struct actor_arena_chunk *chunk) {
+    if (atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_acq_rel) == 1) free(chunk);
+}
+
+void _actor_arena_release(actor_arena_t *arena) {
+    if (arena->chunk == NULL) return;
+    _actor_arena_free(arena->chunk);
+    arena->chunk = NULL;
+}
+
+void _actor_alloc_chunk_stats(unsigned long *mallocs, unsigned long *bytes) {
+    *mallocs = atomic_load_explicit(&chunk_mallocs, memory_order_relaxed);
+    *bytes = atomic_load_explicit(&chunk_malloc_bytes, memory_order_relaxed);
+}
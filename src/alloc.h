@@ -0,0 +1,105 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SRC_ALLOC_H_
+#define SRC_ALLOC_H_
+
+/*
+ * Allocators behind amalloc(). This header is private to the library.
+ *
+ * A slab hands out fixed-size objects, such as message headers, from a
+ * free list per thread. A thread whose list grows too long, or that exits,
+ * gives a batch of objects back to the slab for other threads to refill
+ * from, so objects freed by a receiver find their way back to the sender.
+ *
+ * An arena bumps small blocks out of chunks owned by one actor. A chunk is
+ * freed as a whole once the actor has moved on from it and every block in
+ * it has been released, by whichever thread releases last.
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define ACTOR_SLAB_MAX 4               /* slabs per process */
+#define ACTOR_SLAB_CHUNK_OBJECTS 64    /* objects carved from each malloc() */
+#define ACTOR_SLAB_LOCAL_MAX 256       /* objects a thread keeps before giving half of them back */
+#define ACTOR_ARENA_CHUNK_SIZE (64 * 1024)
+#define ACTOR_ARENA_MAX_BLOCK 4096     /* larger blocks get their own malloc() */
+
+struct actor_slab_object;
+struct actor_slab_chunk;
+
+struct actor_slab_struct {
+    size_t size;
+    unsigned int index; /* into every thread's free lists */
+    pthread_mutex_t lock;
+    struct actor_slab_object *batches; /* given back by threads */
+    struct actor_slab_chunk *chunks;
+};
+typedef struct actor_slab_struct actor_slab_t;
+
+struct actor_arena_chunk;
+
+struct actor_arena_struct {
+    struct actor_arena_chunk *chunk; /* the chunk being bumped, or NULL */
+};
+typedef struct actor_arena_struct actor_arena_t;
+
+/**
+ * Prepare `slab` to hand out objects of `size` bytes. Calling this again on
+ * the same slab keeps its place in the free lists.
+ */
+void _actor_slab_init(actor_slab_t *slab, size_t size);
+
+/**
+ * Free every chunk of `slab`, whether or not its objects were freed, and
+ * forget every thread's free list.
+ */
+void _actor_slab_destroy(actor_slab_t *slab);
+
+void *_actor_slab_alloc(actor_slab_t *slab);
+void _actor_slab_free(actor_slab_t *slab, void *object);
+
+/**
+ * Bump `size` bytes out of `arena`. Only the actor that owns `arena` may
+ * call this.
+ *
+ * @param chunk  set to the chunk holding the block, for _actor_arena_free()
+ * @return       the block, or NULL if `size` is over ACTOR_ARENA_MAX_BLOCK
+ */
+void *_actor_arena_alloc(actor_arena_t *arena, size_t size, struct actor_arena_chunk **chunk);
+
+/**
+ * Release one block of `chunk`. Safe to call from any thread.
+ */
+void _actor_arena_free(struct actor_arena_chunk *chunk);
+
+/**
+ * Stop bumping from the current chunk, letting it go once its blocks are
+ * released. Called when the owning actor exits.
+ */
+void _actor_arena_release(actor_arena_t *arena);
+
+/**
+ * Calls to malloc() made for slab and arena chunks, and the bytes asked for.
+ */
+void _actor_alloc_chunk_stats(unsigned long *mallocs, unsigned long *bytes);
+
+#endif  // SRC_ALLOC_H_
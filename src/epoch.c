@@ -0,0 +1,114 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "epoch.h"
+
+#define EPOCH_SPINS 100 /* polls of a record before yielding the CPU */
+
+/* Private structs */
+
+/* A thread's announcement; records are reused by later threads but never freed */
+struct epoch_record {
+    struct epoch_record *next;
+    atomic_ulong epoch; /* the epoch the thread's read section started in, or 0 outside one */
+    atomic_bool in_use;
+};
+
+/* Internal state */
+static atomic_ulong global_epoch = 1;
+static _Atomic(struct epoch_record *) records;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key; /* gives the thread's record up at exit */
+static _Thread_local struct epoch_record *epoch_local;
+
+
+/* pthread_key_t destructor */
+static void _epoch_thread_exit(void *arg) {
+    struct epoch_record *rec = (struct epoch_record *)arg;
+
+    atomic_store(&rec->epoch, 0);
+    atomic_store_explicit(&rec->in_use, false, memory_order_release);
+}
+
+static void _epoch_key_create() {
+    pthread_key_create(&epoch_key, _epoch_thread_exit);
+}
+
+/* Claims a record given up by an exited thread, or adds a new one */
+static struct epoch_record *_epoch_record() {
+    struct epoch_record *rec;
+    bool expected;
+
+    pthread_once(&epoch_key_once, _epoch_key_create);
+
+    for (rec = atomic_load_explicit(&records, memory_order_acquire); rec != NULL; rec = rec->next) {
+        expected = false;
+        if (!atomic_load_explicit(&rec->in_use, memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&rec->in_use, &expected, true))
+            break;
+    }
+
+    if (rec == NULL) {
+        rec = (struct epoch_record *)malloc(sizeof(struct epoch_record));
+        assert(rec != NULL);
+        atomic_init(&rec->epoch, 0);
+        atomic_init(&rec->in_use, true);
+        rec->next = atomic_load_explicit(&records, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&records, &rec->next, rec, memory_order_release,
+                                                      memory_order_relaxed))
+            continue;
+    }
+
+    pthread_setspecific(epoch_key, rec);
+    return rec;
+}
+
+void _actor_epoch_enter(void) {
+    struct epoch_record *rec = epoch_local;
+
+    if (rec == NULL) rec = epoch_local = _epoch_record();
+
+    assert(atomic_load_explicit(&rec->epoch, memory_order_relaxed) == 0);
+
+    /* Sequentially consistent, so the caller's loads cannot move above the announcement */
+    atomic_store(&rec->epoch, atomic_load_explicit(&global_epoch, memory_order_acquire));
+}
+
+void _actor_epoch_exit(void) {
+    atomic_store_explicit(&epoch_local->epoch, 0, memory_order_release);
+}
+
+void _actor_epoch_synchronize(void) {
+    unsigned long target = atomic_fetch_add(&global_epoch, 1) + 1, epoch;
+    struct epoch_record *rec;
+    int spins;
+
+    for (rec = atomic_load_explicit(&records, memory_order_acquire); rec != NULL; rec = rec->next) {
+        for (spins = 0; (epoch = atomic_load(&rec->epoch)) != 0 && epoch < target; spins++) {
+            if (spins >= EPOCH_SPINS) sched_yield();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SRC_EPOCH_H_
+#define SRC_EPOCH_H_
+
+/*
+ * Epoch-based protection of the actor registry. This header is private to
+ * the library.
+ *
+ * Actor slots are never freed while the library runs, so resolving an
+ * actor_id is always safe; what a sender needs is for the actor not to be
+ * torn down between resolving it and queueing a message. Senders do both
+ * inside a read section, which only stores to the calling thread's own
+ * record. An exiting actor first invalidates its IDs and then waits with
+ * _actor_epoch_synchronize() for every read section that may have resolved
+ * them, after which it can drain its mailbox knowing nothing more arrives.
+ *
+ * Read sections do not nest and must not span a context switch of the
+ * scheduler: a task that parks has to leave its read section first.
+ */
+
+/**
+ * Enter a read section on the calling thread.
+ */
+void _actor_epoch_enter(void);
+
+/**
+ * Leave the read section entered by _actor_epoch_enter().
+ */
+void _actor_epoch_exit(void);
+
+/**
+ * Wait until every read section that was in progress when this was called
+ * has been left. The caller must not be in a read section.
+ */
+void _actor_epoch_synchronize(void);
+
+#endif  // SRC_EPOCH_H_
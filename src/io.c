@@ -0,0 +1,351 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#elif defined(__FreeBSD__) || defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#error "The I/O reactor needs epoll or kqueue"
+#endif
+
+#include "libactor/actor.h"
+#include "io.h"
+
+#define IO_EVENTS 64      /* events taken from the poller at once */
+#define IO_MIN_SLOTS 64
+
+/* Private structs */
+
+/* A ready descriptor, as the poller reported it */
+struct io_event {
+    int fd;
+    int events; /* ACTOR_IO_* */
+};
+
+/* What a descriptor is armed with, indexed by descriptor */
+struct io_slot {
+    actor_io_request_t req;
+    int events; /* ACTOR_IO_READ and ACTOR_IO_WRITE, 0 if not armed */
+};
+
+/* Internal state */
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_fired_cond = PTHREAD_COND_INITIALIZER; /* signalled when a callback returns */
+static int io_firing = -1; /* the descriptor whose callback is running */
+static pthread_t io_thread;
+static bool io_running;
+static int io_poller = -1;
+static int io_wake[2] = {-1, -1}; /* a byte written to io_wake[1] stops the thread */
+static struct io_slot *io_slots;
+static size_t io_nslots;
+
+
+/*------------------------------------------------------------------------------
+                                     poller
+------------------------------------------------------------------------------*/
+
+#if defined(__linux__)
+
+static int _io_poller_open() {
+    return epoll_create1(EPOLL_CLOEXEC);
+}
+
+static int _io_poller_add_wake(int fd) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(io_poller, EPOLL_CTL_ADD, fd, &ev) == 0 ? 0 : errno;
+}
+
+/* Called with io_mutex held */
+static int _io_poller_arm(int fd, int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLONESHOT;
+    if (events & ACTOR_IO_READ) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (events & ACTOR_IO_WRITE) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+
+    /* A descriptor stays registered, disabled, once it fires; closing it unregisters it */
+    if (epoll_ctl(io_poller, EPOLL_CTL_MOD, fd, &ev) == 0) return 0;
+    if (errno == ENOENT && epoll_ctl(io_poller, EPOLL_CTL_ADD, fd, &ev) == 0) return 0;
+    return errno;
+}
+
+/* Called with io_mutex held */
+static void _io_poller_disarm(int fd, int events) {
+    struct epoll_event ev;
+
+    (void)events; /* epoll drops the whole registration */
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(io_poller, EPOLL_CTL_DEL, fd, &ev);
+}
+
+/* Called with io_mutex held once `fired` of the `armed` events came in. One-shot disabled them all. */
+static void _io_poller_fired(int fd, int armed, int fired) {
+    (void)fd;
+    (void)armed;
+    (void)fired;
+}
+
+static int _io_poller_wait(struct io_event *out, int max) {
+    struct epoll_event evs[IO_EVENTS];
+    int n, x;
+
+    if ((n = epoll_wait(io_poller, evs, max < IO_EVENTS ? max : IO_EVENTS, -1)) < 0) return 0;
+
+    for (x = 0; x < n; x++) {
+        out[x].fd = evs[x].data.fd;
+        out[x].events = 0;
+        if (evs[x].events & EPOLLIN) out[x].events |= ACTOR_IO_READ;
+        if (evs[x].events & EPOLLOUT) out[x].events |= ACTOR_IO_WRITE;
+        if (evs[x].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) out[x].events |= ACTOR_IO_ERROR;
+    }
+    return n;
+}
+
+#else
+
+static int _io_poller_open() {
+    return kqueue();
+}
+
+static int _io_poller_add_wake(int fd) {
+    struct kevent ev;
+
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    return kevent(io_poller, &ev, 1, NULL, 0, NULL) == 0 ? 0 : errno;
+}
+
+/* Called with io_mutex held. Each direction is a filter of its own. */
+static int _io_poller_arm(int fd, int events) {
+    struct kevent ev[2];
+    int n = 0;
+
+    if (events & ACTOR_IO_READ) EV_SET(&ev[n++], fd, EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, NULL);
+    if (events & ACTOR_IO_WRITE) EV_SET(&ev[n++], fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, NULL);
+    return kevent(io_poller, ev, n, NULL, 0, NULL) == 0 ? 0 : errno;
+}
+
+/* Called with io_mutex held. Filters that are not registered any more fail quietly. */
+static void _io_poller_disarm(int fd, int events) {
+    struct kevent ev;
+
+    if (events & ACTOR_IO_READ) {
+        EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        kevent(io_poller, &ev, 1, NULL, 0, NULL);
+    }
+    if (events & ACTOR_IO_WRITE) {
+        EV_SET(&ev, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        kevent(io_poller, &ev, 1, NULL, 0, NULL);
+    }
+}
+
+/* Called with io_mutex held once `fired` of the `armed` events came in; the other filter is still registered */
+static void _io_poller_fired(int fd, int armed, int fired) {
+    _io_poller_disarm(fd, armed & ~fired);
+}
+
+static int _io_poller_wait(struct io_event *out, int max) {
+    struct kevent evs[IO_EVENTS];
+    int n, x, y, count = 0, events;
+
+    if ((n = kevent(io_poller, NULL, 0, evs, max < IO_EVENTS ? max : IO_EVENTS, NULL)) < 0) return 0;
+
+    /* Both filters of a descriptor may fire at once, and must be handed over together */
+    for (x = 0; x < n; x++) {
+        events = evs[x].filter == EVFILT_WRITE ? ACTOR_IO_WRITE : ACTOR_IO_READ;
+        if (evs[x].flags & (EV_EOF | EV_ERROR)) events |= ACTOR_IO_ERROR;
+
+        for (y = 0; y < count && out[y].fd != (int)evs[x].ident; y++) continue;
+        if (y == count) {
+            out[count].fd = (int)evs[x].ident;
+            out[count++].events = 0;
+        }
+        out[y].events |= events;
+    }
+    return count;
+}
+
+#endif
+
+
+/*------------------------------------------------------------------------------
+                                 reactor thread
+------------------------------------------------------------------------------*/
+
+/* Called with io_mutex held. Disarms `fd` and returns the events to report, or 0 if it was not armed for them. */
+static int _io_take(int fd, int events, actor_io_request_t *req) {
+    struct io_slot *slot;
+
+    if ((size_t)fd >= io_nslots || io_slots[fd].events == 0) return 0;
+    slot = &io_slots[fd];
+
+    /* Errors go to whoever waits; a stale event for the other direction does not */
+    if ((events &= slot->events | ACTOR_IO_ERROR) == 0) return 0;
+
+    _io_poller_fired(fd, slot->events, events);
+    *req = slot->req;
+    slot->events = 0;
+
+    return events;
+}
+
+static void *_io_main(void *arg) {
+    struct io_event events[IO_EVENTS];
+    actor_io_request_t req;
+    int n, x, fired;
+
+    (void)arg;
+    for (;;) {
+        n = _io_poller_wait(events, IO_EVENTS);
+        for (x = 0; x < n; x++) {
+            if (events[x].fd == io_wake[0]) return NULL;
+
+            pthread_mutex_lock(&io_mutex);
+            if ((fired = _io_take(events[x].fd, events[x].events, &req)) != 0) io_firing = events[x].fd;
+            pthread_mutex_unlock(&io_mutex);
+
+            if (fired == 0) continue;
+            req.fire(events[x].fd, fired, &req);
+
+            pthread_mutex_lock(&io_mutex);
+            io_firing = -1;
+            pthread_cond_broadcast(&io_fired_cond);
+            pthread_mutex_unlock(&io_mutex);
+        }
+    }
+}
+
+/* Called with io_mutex held */
+static int _io_start() {
+    int err;
+
+    if ((io_poller = _io_poller_open()) < 0) return errno;
+    if (pipe(io_wake) != 0) {
+        err = errno;
+        close(io_poller);
+        return err;
+    }
+    if ((err = _io_poller_add_wake(io_wake[0])) == 0 && (err = pthread_create(&io_thread, NULL, _io_main, NULL)) == 0) {
+        io_running = true;
+        return 0;
+    }
+
+    close(io_wake[0]);
+    close(io_wake[1]);
+    close(io_poller);
+    return err;
+}
+
+/* Called with io_mutex held */
+static int _io_grow(int fd) {
+    size_t nslots = io_nslots < IO_MIN_SLOTS ? IO_MIN_SLOTS : io_nslots;
+    struct io_slot *slots;
+
+    while (nslots <= (size_t)fd) nslots *= 2;
+    if ((slots = (struct io_slot *)realloc(io_slots, nslots * sizeof(struct io_slot))) == NULL) return ENOMEM;
+    memset(slots + io_nslots, 0, (nslots - io_nslots) * sizeof(struct io_slot));
+
+    io_slots = slots;
+    io_nslots = nslots;
+    return 0;
+}
+
+void _actor_io_stop(void) {
+    pthread_mutex_lock(&io_mutex);
+    if (!io_running) {
+        pthread_mutex_unlock(&io_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&io_mutex);
+
+    while (write(io_wake[1], "", 1) < 0 && errno == EINTR) continue;
+    pthread_join(io_thread, NULL);
+
+    pthread_mutex_lock(&io_mutex);
+    close(io_wake[0]);
+    close(io_wake[1]);
+    close(io_poller);
+    io_poller = io_wake[0] = io_wake[1] = -1;
+    free(io_slots);
+    io_slots = NULL;
+    io_nslots = 0;
+    io_running = false;
+    pthread_mutex_unlock(&io_mutex);
+}
+
+
+/*------------------------------------------------------------------------------
+                                   descriptors
+------------------------------------------------------------------------------*/
+
+int _actor_io_arm(int fd, int events, const actor_io_request_t *req) {
+    int err = 0;
+
+    events &= ACTOR_IO_READ | ACTOR_IO_WRITE;
+    if (fd < 0 || events == 0 || req == NULL || req->fire == NULL) return EINVAL;
+
+    pthread_mutex_lock(&io_mutex);
+    if (!io_running) err = _io_start();
+    if (err == 0 && (size_t)fd >= io_nslots) err = _io_grow(fd);
+    if (err == 0 && io_slots[fd].events != 0) err = EBUSY;
+    if (err == 0) {
+        /* Filled in first: the event may come in straight away, and waits for io_mutex */
+        io_slots[fd].req = *req;
+        io_slots[fd].events = events;
+        if ((err = _io_poller_arm(fd, events)) != 0) io_slots[fd].events = 0;
+    }
+    pthread_mutex_unlock(&io_mutex);
+
+    return err;
+}
+
+int _actor_io_disarm(int fd, actor_io_request_t *req) {
+    int armed = 0;
+
+    pthread_mutex_lock(&io_mutex);
+    /* A callback in progress may still use the descriptor, or re-arm it */
+    if (io_running && !pthread_equal(pthread_self(), io_thread)) {
+        while (io_firing == fd) pthread_cond_wait(&io_fired_cond, &io_mutex);
+    }
+    if (fd >= 0 && (size_t)fd < io_nslots && io_slots[fd].events != 0) {
+        _io_poller_disarm(fd, io_slots[fd].events);
+        if (req != NULL) *req = io_slots[fd].req;
+        io_slots[fd].events = 0;
+        armed = 1;
+    }
+    pthread_mutex_unlock(&io_mutex);
+
+    return armed;
+}
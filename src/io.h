@@ -0,0 +1,75 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_IO_H_
+#define SRC_IO_H_
+
+/*
+ * The I/O reactor: a thread of the library's own waits on epoll(7) on
+ * Linux, or on kqueue(2) on FreeBSD and macOS, for descriptors to become
+ * ready. Each descriptor is armed for one event at a time and disarmed
+ * before its callback runs, so a callback never races another for the same
+ * descriptor. The first descriptor armed starts the thread. This header is
+ * private to the library.
+ */
+
+#include <stddef.h>
+
+struct actor_io_request_struct;
+typedef struct actor_io_request_struct actor_io_request_t;
+
+/*
+ * Runs on the reactor thread, with no locks held, once `fd` is ready.
+ * `events` holds the ACTOR_IO_* bits that are ready.
+ */
+typedef void (*actor_io_fire_ptr_t)(int fd, int events, const actor_io_request_t *req);
+
+/* What to do once a descriptor is ready; copied into the reactor when armed */
+struct actor_io_request_struct {
+    actor_io_fire_ptr_t fire;
+    void *arg;
+    size_t size; /* for the callback, such as how many bytes to read */
+};
+
+/**
+ * Arm `fd` to call `req->fire` once any of the ACTOR_IO_READ and
+ * ACTOR_IO_WRITE `events` is ready; errors and hang-ups are always
+ * reported. A callback may re-arm its own descriptor.
+ *
+ * @return  0, EBUSY if `fd` is armed already, or an errno from the poller
+ */
+int _actor_io_arm(int fd, int events, const actor_io_request_t *req);
+
+/**
+ * Disarm `fd`. A callback running for it is waited out first, unless this
+ * is called from a callback, and whatever it re-armed is disarmed too, so
+ * once this returns no callback uses `fd` and it may be closed.
+ *
+ * @param req  set to the request `fd` was armed with, if it was
+ * @return     1 if `fd` was armed, 0 if it had fired or was never armed
+ */
+int _actor_io_disarm(int fd, actor_io_request_t *req);
+
+/**
+ * Stop and join the reactor thread, forgetting every descriptor armed.
+ */
+void _actor_io_stop(void);
+
+#endif  // SRC_IO_H_
@@ -0,0 +1,196 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lockprof.h"
+#include "scheduler.h"
+
+/* The totals for one lock taken by one function */
+struct lock_site {
+    _Atomic(const char *) site; /* NULL if the entry is free */
+    atomic_ulong acquired;
+    atomic_ulong contended; /* acquisitions that had to wait */
+    atomic_ulong wait_ns;
+    atomic_ulong wait_max;
+    atomic_ulong hold_ns;
+    atomic_ulong hold_max;
+};
+
+/* A lock this thread holds */
+struct lock_held {
+    pthread_mutex_t *mutex;
+    struct lock_site *site;
+    uint64_t since;
+};
+
+static const char *lock_names[ACTOR_LOCK_CLASSES] = {"actors_mutex", "alloc shard", "msg_mutex", "timers_mutex",
+                                                     "slab"};
+static struct lock_site lock_sites[ACTOR_LOCK_CLASSES][ACTOR_LOCK_SITES];
+static atomic_ulong lock_sites_full; /* acquisitions from sites that found no free entry */
+
+static _Thread_local struct {
+    struct lock_held held[ACTOR_LOCK_HELD_MAX];
+    int count;
+} lock_local;
+
+/* Entries are claimed for good; a site is always a string literal, so the pointer identifies it */
+static struct lock_site *_lock_site(int lock, const char *site) {
+    size_t hash = (size_t)(((uintptr_t)site * 0x9e3779b97f4a7c15ull) >> 20);
+    struct lock_site *s;
+    const char *expected;
+
+    for (size_t x = 0; x < ACTOR_LOCK_SITES; x++) {
+        s = &lock_sites[lock][(hash + x) % ACTOR_LOCK_SITES];
+        expected = atomic_load_explicit(&s->site, memory_order_acquire);
+        if (expected == site) return s;
+        if (expected == NULL) {
+            if (atomic_compare_exchange_strong(&s->site, &expected, site) || expected == site) return s;
+        }
+    }
+    return NULL;
+}
+
+static void _lock_max(atomic_ulong *max, unsigned long value) {
+    unsigned long old = atomic_load_explicit(max, memory_order_relaxed);
+
+    while (value > old && !atomic_compare_exchange_weak_explicit(max, &old, value, memory_order_relaxed,
+                                                                 memory_order_relaxed))
+        continue;
+}
+
+static void _lock_push(pthread_mutex_t *mutex, struct lock_site *s, uint64_t now) {
+    struct lock_held *h;
+
+    if (s == NULL || lock_local.count == ACTOR_LOCK_HELD_MAX) return;
+    h = &lock_local.held[lock_local.count++];
+    h->mutex = mutex;
+    h->site = s;
+    h->since = now;
+}
+
+/* Ends the hold of `mutex`, if this thread is timing it */
+static void _lock_pop(pthread_mutex_t *mutex) {
+    uint64_t hold;
+    int x;
+
+    for (x = lock_local.count - 1; x >= 0 && lock_local.held[x].mutex != mutex; x--) continue;
+    if (x < 0) return;
+
+    hold = _actor_clock_ns() - lock_local.held[x].since;
+    atomic_fetch_add_explicit(&lock_local.held[x].site->hold_ns, hold, memory_order_relaxed);
+    _lock_max(&lock_local.held[x].site->hold_max, hold);
+
+    /* Locks are not always released in the reverse order */
+    for (; x < lock_local.count - 1; x++) lock_local.held[x] = lock_local.held[x + 1];
+    lock_local.count--;
+}
+
+void _actor_lock(pthread_mutex_t *mutex, int lock, const char *site) {
+    struct lock_site *s = _lock_site(lock, site);
+    uint64_t start, now, wait;
+
+    if (pthread_mutex_trylock(mutex) == 0) {
+        now = _actor_clock_ns();
+        wait = 0;
+    } else {
+        start = _actor_clock_ns();
+        pthread_mutex_lock(mutex);
+        now = _actor_clock_ns();
+        wait = now - start;
+    }
+
+    if (s == NULL) {
+        atomic_fetch_add_explicit(&lock_sites_full, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&s->acquired, 1, memory_order_relaxed);
+    if (wait > 0) {
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&s->wait_ns, wait, memory_order_relaxed);
+        _lock_max(&s->wait_max, wait);
+    }
+    _lock_push(mutex, s, now);
+}
+
+void _actor_unlock(pthread_mutex_t *mutex) {
+    _lock_pop(mutex);
+    pthread_mutex_unlock(mutex);
+}
+
+void _actor_lock_cond_begin(pthread_mutex_t *mutex) {
+    _lock_pop(mutex);
+}
+
+void _actor_lock_cond_end(pthread_mutex_t *mutex, int lock, const char *site) {
+    _lock_push(mutex, _lock_site(lock, site), _actor_clock_ns());
+}
+
+static int _lock_compare(const void *a, const void *b) {
+    const struct lock_site *x = *(struct lock_site *const *)a, *y = *(struct lock_site *const *)b;
+    unsigned long xw = atomic_load(&x->wait_ns), yw = atomic_load(&y->wait_ns);
+
+    if (xw != yw) return xw > yw ? -1 : 1;
+    xw = atomic_load(&x->hold_ns);
+    yw = atomic_load(&y->hold_ns);
+    return xw > yw ? -1 : xw < yw;
+}
+
+void _actor_lock_report(FILE *out) {
+    struct lock_site *sorted[ACTOR_LOCK_CLASSES * ACTOR_LOCK_SITES], *s;
+    size_t count = 0, x;
+    int lock;
+
+    for (lock = 0; lock < ACTOR_LOCK_CLASSES; lock++) {
+        for (x = 0; x < ACTOR_LOCK_SITES; x++) {
+            if (atomic_load(&lock_sites[lock][x].site) != NULL) sorted[count++] = &lock_sites[lock][x];
+        }
+    }
+    qsort(sorted, count, sizeof(sorted[0]), _lock_compare);
+
+    fprintf(out, "lock profile, most time waited first:\n");
+    fprintf(out, "%-13s %-28s %10s %10s %11s %10s %11s %10s\n", "lock", "taken by", "acquired", "contended",
+            "wait ms", "wait max us", "hold ms", "hold max us");
+    for (x = 0; x < count; x++) {
+        s = sorted[x];
+        lock = (int)((s - &lock_sites[0][0]) / ACTOR_LOCK_SITES);
+        fprintf(out, "%-13s %-28s %10lu %10lu %11.3f %10.1f %11.3f %10.1f\n", lock_names[lock], atomic_load(&s->site),
+                atomic_load(&s->acquired), atomic_load(&s->contended), atomic_load(&s->wait_ns) / 1e6,
+                atomic_load(&s->wait_max) / 1e3, atomic_load(&s->hold_ns) / 1e6, atomic_load(&s->hold_max) / 1e3);
+    }
+    if (atomic_load(&lock_sites_full) > 0)
+        fprintf(out, "%lu acquisitions not counted; raise ACTOR_LOCK_SITES\n", atomic_load(&lock_sites_full));
+
+    for (lock = 0; lock < ACTOR_LOCK_CLASSES; lock++) {
+        for (x = 0; x < ACTOR_LOCK_SITES; x++) {
+            s = &lock_sites[lock][x];
+            atomic_store(&s->site, NULL);
+            atomic_store(&s->acquired, 0);
+            atomic_store(&s->contended, 0);
+            atomic_store(&s->wait_ns, 0);
+            atomic_store(&s->wait_max, 0);
+            atomic_store(&s->hold_ns, 0);
+            atomic_store(&s->hold_max, 0);
+        }
+    }
+    atomic_store(&lock_sites_full, 0);
+}
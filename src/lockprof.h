@@ -0,0 +1,84 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_LOCKPROF_H_
+#define SRC_LOCKPROF_H_
+
+/*
+ * The lock contention profiler, compiled in with ACTOR_LOCK_PROFILE.
+ * The library's locks are taken with ACTOR_LOCK() and released with
+ * ACTOR_UNLOCK(), which then time how long each acquisition waited and
+ * how long the lock was held, and add them up by lock and by the function
+ * that took it. actor_destroy_all() prints the totals. Without
+ * ACTOR_LOCK_PROFILE the macros are plain pthread calls. This header is
+ * private to the library.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+/* The locks profiled, each standing for every lock of its kind */
+enum {
+    ACTOR_LOCK_ACTORS, /* actors_mutex */
+    ACTOR_LOCK_ALLOC,  /* the shards of the allocation registry */
+    ACTOR_LOCK_MSG,    /* an actor's msg_mutex */
+    ACTOR_LOCK_TIMERS, /* actor_timers_mutex */
+    ACTOR_LOCK_SLAB,   /* a slab's shared free list */
+    ACTOR_LOCK_CLASSES
+};
+
+#define ACTOR_LOCK_SITES 64     /* call sites per lock */
+#define ACTOR_LOCK_HELD_MAX 8   /* locks one thread can hold at once and have timed */
+
+/**
+ * Take `mutex`, counted against `lock` (ACTOR_LOCK_*) and `site`.
+ */
+void _actor_lock(pthread_mutex_t *mutex, int lock, const char *site);
+
+/**
+ * Release `mutex`, taken with _actor_lock().
+ */
+void _actor_unlock(pthread_mutex_t *mutex);
+
+/**
+ * Around a condition wait on `mutex`: the time waiting for the condition
+ * counts as neither holding the lock nor waiting for it.
+ */
+void _actor_lock_cond_begin(pthread_mutex_t *mutex);
+void _actor_lock_cond_end(pthread_mutex_t *mutex, int lock, const char *site);
+
+/**
+ * Print the totals, most time waited first, and zero them.
+ */
+void _actor_lock_report(FILE *out);
+
+#ifdef ACTOR_LOCK_PROFILE
+#define ACTOR_LOCK(mutex, lock) _actor_lock((mutex), (lock), __func__)
+#define ACTOR_UNLOCK(mutex) _actor_unlock(mutex)
+#define ACTOR_LOCK_COND_BEGIN(mutex) _actor_lock_cond_begin(mutex)
+#define ACTOR_LOCK_COND_END(mutex, lock) _actor_lock_cond_end((mutex), (lock), __func__)
+#else
+#define ACTOR_LOCK(mutex, lock) pthread_mutex_lock(mutex)
+#define ACTOR_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define ACTOR_LOCK_COND_BEGIN(mutex) ((void)0)
+#define ACTOR_LOCK_COND_END(mutex, lock) ((void)0)
+#endif
+
+#endif  // SRC_LOCKPROF_H_
@@ -0,0 +1,120 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/umtx.h>
+#endif
+
+#include "park.h"
+
+#define PARK_BUCKETS 64 /* condition variables shared by the words, without a futex */
+
+#if defined(__linux__)
+
+void _actor_park_wait(atomic_uint *word, unsigned int expected, uint64_t deadline) {
+    struct timespec ts;
+
+    /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+    syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, expected, deadline != 0 ? &ts : NULL, NULL,
+            FUTEX_BITSET_MATCH_ANY);
+}
+
+void _actor_park_wake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+#elif defined(__FreeBSD__)
+
+void _actor_park_wait(atomic_uint *word, unsigned int expected, uint64_t deadline) {
+    struct _umtx_time ut;
+
+    ut._timeout.tv_sec = deadline / 1000000000ull;
+    ut._timeout.tv_nsec = deadline % 1000000000ull;
+    ut._flags = UMTX_ABSTIME;
+    ut._clockid = CLOCK_MONOTONIC;
+    _umtx_op(word, UMTX_OP_WAIT_UINT_PRIVATE, expected, deadline != 0 ? (void *)sizeof(ut) : NULL,
+             deadline != 0 ? &ut : NULL);
+}
+
+void _actor_park_wake(atomic_uint *word) {
+    _umtx_op(word, UMTX_OP_WAKE_PRIVATE, 1, NULL, NULL);
+}
+
+#else
+
+static struct park_bucket {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} park_buckets[PARK_BUCKETS];
+static pthread_once_t park_once = PTHREAD_ONCE_INIT;
+
+static void _park_init() {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (int x = 0; x < PARK_BUCKETS; x++) {
+        pthread_mutex_init(&park_buckets[x].lock, NULL);
+        pthread_cond_init(&park_buckets[x].cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+}
+
+static struct park_bucket *_park_bucket(atomic_uint *word) {
+    pthread_once(&park_once, _park_init);
+    return &park_buckets[((uintptr_t)word / sizeof(*word)) % PARK_BUCKETS];
+}
+
+void _actor_park_wait(atomic_uint *word, unsigned int expected, uint64_t deadline) {
+    struct park_bucket *b = _park_bucket(word);
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000000ull;
+    ts.tv_nsec = deadline % 1000000000ull;
+
+    pthread_mutex_lock(&b->lock);
+    if (atomic_load(word) == expected) {
+        if (deadline != 0)
+            pthread_cond_timedwait(&b->cond, &b->lock, &ts);
+        else
+            pthread_cond_wait(&b->cond, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+void _actor_park_wake(atomic_uint *word) {
+    struct park_bucket *b = _park_bucket(word);
+
+    /* Other words share the bucket, so every sleeper must recheck */
+    pthread_mutex_lock(&b->lock);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+#endif
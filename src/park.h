@@ -0,0 +1,58 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SRC_PARK_H_
+#define SRC_PARK_H_
+
+/*
+ * Parking a thread on a 32-bit word, as with a futex: the sleeper passes
+ * the value it expects, so a wake between its check and its sleep is not
+ * lost. Backed by futex(2) on Linux and _umtx_op(2) on FreeBSD, and by
+ * condition variables elsewhere. This header is private to the library.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Sleep while `*word` is `expected`, until _actor_park_wake() is called on
+ * `word` or `deadline` (see _actor_clock_ns(), 0 for none) passes. Wakeups
+ * may be spurious.
+ */
+void _actor_park_wait(atomic_uint *word, unsigned int expected, uint64_t deadline);
+
+/**
+ * Wake one thread sleeping on `word`.
+ */
+void _actor_park_wake(atomic_uint *word);
+
+/**
+ * Hint to the CPU that the caller is spinning.
+ */
+static inline void _actor_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#elif defined(__riscv)
+    __asm__ __volatile__("nop");
+#endif
+}
+
+#endif  // SRC_PARK_H_
@@ -0,0 +1,565 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "scheduler.h"
+#include "timer.h"
+
+/* Private structs */
+
+struct actor_worker_struct;
+typedef struct actor_worker_struct actor_worker_t;
+
+enum { TASK_RUNNABLE, TASK_PARKING, TASK_EXITED };
+
+struct actor_task_struct {
+    actor_task_t *next; /* all-tasks list */
+    actor_task_t *prev;
+    ucontext_t *context; /* NULL for stackless tasks, which run on the worker's stack */
+    void *stack;
+    size_t stack_size;
+    actor_task_function_ptr_t fun;
+    void *arg;
+    void *local; /* see _actor_sched_local() */
+    actor_worker_t *worker; /* the worker currently running the task */
+    int status;
+
+    /* parking */
+    atomic_int parked;
+    pthread_mutex_t *lock;
+    actor_task_check_ptr_t check;
+    void *check_arg;
+
+    /* the receive timeout */
+    uint64_t deadline;
+    actor_timer_t timer;
+};
+
+/*
+ * Each worker owns a ring buffer of runnable tasks. The owner takes from the
+ * head so that tasks run in the order they were woken; thieves take from the
+ * tail.
+ */
+struct actor_worker_struct {
+    pthread_t thread;
+    ucontext_t context;
+    pthread_mutex_t lock;
+    actor_task_t **queue;
+    size_t head;
+    size_t capacity;
+    atomic_size_t count;
+    unsigned int index;
+    unsigned int seed;
+};
+
+/* Internal state */
+static actor_worker_t *sched_workers;
+static unsigned int sched_nworkers;
+static atomic_int sched_running;
+static atomic_int sched_shutdown;
+static atomic_uint sched_next_worker;
+static _Thread_local actor_worker_t *sched_worker;
+static _Thread_local actor_task_t *sched_task;
+static _Thread_local void *sched_local; /* the running task's `local`, or the thread's own */
+
+static pthread_mutex_t sched_idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_idle_cond;
+static atomic_uint sched_idle;
+
+static pthread_mutex_t sched_tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static actor_task_t *sched_tasks;
+static actor_task_t *sched_free_tasks;
+static size_t sched_free_count;
+
+static void _sched_push(actor_worker_t *w, actor_task_t *task);
+static void _sched_free_task(actor_task_t *task);
+
+
+uint64_t _actor_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+/*------------------------------------------------------------------------------
+                                   run queues
+------------------------------------------------------------------------------*/
+
+static void _sched_push(actor_worker_t *w, actor_task_t *task) {
+    if (w == NULL) w = &sched_workers[atomic_fetch_add(&sched_next_worker, 1) % sched_nworkers];
+
+    pthread_mutex_lock(&w->lock);
+    size_t count = atomic_load(&w->count);
+    if (count == w->capacity) {
+        size_t capacity = w->capacity * 2;
+        actor_task_t **queue = (actor_task_t **)malloc(sizeof(actor_task_t *) * capacity);
+        assert(queue != NULL);
+        for (size_t x = 0; x < count; x++) queue[x] = w->queue[(w->head + x) % w->capacity];
+        free(w->queue);
+        w->queue = queue;
+        w->head = 0;
+        w->capacity = capacity;
+    }
+    w->queue[(w->head + count) % w->capacity] = task;
+    atomic_store(&w->count, count + 1);
+    pthread_mutex_unlock(&w->lock);
+
+    /* Pairs with the recheck in _sched_idle() */
+    if (atomic_load(&sched_idle) > 0) {
+        pthread_mutex_lock(&sched_idle_mutex);
+        pthread_cond_signal(&sched_idle_cond);
+        pthread_mutex_unlock(&sched_idle_mutex);
+    }
+}
+
+static actor_task_t *_sched_pop(actor_worker_t *w) {
+    actor_task_t *task = NULL;
+
+    if (atomic_load(&w->count) == 0) return NULL;
+
+    pthread_mutex_lock(&w->lock);
+    size_t count = atomic_load(&w->count);
+    if (count > 0) {
+        task = w->queue[w->head];
+        w->head = (w->head + 1) % w->capacity;
+        atomic_store(&w->count, count - 1);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return task;
+}
+
+static actor_task_t *_sched_steal(actor_worker_t *w) {
+    actor_task_t *task = NULL;
+    unsigned int start = rand_r(&w->seed);
+
+    for (unsigned int x = 0; x < sched_nworkers && task == NULL; x++) {
+        actor_worker_t *victim = &sched_workers[(start + x) % sched_nworkers];
+        if (victim == w || atomic_load(&victim->count) == 0) continue;
+
+        pthread_mutex_lock(&victim->lock);
+        size_t count = atomic_load(&victim->count);
+        if (count > 0) {
+            task = victim->queue[(victim->head + count - 1) % victim->capacity];
+            atomic_store(&victim->count, count - 1);
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return task;
+}
+
+static int _sched_has_work() {
+    for (unsigned int x = 0; x < sched_nworkers; x++) {
+        if (atomic_load(&sched_workers[x].count) > 0) return 1;
+    }
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------------
+                                     timers
+------------------------------------------------------------------------------*/
+
+/*
+ * satisfies actor_timer_fire_ptr_t. Takes the task's lock so that the wake
+ * cannot fall between _sched_finish_park() checking the deadline and
+ * marking the task parked.
+ */
+static void _sched_timer_fire(actor_timer_t *timer, void *arg) {
+    actor_task_t *task = (actor_task_t *)arg;
+
+    (void)timer;
+    pthread_mutex_lock(task->lock);
+    _actor_sched_wake(task);
+    pthread_mutex_unlock(task->lock);
+}
+
+
+/*------------------------------------------------------------------------------
+                                     tasks
+------------------------------------------------------------------------------*/
+
+actor_task_t *_actor_sched_current(void) __attribute__((noinline));
+
+/* Not inlined: a task may resume on another worker, so the thread-local must be re-read on every call */
+actor_task_t *_actor_sched_current(void) {
+    return sched_task;
+}
+
+void *_actor_sched_arg(actor_task_t *task) {
+    return task->arg;
+}
+
+void *_actor_sched_local(void) __attribute__((noinline));
+
+/* Not inlined, for the same reason as _actor_sched_current() */
+void *_actor_sched_local(void) {
+    return sched_local;
+}
+
+void _actor_sched_set_local(void *local) {
+    actor_task_t *task = _actor_sched_current();
+
+    if (task != NULL) task->local = local;
+    sched_local = local;
+}
+
+static void _sched_trampoline(void) {
+    actor_task_t *task = _actor_sched_current();
+
+    (task->fun)(task->arg);
+
+    task->status = TASK_EXITED;
+    setcontext(&task->worker->context);
+}
+
+/*
+ * A cached task if the stack size is the default, otherwise a new one, or
+ * NULL with errno set. Each stack is two mappings, as the guard page splits
+ * it, so vm.max_map_count limits how many tasks can have stacks at once.
+ */
+static actor_task_t *_sched_alloc_task(size_t stack_size) {
+    actor_task_t *task = NULL;
+    long page = sysconf(_SC_PAGESIZE);
+    int err;
+
+    if (stack_size == 0) stack_size = ACTOR_TASK_STACK_SIZE;
+    stack_size = (stack_size + page - 1) / page * page;
+
+    if (stack_size == ACTOR_TASK_STACK_SIZE) {
+        pthread_mutex_lock(&sched_tasks_mutex);
+        if ((task = sched_free_tasks) != NULL) {
+            sched_free_tasks = task->next;
+            sched_free_count--;
+        }
+        pthread_mutex_unlock(&sched_tasks_mutex);
+    }
+
+    if (task != NULL) return task;
+
+    if ((task = (actor_task_t *)calloc(1, sizeof(actor_task_t))) == NULL) return NULL;
+    atomic_init(&task->parked, 0);
+    if ((task->context = (ucontext_t *)malloc(sizeof(ucontext_t))) == NULL) goto fail;
+
+    /* The lowest page of the stack is a guard page */
+    task->stack_size = stack_size + page;
+    task->stack = mmap(NULL, task->stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (task->stack == MAP_FAILED) goto fail;
+    if (mprotect(task->stack, page, PROT_NONE) != 0) {
+        munmap(task->stack, task->stack_size);
+        goto fail;
+    }
+
+    return task;
+
+fail:
+    err = errno;
+    free(task->context);
+    free(task);
+    errno = err;
+    return NULL;
+}
+
+actor_task_t *_actor_sched_spawn(actor_task_function_ptr_t fun, void *arg, size_t stack_size) {
+    /* Volatile as it lives across getcontext(), which may return twice as far as the compiler knows */
+    actor_task_t *volatile task;
+    long page = sysconf(_SC_PAGESIZE);
+
+    assert(fun != NULL);
+
+    if ((task = _sched_alloc_task(stack_size)) == NULL) return NULL;
+    task->fun = fun;
+    task->arg = arg;
+    task->local = NULL;
+    task->status = TASK_RUNNABLE;
+
+    getcontext(task->context);
+    task->context->uc_stack.ss_sp = (char *)task->stack + page;
+    task->context->uc_stack.ss_size = task->stack_size - page;
+    task->context->uc_link = NULL;
+    makecontext(task->context, _sched_trampoline, 0);
+
+    pthread_mutex_lock(&sched_tasks_mutex);
+    task->prev = NULL;
+    task->next = sched_tasks;
+    if (sched_tasks != NULL) sched_tasks->prev = task;
+    sched_tasks = task;
+    pthread_mutex_unlock(&sched_tasks_mutex);
+
+    _sched_push(sched_worker, task);
+
+    return task;
+}
+
+actor_task_t *_actor_sched_spawn_stackless(actor_task_function_ptr_t fun, void *arg) {
+    actor_task_t *task;
+
+    assert(fun != NULL);
+
+    task = (actor_task_t *)calloc(1, sizeof(actor_task_t));
+    assert(task != NULL);
+    atomic_init(&task->parked, 0);
+    task->fun = fun;
+    task->arg = arg;
+    task->status = TASK_RUNNABLE;
+
+    pthread_mutex_lock(&sched_tasks_mutex);
+    task->prev = NULL;
+    task->next = sched_tasks;
+    if (sched_tasks != NULL) sched_tasks->prev = task;
+    sched_tasks = task;
+    pthread_mutex_unlock(&sched_tasks_mutex);
+
+    _sched_push(sched_worker, task);
+
+    return task;
+}
+
+/* Finished tasks keep their stack and are cached for the next spawn */
+static void _sched_free_task(actor_task_t *task) {
+    long page = sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&sched_tasks_mutex);
+    if (task->prev != NULL)
+        task->prev->next = task->next;
+    else
+        sched_tasks = task->next;
+    if (task->next != NULL) task->next->prev = task->prev;
+
+    if (sched_free_count < ACTOR_TASK_CACHE_SIZE && task->stack != NULL &&
+        task->stack_size == ACTOR_TASK_STACK_SIZE + (size_t)page && !atomic_load(&sched_shutdown)) {
+        task->next = sched_free_tasks;
+        sched_free_tasks = task;
+        sched_free_count++;
+        task = NULL;
+    }
+    pthread_mutex_unlock(&sched_tasks_mutex);
+
+    if (task != NULL) {
+        if (task->stack != NULL) munmap(task->stack, task->stack_size);
+        free(task->context);
+        free(task);
+    }
+}
+
+void _actor_sched_park(uint64_t deadline, pthread_mutex_t *lock, actor_task_check_ptr_t check, void *arg) {
+    actor_task_t *task = _actor_sched_current();
+
+    assert(task != NULL && task->stack != NULL);
+
+    task->status = TASK_PARKING;
+    task->deadline = deadline;
+    task->lock = lock;
+    task->check = check;
+    task->check_arg = arg;
+    swapcontext(task->context, &task->worker->context);
+
+    if (deadline != 0) _actor_timer_cancel(&task->timer);
+}
+
+void _actor_sched_suspend(pthread_mutex_t *lock, actor_task_check_ptr_t check, void *arg) {
+    actor_task_t *task = _actor_sched_current();
+
+    assert(task != NULL && task->stack == NULL);
+
+    task->status = TASK_PARKING;
+    task->deadline = 0;
+    task->lock = lock;
+    task->check = check;
+    task->check_arg = arg;
+}
+
+void _actor_sched_yield(void) {
+    actor_task_t *task = _actor_sched_current();
+
+    assert(task != NULL && task->stack == NULL);
+
+    task->status = TASK_RUNNABLE;
+}
+
+void _actor_sched_wake(actor_task_t *task) {
+    if (atomic_exchange(&task->parked, 0) == 1) _sched_push(sched_worker, task);
+}
+
+/*
+ * Runs on the worker's stack once the task has switched out. The task is
+ * marked parked under the same lock its wakers hold, and is not touched
+ * again after that: a waker may resume it on another worker immediately.
+ */
+static void _sched_finish_park(actor_worker_t *w, actor_task_t *task) {
+    pthread_mutex_t *lock = task->lock;
+    uint64_t deadline = task->deadline;
+
+    if (deadline != 0) _actor_timer_arm(&task->timer, deadline, _sched_timer_fire, task);
+
+    pthread_mutex_lock(lock);
+    if (!task->check(task->check_arg) && (deadline == 0 || _actor_clock_ns() < deadline)) {
+        atomic_store(&task->parked, 1);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+    pthread_mutex_unlock(lock);
+
+    _sched_push(w, task);
+}
+
+
+/*------------------------------------------------------------------------------
+                                    workers
+------------------------------------------------------------------------------*/
+
+static void _sched_run(actor_worker_t *w, actor_task_t *task) {
+    task->worker = w;
+    sched_task = task;
+    sched_local = task->local;
+    if (task->stack != NULL) {
+        task->status = TASK_RUNNABLE;
+        swapcontext(&w->context, task->context);
+    } else {
+        /* Done unless it suspends or yields before returning */
+        task->status = TASK_EXITED;
+        (task->fun)(task->arg);
+    }
+    sched_task = NULL;
+    sched_local = NULL;
+
+    switch (task->status) {
+        case TASK_RUNNABLE: /* a stackless task that yielded */
+            _sched_push(w, task);
+            break;
+        case TASK_PARKING:
+            _sched_finish_park(w, task);
+            break;
+        case TASK_EXITED:
+            _sched_free_task(task);
+            break;
+    }
+}
+
+static void _sched_idle() {
+    pthread_mutex_lock(&sched_idle_mutex);
+    atomic_fetch_add(&sched_idle, 1);
+
+    /* Pairs with the check in _sched_push() */
+    if (!_sched_has_work() && !atomic_load(&sched_shutdown)) pthread_cond_wait(&sched_idle_cond, &sched_idle_mutex);
+
+    atomic_fetch_sub(&sched_idle, 1);
+    pthread_mutex_unlock(&sched_idle_mutex);
+}
+
+static void *_sched_worker_main(void *arg) {
+    actor_worker_t *w = (actor_worker_t *)arg;
+    actor_task_t *task;
+
+    sched_worker = w;
+
+    while (!atomic_load(&sched_shutdown)) {
+        if ((task = _sched_pop(w)) == NULL) task = _sched_steal(w);
+
+        if (task != NULL)
+            _sched_run(w, task);
+        else
+            _sched_idle();
+    }
+
+    return NULL;
+}
+
+int _actor_sched_active(void) {
+    return atomic_load(&sched_running);
+}
+
+int _actor_sched_start(unsigned int workers) {
+    if (atomic_load(&sched_running)) return 0;
+
+    if (workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    pthread_cond_init(&sched_idle_cond, NULL);
+
+    sched_workers = (actor_worker_t *)calloc(workers, sizeof(actor_worker_t));
+    if (sched_workers == NULL) return -1;
+    sched_nworkers = workers;
+
+    for (unsigned int x = 0; x < workers; x++) {
+        actor_worker_t *w = &sched_workers[x];
+        pthread_mutex_init(&w->lock, NULL);
+        w->capacity = 64;
+        w->queue = (actor_task_t **)malloc(sizeof(actor_task_t *) * w->capacity);
+        assert(w->queue != NULL);
+        w->index = x;
+        w->seed = x + 1;
+    }
+
+    atomic_store(&sched_running, 1);
+
+    for (unsigned int x = 0; x < workers; x++) {
+        pthread_create(&sched_workers[x].thread, NULL, _sched_worker_main, &sched_workers[x]);
+    }
+
+    return 0;
+}
+
+void _actor_sched_stop(void) {
+    actor_task_t *task;
+
+    if (!atomic_load(&sched_running)) return;
+
+    pthread_mutex_lock(&sched_idle_mutex);
+    atomic_store(&sched_shutdown, 1);
+    pthread_cond_broadcast(&sched_idle_cond);
+    pthread_mutex_unlock(&sched_idle_mutex);
+
+    for (unsigned int x = 0; x < sched_nworkers; x++) {
+        pthread_join(sched_workers[x].thread, NULL);
+        pthread_mutex_destroy(&sched_workers[x].lock);
+        free(sched_workers[x].queue);
+    }
+
+    /* Tasks that were still parked when the runtime shut down */
+    while ((task = sched_tasks) != NULL) _sched_free_task(task);
+    while ((task = sched_free_tasks) != NULL) {
+        sched_free_tasks = task->next;
+        munmap(task->stack, task->stack_size);
+        free(task->context);
+        free(task);
+    }
+    sched_free_count = 0;
+
+    free(sched_workers);
+    sched_workers = NULL;
+    sched_nworkers = 0;
+    pthread_cond_destroy(&sched_idle_cond);
+    atomic_store(&sched_shutdown, 0);
+    atomic_store(&sched_running, 0);
+}
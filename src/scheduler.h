@@ -0,0 +1,135 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SRC_SCHEDULER_H_
+#define SRC_SCHEDULER_H_
+
+/*
+ * M:N scheduler: actors run as tasks with their own small stack, or with
+ * none for handler actors, multiplexed onto a fixed pool of worker
+ * threads. Each worker owns a run queue; idle workers steal from the
+ * others. This header is private to the library.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+struct actor_task_struct;
+typedef struct actor_task_struct actor_task_t;
+
+typedef void (*actor_task_function_ptr_t)(void *);
+
+/* Returns non-zero if a parked task has work and should be resumed */
+typedef int (*actor_task_check_ptr_t)(void *);
+
+#define ACTOR_TASK_STACK_SIZE (64 * 1024)
+#define ACTOR_TASK_CACHE_SIZE 256
+
+/**
+ * Start the worker pool.
+ *
+ * @param workers  number of worker threads, or 0 for one per online CPU
+ * @return         0 on success
+ */
+int _actor_sched_start(unsigned int workers);
+
+/**
+ * Stop and join the worker pool, freeing any task that never finished.
+ */
+void _actor_sched_stop(void);
+
+/**
+ * Non-zero once _actor_sched_start() has succeeded.
+ */
+int _actor_sched_active(void);
+
+/**
+ * Create a task running `fun(arg)` and make it runnable. Only tasks with
+ * the default stack size come from, and go back to, the task cache.
+ *
+ * @param stack_size  the stack size, or 0 for ACTOR_TASK_STACK_SIZE
+ * @return            the task, or NULL with errno set if its stack could not be mapped
+ */
+actor_task_t *_actor_sched_spawn(actor_task_function_ptr_t fun, void *arg, size_t stack_size);
+
+/**
+ * Create a task without a stack of its own and make it runnable. `fun(arg)`
+ * runs on the worker's stack and is called again from the top each time
+ * the task is resumed. It returns after _actor_sched_suspend() to wait,
+ * after _actor_sched_yield() to be called again soon, or after neither
+ * once the task is done. It must not call _actor_sched_park().
+ */
+actor_task_t *_actor_sched_spawn_stackless(actor_task_function_ptr_t fun, void *arg);
+
+/**
+ * The task running on the calling thread, or NULL outside of a task.
+ */
+actor_task_t *_actor_sched_current(void);
+
+/**
+ * The `arg` the task was spawned with.
+ */
+void *_actor_sched_arg(actor_task_t *task);
+
+/**
+ * A pointer private to the running task, or to the calling thread outside
+ * of tasks; NULL until set. A single thread-local load, kept up to date as
+ * tasks move between workers.
+ */
+void *_actor_sched_local(void);
+
+/**
+ * Set the pointer returned by _actor_sched_local() for the running task,
+ * or for the calling thread outside of tasks.
+ */
+void _actor_sched_set_local(void *local);
+
+/**
+ * Suspend the calling task until _actor_sched_wake() is called on it
+ * or `deadline` (see _actor_clock_ns(), 0 for none) passes.
+ * Once the task is off its stack the worker calls `check(arg)` with `lock`
+ * held; if it returns non-zero the task is resumed straight away. Wakers
+ * must hold `lock` around the state change that `check` looks at.
+ * Wakeups may be spurious.
+ */
+void _actor_sched_park(uint64_t deadline, pthread_mutex_t *lock, actor_task_check_ptr_t check, void *arg);
+
+/**
+ * Have the calling stackless task wait once its function returns, as with
+ * _actor_sched_park() without a deadline.
+ */
+void _actor_sched_suspend(pthread_mutex_t *lock, actor_task_check_ptr_t check, void *arg);
+
+/**
+ * Have the calling stackless task queued again once its function returns.
+ */
+void _actor_sched_yield(void);
+
+/**
+ * Make a parked task runnable. Does nothing if the task is not parked.
+ */
+void _actor_sched_wake(actor_task_t *task);
+
+/**
+ * Monotonic clock in nanoseconds.
+ */
+uint64_t _actor_clock_ns(void);
+
+#endif  // SRC_SCHEDULER_H_
@@ -0,0 +1,72 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "libactor/actor.h"
+#include "stats.h"
+
+void _actor_stats_reset(actor_stats_counters_t *c, uint64_t now) {
+    atomic_store_explicit(&c->enqueued, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->depth, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->max_depth, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->dequeued, 0, memory_order_relaxed);
+    for (unsigned int x = 0; x < ACTOR_STATS_BUCKETS; x++) atomic_store_explicit(&c->latency[x], 0, memory_order_relaxed);
+    c->spawned = now;
+}
+
+void _actor_stats_read(actor_stats_counters_t *c, actor_stats_t *stats, uint64_t now) {
+    stats->enqueued = atomic_load_explicit(&c->enqueued, memory_order_relaxed);
+    stats->dequeued = atomic_load_explicit(&c->dequeued, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&c->bytes, memory_order_relaxed);
+    stats->depth = atomic_load_explicit(&c->depth, memory_order_relaxed);
+    stats->max_depth = atomic_load_explicit(&c->max_depth, memory_order_relaxed);
+    stats->uptime_ns = now - c->spawned;
+    for (unsigned int x = 0; x < ACTOR_STATS_BUCKETS; x++)
+        stats->latency[x] = atomic_load_explicit(&c->latency[x], memory_order_relaxed);
+}
+
+uint64_t actor_stats_bucket_ns(unsigned int bucket) {
+    const unsigned int sub = 1u << ACTOR_STATS_SUB_BITS;
+
+    if (bucket >= ACTOR_STATS_BUCKETS) return UINT64_MAX;
+    if (bucket < 2 * sub) return bucket;
+    return (uint64_t)(sub + bucket % sub) << (bucket / sub - 1);
+}
+
+uint64_t actor_stats_percentile(const actor_stats_t *stats, double percentile) {
+    unsigned long total = 0, seen = 0, rank;
+    unsigned int x;
+
+    if (stats == NULL) return 0;
+    for (x = 0; x < ACTOR_STATS_BUCKETS; x++) total += stats->latency[x];
+    if (total == 0) return 0;
+
+    rank = percentile <= 0 ? 1 : percentile >= 100 ? total : (unsigned long)(percentile / 100 * total + 0.5);
+    if (rank == 0) rank = 1;
+    for (x = 0; x < ACTOR_STATS_BUCKETS - 1; x++) {
+        if ((seen += stats->latency[x]) >= rank) break;
+    }
+
+    /* The top of the bucket, so the result never understates */
+    return x < ACTOR_STATS_BUCKETS - 1 ? actor_stats_bucket_ns(x + 1) - 1 : actor_stats_bucket_ns(x);
+}
@@ -0,0 +1,120 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_STATS_H_
+#define SRC_STATS_H_
+
+/*
+ * Per-actor message statistics, compiled in with ACTOR_STATS. Senders
+ * count what they queue and the receiver what it takes, with relaxed
+ * atomics and no locks; the receiver's counters have a single writer, so
+ * they are plain loads and stores. Each message is stamped when it is
+ * created, and the receiver adds the time it spent queued to a log-linear
+ * histogram of ACTOR_STATS_BUCKETS buckets, four to each power of two of
+ * nanoseconds as in HDR histograms. Without ACTOR_STATS the hooks compile
+ * to nothing. This header is private to the library.
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libactor/actor.h"
+
+#define ACTOR_STATS_SUB_BITS 2 /* buckets per power of two, as a power of two */
+
+/* One for each actor slot, zeroed by _actor_stats_reset() when an actor is spawned there */
+typedef struct actor_stats_counters {
+    /* Updated by the senders */
+    atomic_ulong enqueued;
+    atomic_ulong bytes;
+    atomic_size_t depth;
+    atomic_size_t max_depth;
+    /* Updated by the receiver only */
+    atomic_ulong dequeued;
+    atomic_ulong latency[ACTOR_STATS_BUCKETS];
+    uint64_t spawned; /* see _actor_clock_ns() */
+} actor_stats_counters_t;
+
+/* The bucket that `ns` falls in */
+static inline unsigned int _actor_stats_bucket(uint64_t ns) {
+    const unsigned int sub = 1u << ACTOR_STATS_SUB_BITS;
+    unsigned int msb, shift, bucket;
+
+    if (ns < 2 * sub) return (unsigned int)ns;
+    msb = 63 - (unsigned int)__builtin_clzll(ns);
+    shift = msb - ACTOR_STATS_SUB_BITS;
+    bucket = (shift + 1) * sub + (unsigned int)((ns >> shift) & (sub - 1));
+
+    return bucket < ACTOR_STATS_BUCKETS ? bucket : ACTOR_STATS_BUCKETS - 1;
+}
+
+/* Counts `count` messages with `bytes` of data between them queued to the actor */
+static inline void _actor_stats_enqueue(actor_stats_counters_t *c, unsigned long count, size_t bytes) {
+    size_t depth = atomic_fetch_add_explicit(&c->depth, count, memory_order_relaxed) + count;
+    size_t max = atomic_load_explicit(&c->max_depth, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&c->enqueued, count, memory_order_relaxed);
+    if (bytes > 0) atomic_fetch_add_explicit(&c->bytes, bytes, memory_order_relaxed);
+    while (depth > max && !atomic_compare_exchange_weak_explicit(&c->max_depth, &max, depth, memory_order_relaxed,
+                                                                 memory_order_relaxed))
+        continue;
+}
+
+/* Counts a message taken by the receiver, which was stamped with `sent` */
+static inline void _actor_stats_dequeue(actor_stats_counters_t *c, uint64_t sent, uint64_t now) {
+    atomic_ulong *bucket = &c->latency[_actor_stats_bucket(now > sent ? now - sent : 0)];
+
+    atomic_fetch_sub_explicit(&c->depth, 1, memory_order_relaxed);
+    atomic_store_explicit(&c->dequeued, atomic_load_explicit(&c->dequeued, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/* Counts a message discarded from the mailbox before it was received */
+static inline void _actor_stats_discard(actor_stats_counters_t *c) {
+    atomic_fetch_sub_explicit(&c->depth, 1, memory_order_relaxed);
+}
+
+/**
+ * Zero the counters for an actor spawned at `now`.
+ */
+void _actor_stats_reset(actor_stats_counters_t *c, uint64_t now);
+
+/**
+ * Copy the counters into `stats`, leaving the mailbox counters kept by
+ * actor.c alone.
+ */
+void _actor_stats_read(actor_stats_counters_t *c, actor_stats_t *stats, uint64_t now);
+
+#ifdef ACTOR_STATS
+#define ACTOR_STATS_ENQUEUE(st, count, bytes) _actor_stats_enqueue((st)->stats, (count), (bytes))
+#define ACTOR_STATS_DEQUEUE(st, msg) \
+    _actor_stats_dequeue((st)->stats, ACTOR_ENVELOPE(msg)->sent, _actor_clock_ns())
+#define ACTOR_STATS_DISCARD(st) _actor_stats_discard((st)->stats)
+#define ACTOR_STATS_STAMP(msg) (ACTOR_ENVELOPE(msg)->sent = _actor_clock_ns())
+#else
+#define ACTOR_STATS_ENQUEUE(st, count, bytes) ((void)(count), (void)(bytes))
+#define ACTOR_STATS_DEQUEUE(st, msg) ((void)0)
+#define ACTOR_STATS_DISCARD(st) ((void)0)
+#define ACTOR_STATS_STAMP(msg) ((void)0)
+#endif
+
+#endif  // SRC_STATS_H_
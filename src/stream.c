@@ -0,0 +1,424 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(__FreeBSD__)
+#include <sys/socket.h>
+#endif
+
+#include "libactor/stream.h"
+#include "scheduler.h"
+
+#define STREAM_IOV 16 /* pieces handed to one writev(2) */
+
+/* Private structs */
+
+/*
+ * The input is a ring: `head` and `tail` count the bytes consumed and read
+ * since the stream was opened, so the buffered bytes run from
+ * head % ACTOR_STREAM_BUFFER_SIZE to tail % ACTOR_STREAM_BUFFER_SIZE, and
+ * one readv(2) fills the free space even when it wraps around. Lines that
+ * wrap around are copied into `line` to be returned in one piece.
+ *
+ * The output is a plain buffer, written out with whatever did not fit.
+ */
+struct actor_stream_struct {
+    int fd;
+    int error;
+    char *in;
+    size_t head;
+    size_t tail;
+    char *line; /* allocated on first use */
+    char *out;
+    size_t out_len;
+};
+
+
+/*------------------------------------------------------------------------------
+                                    waiting
+------------------------------------------------------------------------------*/
+
+static uint64_t _stream_deadline(long timeout) {
+    return timeout > 0 ? _actor_clock_ns() + (uint64_t)timeout * 1000000ull : 0;
+}
+
+/* Waits through the reactor until the descriptor is ready for `events`. Returns 0 or an error. */
+static int _stream_wait(actor_stream_t *s, int events, uint64_t deadline) {
+    actor_msg_t *msg;
+    long timeout = 0;
+    uint64_t now;
+    int err;
+
+    if (deadline != 0) {
+        if ((now = _actor_clock_ns()) >= deadline) return ETIMEDOUT;
+        timeout = (long)((deadline - now + 999999) / 1000000);
+    }
+
+    if ((err = actor_io_watch(s->fd, events)) != 0) return err;
+    if ((msg = actor_receive_type(ACTOR_MSG_IO, timeout)) == NULL) {
+        /* If the watch fired meanwhile, its message is on the way and must not be left behind */
+        if (actor_io_unwatch(s->fd) != 0) arelease(actor_receive_type(ACTOR_MSG_IO, 0));
+        return ETIMEDOUT;
+    }
+    arelease(msg);
+
+    return 0;
+}
+
+static int _stream_flush(actor_stream_t *s, uint64_t deadline);
+
+/*
+ * Waits until there is input. Output still buffered goes out first, as the
+ * other end may be waiting for it before it sends any more.
+ */
+static int _stream_wait_input(actor_stream_t *s, uint64_t deadline) {
+    int err;
+
+    if ((err = _stream_flush(s, deadline)) != 0) return err;
+    return _stream_wait(s, ACTOR_IO_READ, deadline);
+}
+
+
+/*------------------------------------------------------------------------------
+                                    streams
+------------------------------------------------------------------------------*/
+
+actor_stream_t *actor_stream_open(int fd) {
+    actor_stream_t *s;
+    int flags;
+
+    if (actor_self() == NULL) return NULL;
+
+    if ((flags = fcntl(fd, F_GETFL)) < 0) return NULL;
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return NULL;
+
+    s = (actor_stream_t *)amalloc(sizeof(actor_stream_t));
+    memset(s, 0, sizeof(actor_stream_t));
+    s->fd = fd;
+    s->in = (char *)amalloc(ACTOR_STREAM_BUFFER_SIZE);
+    s->out = (char *)amalloc(ACTOR_STREAM_BUFFER_SIZE);
+
+    return s;
+}
+
+int actor_stream_close(actor_stream_t *s) {
+    int err;
+
+    if (s == NULL) return EINVAL;
+
+    err = _stream_flush(s, 0);
+    close(s->fd);
+
+    arelease(s->line);
+    arelease(s->in);
+    arelease(s->out);
+    arelease(s);
+
+    return err;
+}
+
+int actor_stream_error(actor_stream_t *s) {
+    return s->error;
+}
+
+size_t actor_stream_buffered(actor_stream_t *s) {
+    return s->tail - s->head;
+}
+
+
+/*------------------------------------------------------------------------------
+                                    reading
+------------------------------------------------------------------------------*/
+
+/* Reads into the free space, waiting for at least one byte. Returns the bytes read, 0 at the end, or -1. */
+static ssize_t _stream_fill(actor_stream_t *s, uint64_t deadline) {
+    size_t start = s->tail % ACTOR_STREAM_BUFFER_SIZE, space = ACTOR_STREAM_BUFFER_SIZE - (s->tail - s->head);
+    struct iovec iov[2];
+    ssize_t n;
+
+    iov[0].iov_base = s->in + start;
+    iov[0].iov_len = start + space <= ACTOR_STREAM_BUFFER_SIZE ? space : ACTOR_STREAM_BUFFER_SIZE - start;
+    iov[1].iov_base = s->in;
+    iov[1].iov_len = space - iov[0].iov_len;
+
+    while ((n = readv(s->fd, iov, iov[1].iov_len > 0 ? 2 : 1)) < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            s->error = errno;
+            return -1;
+        }
+        if ((s->error = _stream_wait_input(s, deadline)) != 0) return -1;
+    }
+
+    s->tail += n;
+    s->error = 0;
+    return n;
+}
+
+const char *actor_stream_read_line(actor_stream_t *s, size_t *len, long timeout) {
+    uint64_t deadline = _stream_deadline(timeout);
+    size_t start, first, n, x, scanned = 0;
+    char *line;
+
+    for (;;) {
+        /* Only what came in since the last pass needs searching */
+        for (x = s->head + scanned; x < s->tail && s->in[x % ACTOR_STREAM_BUFFER_SIZE] != '\n'; x++) continue;
+        if (x < s->tail) break;
+
+        scanned = s->tail - s->head;
+        if (scanned == ACTOR_STREAM_BUFFER_SIZE) {
+            s->error = EMSGSIZE;
+            return NULL;
+        }
+        if (_stream_fill(s, deadline) <= 0) return NULL;
+    }
+
+    n = x - s->head;
+    start = s->head % ACTOR_STREAM_BUFFER_SIZE;
+    if (start + n < ACTOR_STREAM_BUFFER_SIZE) {
+        /* The NUL goes where the "\n" was */
+        line = s->in + start;
+    } else {
+        if (s->line == NULL) s->line = (char *)amalloc(ACTOR_STREAM_BUFFER_SIZE);
+        first = ACTOR_STREAM_BUFFER_SIZE - start;
+        memcpy(s->line, s->in + start, first);
+        memcpy(s->line + first, s->in, n - first);
+        line = s->line;
+    }
+    s->head = x + 1;
+
+    if (n > 0 && line[n - 1] == '\r') n--;
+    line[n] = 0;
+    *len = n;
+    s->error = 0;
+
+    return line;
+}
+
+void *actor_stream_read(actor_stream_t *s, size_t max, size_t *len, long timeout) {
+    size_t start, first, n;
+    uint64_t deadline;
+    ssize_t got;
+    char *block;
+
+    if (max == 0) {
+        s->error = EINVAL;
+        return NULL;
+    }
+
+    /* Bytes that are buffered already have to be copied out */
+    if ((n = s->tail - s->head) > 0) {
+        if (n > max) n = max;
+        block = (char *)amalloc(n);
+        start = s->head % ACTOR_STREAM_BUFFER_SIZE;
+        first = start + n <= ACTOR_STREAM_BUFFER_SIZE ? n : ACTOR_STREAM_BUFFER_SIZE - start;
+        memcpy(block, s->in + start, first);
+        memcpy(block + first, s->in, n - first);
+        s->head += n;
+        *len = n;
+        s->error = 0;
+        return block;
+    }
+
+    deadline = _stream_deadline(timeout);
+    block = (char *)amalloc(max);
+    while ((got = read(s->fd, block, max)) < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            s->error = errno;
+        else
+            s->error = _stream_wait_input(s, deadline);
+        if (s->error != 0) break;
+    }
+    if (got <= 0) {
+        if (got == 0) s->error = 0;
+        arelease(block);
+        return NULL;
+    }
+
+    *len = got;
+    s->error = 0;
+    return block;
+}
+
+
+/*------------------------------------------------------------------------------
+                                    writing
+------------------------------------------------------------------------------*/
+
+/* Writes every piece, waiting whenever the descriptor is full. Uses `iov` up. */
+static int _stream_write_all(actor_stream_t *s, struct iovec *iov, int iovcnt, uint64_t deadline) {
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        if (iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        if ((n = writev(s->fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return s->error = errno;
+            if ((s->error = _stream_wait(s, ACTOR_IO_WRITE, deadline)) != 0) return s->error;
+            continue;
+        }
+
+        /* Skip what went out */
+        while (n > 0) {
+            if ((size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            } else {
+                iov->iov_base = (char *)iov->iov_base + n;
+                iov->iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+
+    return s->error = 0;
+}
+
+static int _stream_flush(actor_stream_t *s, uint64_t deadline) {
+    struct iovec iov;
+
+    if (s->out_len == 0) return s->error = 0;
+
+    iov.iov_base = s->out;
+    iov.iov_len = s->out_len;
+    s->out_len = 0;
+
+    return _stream_write_all(s, &iov, 1, deadline);
+}
+
+int actor_stream_flush(actor_stream_t *s, long timeout) {
+    return _stream_flush(s, _stream_deadline(timeout));
+}
+
+int actor_stream_writev(actor_stream_t *s, const struct iovec *iov, int iovcnt, long timeout) {
+    struct iovec v[STREAM_IOV];
+    uint64_t deadline;
+    size_t total = 0;
+    int x, n;
+
+    for (x = 0; x < iovcnt; x++) total += iov[x].iov_len;
+
+    if (s->out_len + total <= ACTOR_STREAM_BUFFER_SIZE) {
+        for (x = 0; x < iovcnt; x++) {
+            memcpy(s->out + s->out_len, iov[x].iov_base, iov[x].iov_len);
+            s->out_len += iov[x].iov_len;
+        }
+        return s->error = 0;
+    }
+
+    /* The buffered bytes go first, then the pieces as they are */
+    deadline = _stream_deadline(timeout);
+    v[0].iov_base = s->out;
+    v[0].iov_len = s->out_len;
+    s->out_len = 0;
+    for (n = 1, x = 0; x < iovcnt; x++) {
+        v[n++] = iov[x];
+        if (n == STREAM_IOV || x == iovcnt - 1) {
+            if (_stream_write_all(s, v, n, deadline) != 0) return s->error;
+            n = 0;
+        }
+    }
+
+    return s->error = 0;
+}
+
+int actor_stream_write(actor_stream_t *s, const void *data, size_t len, long timeout) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+
+    return actor_stream_writev(s, &iov, 1, timeout);
+}
+
+/* Sends part of a file; returns the bytes sent, or -1 with errno set */
+static ssize_t _stream_sendfile(int out, int in, off_t offset, size_t count) {
+#if defined(__linux__)
+    return sendfile(out, in, &offset, count);
+#elif defined(__FreeBSD__)
+    off_t sent = 0;
+
+    /* A non-blocking socket may take part of the file and still fail with EAGAIN */
+    if (sendfile(in, out, offset, count, NULL, &sent, 0) < 0 && sent == 0) return -1;
+    return sent;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Where sendfile(2) is no use, the file goes through the output buffer */
+static int _stream_copy_file(actor_stream_t *s, int fd, off_t offset, size_t count, uint64_t deadline) {
+    struct iovec iov;
+    ssize_t n;
+
+    while (count > 0) {
+        n = pread(fd, s->out, count < ACTOR_STREAM_BUFFER_SIZE ? count : ACTOR_STREAM_BUFFER_SIZE, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return s->error = n < 0 ? errno : EIO;
+
+        iov.iov_base = s->out;
+        iov.iov_len = n;
+        if (_stream_write_all(s, &iov, 1, deadline) != 0) return s->error;
+        offset += n;
+        count -= n;
+    }
+
+    return s->error = 0;
+}
+
+int actor_stream_sendfile(actor_stream_t *s, int fd, off_t offset, size_t count, long timeout) {
+    uint64_t deadline = _stream_deadline(timeout);
+    ssize_t n;
+
+    if (_stream_flush(s, deadline) != 0) return s->error;
+
+    while (count > 0) {
+        if ((n = _stream_sendfile(s->fd, fd, offset, count)) > 0) {
+            offset += n;
+            count -= n;
+        } else if (n == 0) {
+            /* The file is shorter than `count` */
+            return s->error = EIO;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if ((s->error = _stream_wait(s, ACTOR_IO_WRITE, deadline)) != 0) return s->error;
+        } else if (errno == EINVAL || errno == ENOSYS || errno == ENOTSOCK || errno == EOPNOTSUPP) {
+            return _stream_copy_file(s, fd, offset, count, deadline);
+        } else if (errno != EINTR) {
+            return s->error = errno;
+        }
+    }
+
+    return s->error = 0;
+}
@@ -0,0 +1,218 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "park.h"
+#include "scheduler.h"
+#include "threads.h"
+
+/* Private structs */
+
+enum { THREAD_IDLE, THREAD_RUN, THREAD_EXIT };
+
+struct actor_thread_struct;
+typedef struct actor_thread_struct actor_thread_t;
+
+struct actor_thread_struct {
+    actor_thread_t *next; /* idle list */
+    atomic_uint state;    /* the thread parks on this while idle */
+    size_t stack_size;
+    bool reserved; /* started by _actor_thread_prestart(), never times out */
+    actor_thread_function_ptr_t fun;
+    void *arg;
+};
+
+/* Internal state */
+
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t threads_cond = PTHREAD_COND_INITIALIZER;
+static actor_thread_t *threads_idle; /* most recently parked first, protected by threads_mutex */
+static size_t threads_idle_count;
+static size_t threads_stopping; /* idle threads _actor_thread_stop() is waiting for */
+
+
+/*------------------------------------------------------------------------------
+                                  thread cache
+------------------------------------------------------------------------------*/
+
+/* Called with threads_mutex held */
+static void _thread_unlink(actor_thread_t *t) {
+    actor_thread_t **p;
+
+    for (p = &threads_idle; *p != t; p = &(*p)->next) assert(*p != NULL);
+    *p = t->next;
+    threads_idle_count--;
+}
+
+/*
+ * Parks the calling thread on the cache until a spawn hands it a function.
+ * Returns false if the thread should exit instead.
+ */
+static bool _thread_park(actor_thread_t *t) {
+    uint64_t deadline;
+    unsigned int state;
+
+    pthread_mutex_lock(&threads_mutex);
+    if (threads_idle_count >= ACTOR_THREAD_CACHE_SIZE) {
+        pthread_mutex_unlock(&threads_mutex);
+        return false;
+    }
+    atomic_store_explicit(&t->state, THREAD_IDLE, memory_order_relaxed);
+    t->next = threads_idle;
+    threads_idle = t;
+    threads_idle_count++;
+    pthread_mutex_unlock(&threads_mutex);
+
+    deadline = t->reserved ? 0 : _actor_clock_ns() + ACTOR_THREAD_IDLE_NS;
+    for (;;) {
+        while ((state = atomic_load_explicit(&t->state, memory_order_acquire)) == THREAD_IDLE &&
+               (deadline == 0 || _actor_clock_ns() < deadline))
+            _actor_park_wait(&t->state, THREAD_IDLE, deadline);
+        if (state != THREAD_IDLE) break;
+
+        /* Timed out, unless a spawn has taken the thread off the list meanwhile */
+        pthread_mutex_lock(&threads_mutex);
+        if (atomic_load_explicit(&t->state, memory_order_relaxed) == THREAD_IDLE) {
+            _thread_unlink(t);
+            pthread_mutex_unlock(&threads_mutex);
+            return false;
+        }
+        pthread_mutex_unlock(&threads_mutex);
+    }
+
+    if (state == THREAD_RUN) return true;
+
+    pthread_mutex_lock(&threads_mutex);
+    if (--threads_stopping == 0) pthread_cond_broadcast(&threads_cond);
+    pthread_mutex_unlock(&threads_mutex);
+    return false;
+}
+
+static void *_thread_main(void *arg) {
+    actor_thread_t *t = (actor_thread_t *)arg;
+
+    do {
+        if (t->fun != NULL) (t->fun)(t->arg);
+        t->fun = NULL;
+    } while (_thread_park(t));
+
+    free(t);
+    return NULL;
+}
+
+static int _thread_create(actor_thread_t *t) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int error;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (t->stack_size != 0) pthread_attr_setstacksize(&attr, t->stack_size);
+    error = pthread_create(&thread, &attr, _thread_main, t);
+    pthread_attr_destroy(&attr);
+
+    return error;
+}
+
+static actor_thread_t *_thread_alloc(size_t stack_size) {
+    actor_thread_t *t;
+
+    t = (actor_thread_t *)calloc(1, sizeof(actor_thread_t));
+    assert(t != NULL);
+    atomic_init(&t->state, THREAD_RUN);
+    t->stack_size = stack_size;
+
+    return t;
+}
+
+static size_t _thread_stack_size(size_t stack_size) {
+    if (stack_size != 0 && stack_size < (size_t)PTHREAD_STACK_MIN) return PTHREAD_STACK_MIN;
+    return stack_size;
+}
+
+int _actor_thread_spawn(actor_thread_function_ptr_t fun, void *arg, size_t stack_size) {
+    actor_thread_t *t;
+    int error;
+
+    assert(fun != NULL);
+    stack_size = _thread_stack_size(stack_size);
+
+    pthread_mutex_lock(&threads_mutex);
+    for (t = threads_idle; t != NULL && t->stack_size != stack_size; t = t->next)
+        ;
+    if (t != NULL) {
+        _thread_unlink(t);
+        t->fun = fun;
+        t->arg = arg;
+        atomic_store_explicit(&t->state, THREAD_RUN, memory_order_release);
+        /* Under the lock, as the thread frees itself once it is done and finds the cache full */
+        _actor_park_wake(&t->state);
+        pthread_mutex_unlock(&threads_mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&threads_mutex);
+
+    t = _thread_alloc(stack_size);
+    t->fun = fun;
+    t->arg = arg;
+    if ((error = _thread_create(t)) != 0) free(t);
+
+    return error;
+}
+
+int _actor_thread_prestart(unsigned int count, size_t stack_size) {
+    actor_thread_t *t;
+    int error;
+
+    stack_size = _thread_stack_size(stack_size);
+    if (count > ACTOR_THREAD_CACHE_SIZE) count = ACTOR_THREAD_CACHE_SIZE;
+
+    for (unsigned int x = 0; x < count; x++) {
+        t = _thread_alloc(stack_size);
+        t->reserved = true;
+        if ((error = _thread_create(t)) != 0) {
+            free(t);
+            return error;
+        }
+    }
+
+    return 0;
+}
+
+void _actor_thread_stop(void) {
+    actor_thread_t *t;
+
+    pthread_mutex_lock(&threads_mutex);
+    while ((t = threads_idle) != NULL) {
+        threads_idle = t->next;
+        threads_stopping++;
+        atomic_store_explicit(&t->state, THREAD_EXIT, memory_order_release);
+        _actor_park_wake(&t->state);
+    }
+    threads_idle_count = 0;
+    while (threads_stopping > 0) pthread_cond_wait(&threads_cond, &threads_mutex);
+    pthread_mutex_unlock(&threads_mutex);
+}
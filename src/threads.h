@@ -0,0 +1,63 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_THREADS_H_
+#define SRC_THREADS_H_
+
+/*
+ * A cache of detached threads for actors that run on a thread of their
+ * own. A thread whose function has returned parks itself on the cache
+ * instead of exiting, and the next spawn with the same stack size hands it
+ * a function instead of creating a thread. This header is private to the
+ * library.
+ */
+
+#include <stddef.h>
+
+typedef void (*actor_thread_function_ptr_t)(void *);
+
+#define ACTOR_THREAD_CACHE_SIZE 64
+#define ACTOR_THREAD_IDLE_NS (10ull * 1000000000ull) /* before an idle thread exits */
+
+/**
+ * Run `fun(arg)` on a cached thread with a stack of `stack_size` bytes, or
+ * on a new one if none is idle.
+ *
+ * @param stack_size  the stack size, or 0 for the system default
+ * @return            0 on success, or the pthread_create() error
+ */
+int _actor_thread_spawn(actor_thread_function_ptr_t fun, void *arg, size_t stack_size);
+
+/**
+ * Start idle threads ahead of the spawns that will use them, up to the
+ * size of the cache. Up to that many idle threads with this stack size are
+ * then kept for good, rather than exiting after ACTOR_THREAD_IDLE_NS.
+ *
+ * @return  0 on success, or the pthread_create() error
+ */
+int _actor_thread_prestart(unsigned int count, size_t stack_size);
+
+/**
+ * Make the idle threads exit and wait for them. Threads that are still
+ * running a function are left alone.
+ */
+void _actor_thread_stop(void);
+
+#endif  // SRC_THREADS_H_
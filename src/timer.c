@@ -0,0 +1,295 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "scheduler.h"
+#include "timer.h"
+
+/*
+ * The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots. Level 0 holds the
+ * timers due within the current block of TIMER_SLOTS ticks, one slot per
+ * tick; each level above holds timers one block further out, one slot per
+ * block of the level below. When the wheel reaches the start of a block,
+ * the slot of the level above that covers it is emptied into the levels
+ * below, so every timer moves down at most TIMER_LEVELS - 1 times before
+ * it fires. Timers further out than the top level reaches wait in its last
+ * slot and are placed again when they get there.
+ */
+#define TIMER_TICK_NS 1000000ull /* 1 ms */
+#define TIMER_LEVEL_BITS 8
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4
+#define TIMER_MASK(_level) ((1ull << (TIMER_LEVEL_BITS * (_level))) - 1) /* ticks within a slot of `_level` */
+#define TIMER_RANGE (1ull << (TIMER_LEVEL_BITS * TIMER_LEVELS))
+
+/* Internal state */
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;                                  /* wakes the timer thread */
+static pthread_cond_t timer_fired_cond = PTHREAD_COND_INITIALIZER; /* signalled after each callback */
+static pthread_t timer_thread;
+static bool timer_running;
+static bool timer_shutdown;
+
+static actor_timer_t *timer_wheel[TIMER_LEVELS][TIMER_SLOTS];
+static size_t timer_level_count[TIMER_LEVELS];
+static uint64_t timer_now;         /* the last tick the wheel has reached */
+static uint64_t timer_sleep_until; /* the tick the sleeping thread wakes at, 0 for none, UINT64_MAX while awake */
+static actor_timer_t *timer_expired; /* taken from the wheel, waiting for their callbacks */
+static actor_timer_t *timer_firing;
+
+
+/*------------------------------------------------------------------------------
+                                     wheel
+------------------------------------------------------------------------------*/
+
+/* Called with timer_mutex held; `expires` is a tick after timer_now */
+static void _timer_insert(actor_timer_t *timer, uint64_t expires) {
+    uint64_t next = timer_now + 1;
+    int level = 0;
+
+    if (expires - next >= TIMER_RANGE) expires = next + TIMER_RANGE - 1;
+
+    /* The lowest level whose current block contains `expires` */
+    while (level < TIMER_LEVELS - 1 && (expires >> (TIMER_LEVEL_BITS * (level + 1))) != (next >> (TIMER_LEVEL_BITS * (level + 1))))
+        level++;
+
+    timer->bucket = &timer_wheel[level][(expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1)];
+    timer->prev = NULL;
+    timer->next = *timer->bucket;
+    if (timer->next != NULL) timer->next->prev = timer;
+    *timer->bucket = timer;
+    timer_level_count[level]++;
+}
+
+static uint64_t _timer_expires(actor_timer_t *timer) {
+    uint64_t expires = (timer->deadline + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+
+    return expires > timer_now ? expires : timer_now + 1;
+}
+
+/* Called with timer_mutex held */
+static void _timer_unlink(actor_timer_t *timer) {
+    if (timer->bucket != &timer_expired) timer_level_count[(timer->bucket - &timer_wheel[0][0]) / TIMER_SLOTS]--;
+
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        *timer->bucket = timer->next;
+    if (timer->next != NULL) timer->next->prev = timer->prev;
+    timer->bucket = NULL;
+}
+
+/* Called with timer_mutex held; moves the slot of `level` covering the block that starts at `tick` down */
+static void _timer_cascade(int level, uint64_t tick) {
+    actor_timer_t **bucket = &timer_wheel[level][(tick >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1)];
+    actor_timer_t *timer;
+
+    while ((timer = *bucket) != NULL) {
+        _timer_unlink(timer);
+        _timer_insert(timer, _timer_expires(timer));
+    }
+}
+
+/*
+ * Called with timer_mutex held, which it drops around each callback. The
+ * slot is emptied first: a timer armed meanwhile may belong in it again.
+ */
+static void _timer_fire(uint64_t tick) {
+    actor_timer_t **bucket = &timer_wheel[0][tick & (TIMER_SLOTS - 1)];
+    actor_timer_t *timer;
+
+    while ((timer = *bucket) != NULL) {
+        _timer_unlink(timer);
+        timer->bucket = &timer_expired;
+        timer->prev = NULL;
+        timer->next = timer_expired;
+        if (timer->next != NULL) timer->next->prev = timer;
+        timer_expired = timer;
+    }
+
+    while ((timer = timer_expired) != NULL) {
+        _timer_unlink(timer);
+        timer_firing = timer;
+        pthread_mutex_unlock(&timer_mutex);
+
+        timer->fire(timer, timer->arg);
+
+        pthread_mutex_lock(&timer_mutex);
+        timer_firing = NULL;
+        pthread_cond_broadcast(&timer_fired_cond);
+    }
+}
+
+/* Called with timer_mutex held; runs the wheel up to `tick`, skipping the stretches where nothing can happen */
+static void _timer_advance(uint64_t tick) {
+    uint64_t next;
+    int level;
+
+    while (timer_now < tick) {
+        for (level = 0; level < TIMER_LEVELS && timer_level_count[level] == 0; level++) continue;
+        if (level == TIMER_LEVELS) {
+            timer_now = tick;
+            break;
+        }
+
+        /* The next tick that fires level 0 or starts a block of the lowest level in use */
+        next = (timer_now | TIMER_MASK(level)) + 1;
+        if (next > tick) {
+            timer_now = tick;
+            break;
+        }
+
+        timer_now = next - 1;
+        for (level = TIMER_LEVELS - 1; level > 0; level--) {
+            if ((next & TIMER_MASK(level)) == 0) _timer_cascade(level, next);
+        }
+        timer_now = next;
+        _timer_fire(next);
+    }
+}
+
+/* Called with timer_mutex held; the tick at which the wheel next has work, or 0 */
+static uint64_t _timer_next() {
+    uint64_t next = timer_now + 1;
+    int level, slot;
+
+    if (timer_level_count[0] > 0) {
+        for (slot = next & (TIMER_SLOTS - 1); slot < TIMER_SLOTS; slot++) {
+            if (timer_wheel[0][slot] != NULL) return (next & ~(uint64_t)(TIMER_SLOTS - 1)) | slot;
+        }
+        return next;
+    }
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        if (timer_level_count[level] > 0) return (timer_now | TIMER_MASK(level)) + 1;
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------------
+                                  timer thread
+------------------------------------------------------------------------------*/
+
+static void *_timer_main(void *arg) {
+    struct timespec ts;
+    uint64_t next;
+
+    (void)arg;
+
+    pthread_mutex_lock(&timer_mutex);
+    while (!timer_shutdown) {
+        _timer_advance(_actor_clock_ns() / TIMER_TICK_NS);
+
+        next = _timer_next();
+        timer_sleep_until = next;
+        if (next != 0) {
+            ts.tv_sec = next * TIMER_TICK_NS / 1000000000ull;
+            ts.tv_nsec = next * TIMER_TICK_NS % 1000000000ull;
+            pthread_cond_timedwait(&timer_cond, &timer_mutex, &ts);
+        } else {
+            pthread_cond_wait(&timer_cond, &timer_mutex);
+        }
+        timer_sleep_until = UINT64_MAX;
+    }
+    pthread_mutex_unlock(&timer_mutex);
+
+    return NULL;
+}
+
+/* Called with timer_mutex held */
+static void _timer_start() {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    timer_now = _actor_clock_ns() / TIMER_TICK_NS;
+    timer_sleep_until = UINT64_MAX;
+    timer_running = true;
+    pthread_create(&timer_thread, NULL, _timer_main, NULL);
+}
+
+void _actor_timer_stop(void) {
+    int level, slot;
+
+    pthread_mutex_lock(&timer_mutex);
+    if (!timer_running) {
+        pthread_mutex_unlock(&timer_mutex);
+        return;
+    }
+    timer_shutdown = true;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+
+    pthread_join(timer_thread, NULL);
+
+    pthread_mutex_lock(&timer_mutex);
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            while (timer_wheel[level][slot] != NULL) _timer_unlink(timer_wheel[level][slot]);
+        }
+    }
+    pthread_cond_destroy(&timer_cond);
+    timer_shutdown = false;
+    timer_running = false;
+    pthread_mutex_unlock(&timer_mutex);
+}
+
+
+/*------------------------------------------------------------------------------
+                                     timers
+------------------------------------------------------------------------------*/
+
+void _actor_timer_arm(actor_timer_t *timer, uint64_t deadline, actor_timer_fire_ptr_t fire, void *arg) {
+    uint64_t expires;
+
+    timer->deadline = deadline;
+    timer->fire = fire;
+    timer->arg = arg;
+
+    pthread_mutex_lock(&timer_mutex);
+    if (!timer_running) _timer_start();
+    expires = _timer_expires(timer);
+    _timer_insert(timer, expires);
+
+    /* The thread only needs waking if it sleeps past the new timer */
+    if (timer_sleep_until != UINT64_MAX && (timer_sleep_until == 0 || expires < timer_sleep_until))
+        pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+}
+
+int _actor_timer_cancel(actor_timer_t *timer) {
+    int armed;
+
+    pthread_mutex_lock(&timer_mutex);
+    if ((armed = timer->bucket != NULL)) _timer_unlink(timer);
+    if (timer_running && !pthread_equal(pthread_self(), timer_thread)) {
+        while (timer_firing == timer) pthread_cond_wait(&timer_fired_cond, &timer_mutex);
+    }
+    pthread_mutex_unlock(&timer_mutex);
+
+    return armed;
+}
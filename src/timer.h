@@ -0,0 +1,70 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SRC_TIMER_H_
+#define SRC_TIMER_H_
+
+/*
+ * Timers on CLOCK_MONOTONIC, kept in a hierarchical timing wheel of
+ * millisecond ticks. Arming and cancelling a timer are O(1) whatever the
+ * number pending. A thread of the library's own, started by the first
+ * timer armed, advances the wheel and runs the callbacks. This header is
+ * private to the library.
+ */
+
+#include <stdint.h>
+
+struct actor_timer_struct;
+typedef struct actor_timer_struct actor_timer_t;
+
+/* Runs on the timer thread, with no locks held, once the timer expires */
+typedef void (*actor_timer_fire_ptr_t)(actor_timer_t *timer, void *arg);
+
+/* Embedded in its owner, which zeroes it before first use */
+struct actor_timer_struct {
+    actor_timer_t *next;
+    actor_timer_t *prev;
+    actor_timer_t **bucket; /* the wheel slot holding the timer, NULL when not armed */
+    uint64_t deadline;
+    actor_timer_fire_ptr_t fire;
+    void *arg;
+};
+
+/**
+ * Arm `timer` to call `fire(timer, arg)` once `deadline` (see
+ * _actor_clock_ns()) has passed. The timer must not be armed already; a
+ * callback may re-arm its own timer.
+ */
+void _actor_timer_arm(actor_timer_t *timer, uint64_t deadline, actor_timer_fire_ptr_t fire, void *arg);
+
+/**
+ * Disarm `timer`. Once this returns the callback is not running and will
+ * not run, unless it re-arms the timer itself; called from the callback,
+ * it does not wait for the callback to return.
+ *
+ * @return  1 if the timer was armed, 0 if it had fired or was never armed
+ */
+int _actor_timer_cancel(actor_timer_t *timer);
+
+/**
+ * Stop and join the timer thread, forgetting every timer still armed.
+ */
+void _actor_timer_stop(void);
+
+#endif  // SRC_TIMER_H_
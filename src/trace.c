@@ -0,0 +1,229 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libactor/actor.h"
+#include "trace.h"
+
+/* A thread's ring, kept until _actor_trace_shutdown() so that a thread recording late never writes to freed memory */
+struct actor_trace_ring {
+    struct actor_trace_ring *next; /* every ring, see trace_rings */
+    uint32_t thread;
+    uint32_t count;
+    struct actor_trace_event events[ACTOR_TRACE_RING_EVENTS];
+};
+
+atomic_int actor_trace_on;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1; /* protected by trace_mutex, as are the rest */
+static struct actor_trace_ring *trace_rings;
+static uint32_t trace_threads;
+static atomic_uint trace_epoch; /* bumped as the rings are freed */
+
+/* Together, so that recording looks up one thread-local */
+static _Thread_local struct {
+    struct actor_trace_ring *ring;
+    unsigned int epoch;
+} trace_local;
+
+#ifdef ACTOR_TRACE
+static uint64_t _trace_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* Called with trace_mutex held. A failed write stops the trace rather than leave a file with a hole. */
+static void _trace_write(const void *buf, size_t size) {
+    ssize_t ret;
+
+    while (size > 0 && trace_fd >= 0) {
+        if ((ret = write(trace_fd, buf, size)) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "actor trace: write failed: %s; tracing stopped.\n", strerror(errno));
+            atomic_store(&actor_trace_on, 0);
+            close(trace_fd);
+            trace_fd = -1;
+            return;
+        }
+        buf = (const char *)buf + ret;
+        size -= (size_t)ret;
+    }
+}
+
+/* Called with trace_mutex held */
+static void _trace_flush(struct actor_trace_ring *r) {
+    struct actor_trace_block block;
+
+    if (r->count == 0) return;
+    block.thread = r->thread;
+    block.count = r->count;
+    _trace_write(&block, sizeof(block));
+    _trace_write(r->events, sizeof(struct actor_trace_event) * r->count);
+    r->count = 0;
+}
+
+static struct actor_trace_ring *_trace_ring_new() {
+    struct actor_trace_ring *r = (struct actor_trace_ring *)malloc(sizeof(struct actor_trace_ring));
+
+    if (r == NULL) return NULL;
+    r->count = 0;
+
+    pthread_mutex_lock(&trace_mutex);
+    r->thread = trace_threads++;
+    r->next = trace_rings;
+    trace_rings = r;
+    pthread_mutex_unlock(&trace_mutex);
+
+    trace_local.ring = r;
+    trace_local.epoch = atomic_load_explicit(&trace_epoch, memory_order_relaxed);
+    return r;
+}
+
+void _actor_trace_record(int event, uint64_t actor, uint64_t object, uint32_t arg) {
+    struct actor_trace_ring *r = trace_local.ring;
+    struct actor_trace_event *e;
+
+    if (r == NULL || trace_local.epoch != atomic_load_explicit(&trace_epoch, memory_order_relaxed)) {
+        if ((r = _trace_ring_new()) == NULL) return;
+    }
+
+    e = &r->events[r->count];
+    e->ticks = _actor_trace_ticks();
+    e->actor = actor;
+    e->object = object;
+    e->arg = arg;
+    e->event = (uint16_t)event;
+    e->reserved = 0;
+
+    if (++r->count == ACTOR_TRACE_RING_EVENTS) {
+        pthread_mutex_lock(&trace_mutex);
+        if (trace_fd >= 0)
+            _trace_flush(r);
+        else
+            r->count = 0;
+        pthread_mutex_unlock(&trace_mutex);
+    }
+}
+
+int actor_trace_start(const char *path) {
+#ifdef ACTOR_TRACE
+    struct actor_trace_header header;
+    struct actor_trace_ring *r;
+    int err = 0;
+
+    if (path == NULL) return EINVAL;
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_fd >= 0) {
+        err = EBUSY;
+    } else if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        err = errno;
+    } else {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ACTOR_TRACE_MAGIC, sizeof(header.magic));
+        header.version = ACTOR_TRACE_VERSION;
+        header.event_size = sizeof(struct actor_trace_event);
+        header.start_ns = _trace_clock_ns();
+        header.start_ticks = _actor_trace_ticks();
+        _trace_write(&header, sizeof(header));
+
+        /* Anything recorded since the last trace stopped belongs to neither */
+        for (r = trace_rings; r != NULL; r = r->next) r->count = 0;
+        if (trace_fd >= 0)
+            atomic_store(&actor_trace_on, 1);
+        else
+            err = EIO;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    return err;
+#else
+    (void)path;
+    return ENOTSUP;
+#endif
+}
+
+/*
+ * Threads still recording as the trace stops may lose the events in
+ * flight; stop it once the actors of interest are done, as
+ * actor_destroy_all() does.
+ */
+int actor_trace_stop() {
+#ifdef ACTOR_TRACE
+    struct actor_trace_ring *r;
+    uint64_t end[2];
+
+    pthread_mutex_lock(&trace_mutex);
+    atomic_store(&actor_trace_on, 0);
+    if (trace_fd >= 0) {
+        for (r = trace_rings; r != NULL; r = r->next) _trace_flush(r);
+
+        end[0] = _actor_trace_ticks();
+        end[1] = _trace_clock_ns();
+        if (trace_fd >= 0 && pwrite(trace_fd, end, sizeof(end), offsetof(struct actor_trace_header, end_ticks)) !=
+                                 (ssize_t)sizeof(end))
+            fprintf(stderr, "actor trace: cannot finish the header: %s\n", strerror(errno));
+        if (trace_fd >= 0) close(trace_fd);
+        trace_fd = -1;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    return 0;
+#else
+    return ENOTSUP;
+#endif
+}
+
+void _actor_trace_init() {
+#ifdef ACTOR_TRACE
+    const char *path = getenv("ACTOR_TRACE_FILE");
+    int err;
+
+    if (path != NULL && *path != 0 && (err = actor_trace_start(path)) != 0 && err != EBUSY)
+        fprintf(stderr, "actor trace: cannot trace to %s: %s\n", path, strerror(err));
+#endif
+}
+
+void _actor_trace_shutdown() {
+    struct actor_trace_ring *r;
+
+    actor_trace_stop();
+
+    pthread_mutex_lock(&trace_mutex);
+    while ((r = trace_rings) != NULL) {
+        trace_rings = r->next;
+        free(r);
+    }
+    trace_threads = 0;
+    atomic_fetch_add(&trace_epoch, 1);
+    pthread_mutex_unlock(&trace_mutex);
+}
@@ -0,0 +1,128 @@
+/*
+  Copyright (C) 2009 Chris Moos
+
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+/*
+ * Binary event tracing, compiled in with ACTOR_TRACE and switched on by
+ * actor_trace_start(). Each thread records into a ring of its own with
+ * plain stores, so recording takes no lock and no atomic operation; a
+ * full ring is appended to the trace file by its thread, under a lock,
+ * and the rest are written by actor_trace_stop(). Timestamps are CPU
+ * ticks; the file header pairs ticks with CLOCK_MONOTONIC at the start
+ * and at the end so tools/trace2json.c can convert them. Actors are
+ * recorded by the address of their ID, which includes the generation.
+ * Without ACTOR_TRACE the hooks compile to nothing. This header is
+ * private to the library, but it is also the file format.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define ACTOR_TRACE_MAGIC "ACTTRACE"
+#define ACTOR_TRACE_VERSION 1
+#define ACTOR_TRACE_RING_EVENTS 8192 /* events per thread between writes */
+
+enum {
+    ACTOR_TRACE_SPAWN = 1, /* actor spawned `object`, the new actor's ID */
+    ACTOR_TRACE_SEND,      /* actor sent message `object` of type `arg` */
+    ACTOR_TRACE_RECEIVE,   /* actor took message `object` of type `arg` from its mailbox */
+    ACTOR_TRACE_EXIT,      /* actor exited */
+    ACTOR_TRACE_AMALLOC,   /* actor allocated block `object` of `arg` bytes */
+    ACTOR_TRACE_ARELEASE   /* actor released a reference to block `object` */
+};
+
+/* The start of the file */
+struct actor_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    uint64_t start_ticks;
+    uint64_t start_ns;
+    uint64_t end_ticks; /* 0 if the trace was never stopped */
+    uint64_t end_ns;
+};
+
+/* Then blocks of events, each from one thread and in the order recorded */
+struct actor_trace_block {
+    uint32_t thread; /* numbered in the order threads first recorded */
+    uint32_t count;
+};
+
+struct actor_trace_event {
+    uint64_t ticks;
+    uint64_t actor;  /* the acting actor, 0 for a thread that is not one */
+    uint64_t object; /* a message, a block or an actor, see the events */
+    uint32_t arg;
+    uint16_t event;
+    uint16_t reserved;
+};
+
+extern atomic_int actor_trace_on;
+
+/* The CPU's tick counter, or CLOCK_MONOTONIC where there is none to read */
+static inline uint64_t _actor_trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Record an event on this thread's ring. Only call this while
+ * actor_trace_on is set.
+ */
+void _actor_trace_record(int event, uint64_t actor, uint64_t object, uint32_t arg);
+
+/**
+ * Start tracing to the file named by the ACTOR_TRACE_FILE environment
+ * variable, if it is set.
+ */
+void _actor_trace_init(void);
+
+/**
+ * Stop tracing and free every thread's ring.
+ */
+void _actor_trace_shutdown(void);
+
+#ifdef ACTOR_TRACE
+#define ACTOR_TRACE_EVENT(event, actor, object, arg)                                                            \
+    do {                                                                                                         \
+        if (atomic_load_explicit(&actor_trace_on, memory_order_relaxed))                                        \
+            _actor_trace_record((event), (uint64_t)cheri_address_get(actor), (uint64_t)cheri_address_get(object), \
+                                (uint32_t)(arg));                                                                \
+    } while (0)
+#else
+#define ACTOR_TRACE_EVENT(event, actor, object, arg) ((void)0)
+#endif
+
+#endif  // SRC_TRACE_H_
@@ -0,0 +1,107 @@
+/*
+libactor - A C Actor Library
+mailbox_order.c
+
+Several producers send numbered messages to one consumer at once. Checks
+that the consumer gets every message exactly once, and each producer's
+in the order they were sent, while the mailbox is pushed to from several
+threads and drained at the same time.
+
+usage: mailbox_order [threads|scheduler] [producers] [messages]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, DONE_MSG };
+
+struct item {
+    long producer;
+    long seq;
+};
+
+static long producers = 8;
+static long messages = 20000;
+static int failures;
+
+ACTOR_FUNCTION(producer_func, args) {
+    actor_msg_t *msg = actor_receive(); /* the consumer */
+    actor_id consumer = *(actor_id *)msg->data;
+    struct item item;
+
+    item.producer = (long)(size_t)args;
+    arelease(msg);
+    for (item.seq = 0; item.seq < messages; item.seq++) actor_send_msg(consumer, DATA_MSG, &item, sizeof(item));
+    return 0;
+}
+
+ACTOR_FUNCTION(consumer_func, args) {
+    long *next = (long *)calloc(producers, sizeof(long)), received = 0, x;
+    const struct item *item;
+    actor_msg_t *msg;
+
+    (void)args;
+    while (received < producers * messages) {
+        msg = actor_receive();
+        item = (const struct item *)msg->data;
+        if (item->seq != next[item->producer]) {
+            fprintf(stderr, "producer %ld: message %ld arrived when %ld was due\n", item->producer, item->seq,
+                    next[item->producer]);
+            failures++;
+        }
+        next[item->producer] = item->seq + 1;
+        received++;
+        arelease(msg);
+    }
+
+    /* Nothing is left over */
+    if ((msg = actor_receive_timeout(50)) != NULL) {
+        fprintf(stderr, "a message more than was sent arrived\n");
+        failures++;
+        arelease(msg);
+    }
+    for (x = 0; x < producers; x++) {
+        if (next[x] != messages) {
+            fprintf(stderr, "producer %ld: %ld of %ld messages arrived\n", x, next[x], messages);
+            failures++;
+        }
+    }
+
+    free(next);
+    return 0;
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    actor_id consumer = spawn_actor(consumer_func, NULL), producer;
+    long x;
+
+    (void)args;
+    for (x = 0; x < producers; x++) {
+        producer = spawn_actor(producer_func, (void *)(size_t)x);
+        actor_send_msg(producer, DATA_MSG, &consumer, sizeof(consumer));
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scheduler") == 0)
+        actor_init_scheduler(0);
+    else
+        actor_init();
+    if (argc > 2) producers = atol(argv[2]);
+    if (argc > 3) messages = atol(argv[3]);
+
+    spawn_actor(tester_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("%ld messages from each of %ld producers, in order\n", messages, producers);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+libactor - A C Actor Library
+mailbox_overflow.c
+
+Fills bounded mailboxes under each ACTOR_OVERFLOW_* policy while the
+receiver waits, then checks which messages were refused or dropped, the
+counters of actor_mailbox_stats(), and the order in which the rest are
+received. Messages from the I/O reactor do not count against the
+capacity: ACTOR_OVERFLOW_DROP_OLDEST must leave them where they are,
+whichever lane the messages it can drop are in.
+
+usage: mailbox_overflow [threads|scheduler]
+*/
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, NAP_MSG };
+
+#define WATCH -1 /* a step at which the receiver watches a readable pipe */
+#define IO -1    /* the seq recorded for the reactor's message */
+#define MAX_STEPS 16
+
+struct step {
+    int lane;
+    long seq;
+};
+
+struct expect {
+    long type;
+    long seq;
+};
+
+struct overflow_case {
+    const char *name;
+    int overflow;
+    size_t capacity;
+    int try_send;          /* send with actor_try_send_msg(), which only has the normal lane */
+    struct step steps[MAX_STEPS];
+    int step_count;
+    int eagain;            /* sends refused with EAGAIN */
+    unsigned long dropped;
+    unsigned long rejected;
+    struct expect received[MAX_STEPS];
+    int received_count;
+};
+
+static const struct overflow_case cases[] = {
+    {"reject", ACTOR_OVERFLOW_REJECT, 4, 1,
+     {{0, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5}, {0, 6}, {0, 7}, {0, 8}, {0, 9}}, 10, 6, 0, 6,
+     {{DATA_MSG, 0}, {DATA_MSG, 1}, {DATA_MSG, 2}, {DATA_MSG, 3}}, 4},
+    {"block, tried", ACTOR_OVERFLOW_BLOCK, 4, 1,
+     {{0, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5}, {0, 6}, {0, 7}, {0, 8}, {0, 9}}, 10, 6, 0, 6,
+     {{DATA_MSG, 0}, {DATA_MSG, 1}, {DATA_MSG, 2}, {DATA_MSG, 3}}, 4},
+    {"drop newest", ACTOR_OVERFLOW_DROP_NEWEST, 4, 1,
+     {{0, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5}, {0, 6}, {0, 7}, {0, 8}, {0, 9}}, 10, 0, 6, 0,
+     {{DATA_MSG, 0}, {DATA_MSG, 1}, {DATA_MSG, 2}, {DATA_MSG, 3}}, 4},
+    {"drop oldest", ACTOR_OVERFLOW_DROP_OLDEST, 4, 1,
+     {{0, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5}, {0, 6}, {0, 7}, {0, 8}, {0, 9}}, 10, 0, 6, 0,
+     {{DATA_MSG, 6}, {DATA_MSG, 7}, {DATA_MSG, 8}, {DATA_MSG, 9}}, 4},
+    /* The lowest lane goes first */
+    {"drop oldest, lanes", ACTOR_OVERFLOW_DROP_OLDEST, 4, 0,
+     {{ACTOR_PRIORITY_NORMAL, 0}, {ACTOR_PRIORITY_NORMAL, 1}, {ACTOR_PRIORITY_HIGH, 2}, {ACTOR_PRIORITY_HIGH, 3},
+      {ACTOR_PRIORITY_NORMAL, 4}, {ACTOR_PRIORITY_HIGH, 5}}, 6, 0, 2, 0,
+     {{DATA_MSG, 2}, {DATA_MSG, 3}, {DATA_MSG, 5}, {DATA_MSG, 4}}, 4},
+    /* The reactor's message keeps its place between the counted ones */
+    {"drop oldest, behind I/O", ACTOR_OVERFLOW_DROP_OLDEST, 2, 0,
+     {{ACTOR_PRIORITY_NORMAL, 0}, {0, WATCH}, {ACTOR_PRIORITY_NORMAL, 1}, {ACTOR_PRIORITY_NORMAL, 2},
+      {ACTOR_PRIORITY_NORMAL, 3}}, 5, 0, 2, 0,
+     {{ACTOR_MSG_IO, IO}, {DATA_MSG, 2}, {DATA_MSG, 3}}, 3},
+    /* Only the reactor's message is in the lowest lane; what can be dropped is above it */
+    {"drop oldest, I/O below", ACTOR_OVERFLOW_DROP_OLDEST, 2, 0,
+     {{0, WATCH}, {ACTOR_PRIORITY_HIGH, 0}, {ACTOR_PRIORITY_HIGH, 1}, {ACTOR_PRIORITY_HIGH, 2}}, 4, 0, 1, 0,
+     {{DATA_MSG, 1}, {DATA_MSG, 2}, {ACTOR_MSG_IO, IO}}, 3},
+};
+
+/* Shared by the tester and one receiver; the stages are outside the mailbox under test */
+struct box {
+    atomic_int stage;
+    int fd;
+    struct expect received[MAX_STEPS * 2];
+    int received_count;
+};
+
+static int failures;
+
+/* Sleeps without taking anything from the mailbox, on a thread or a task */
+static void nap(long ms) {
+    arelease(actor_receive_type(NAP_MSG, ms));
+}
+
+static void wait_stage(struct box *box, int stage) {
+    while (atomic_load(&box->stage) < stage) nap(1);
+}
+
+ACTOR_FUNCTION(receiver_func, args) {
+    struct box *box = (struct box *)args;
+    actor_msg_t *msg;
+
+    wait_stage(box, 1);
+    if (box->fd >= 0) {
+        actor_io_watch(box->fd, ACTOR_IO_READ);
+        /* Plenty of time for the reactor's message to arrive */
+        nap(50);
+    }
+    atomic_store(&box->stage, 2);
+
+    wait_stage(box, 3);
+    while ((msg = actor_receive_timeout(50)) != NULL) {
+        if (box->received_count < MAX_STEPS * 2) {
+            box->received[box->received_count].type = msg->type;
+            box->received[box->received_count].seq = msg->type == DATA_MSG ? *(const long *)msg->data : IO;
+        }
+        box->received_count++;
+        arelease(msg);
+    }
+    atomic_store(&box->stage, 4);
+    return 0;
+}
+
+static void run_case(const struct overflow_case *c) {
+    actor_opts_t opts;
+    actor_mailbox_stats_t stats;
+    struct box box;
+    actor_id receiver;
+    int pipefd[2] = {-1, -1}, x, eagain = 0, watched = 0, ok = 1;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.mailbox_capacity = c->capacity;
+    opts.mailbox_overflow = c->overflow;
+
+    memset(&box, 0, sizeof(box));
+    box.fd = -1;
+    for (x = 0; x < c->step_count; x++) {
+        if (c->steps[x].seq == WATCH && pipe(pipefd) == 0) {
+            /* Readable from the start */
+            if (write(pipefd[1], "x", 1) != 1) ok = 0;
+            box.fd = pipefd[0];
+        }
+    }
+
+    receiver = spawn_actor_opts(receiver_func, &box, &opts);
+
+    for (x = 0; x < c->step_count; x++) {
+        if (c->steps[x].seq == WATCH) {
+            atomic_store(&box.stage, 1);
+            wait_stage(&box, 2);
+            watched = 1;
+        } else if (c->try_send) {
+            if (actor_try_send_msg(receiver, DATA_MSG, (void *)&c->steps[x].seq, sizeof(long)) == EAGAIN) eagain++;
+        } else {
+            actor_send_priority_msg(receiver, c->steps[x].lane, DATA_MSG, (void *)&c->steps[x].seq, sizeof(long));
+        }
+    }
+    if (!watched) {
+        atomic_store(&box.stage, 1);
+        wait_stage(&box, 2);
+    }
+
+    actor_mailbox_stats(receiver, &stats);
+    atomic_store(&box.stage, 3);
+    wait_stage(&box, 4);
+
+    if (eagain != c->eagain) {
+        fprintf(stderr, "%s: %d sends refused, not %d\n", c->name, eagain, c->eagain);
+        ok = 0;
+    }
+    if (stats.dropped != c->dropped || stats.rejected != c->rejected) {
+        fprintf(stderr, "%s: %lu dropped and %lu rejected, not %lu and %lu\n", c->name, stats.dropped,
+                stats.rejected, c->dropped, c->rejected);
+        ok = 0;
+    }
+    if (stats.depth != c->capacity) {
+        fprintf(stderr, "%s: depth %zu, not %zu\n", c->name, stats.depth, c->capacity);
+        ok = 0;
+    }
+    if (box.received_count != c->received_count) {
+        fprintf(stderr, "%s: %d messages received, not %d\n", c->name, box.received_count, c->received_count);
+        ok = 0;
+    } else {
+        for (x = 0; x < c->received_count; x++) {
+            if (box.received[x].type != c->received[x].type || box.received[x].seq != c->received[x].seq) {
+                fprintf(stderr, "%s: message %d is %ld/%ld, not %ld/%ld\n", c->name, x, box.received[x].type,
+                        box.received[x].seq, c->received[x].type, c->received[x].seq);
+                ok = 0;
+            }
+        }
+    }
+
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    if (!ok) failures++;
+    printf("%-24s %s\n", c->name, ok ? "ok" : "FAILED");
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    size_t x;
+
+    (void)args;
+    for (x = 0; x < sizeof(cases) / sizeof(cases[0]); x++) run_case(&cases[x]);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scheduler") == 0)
+        actor_init_scheduler(0);
+    else
+        actor_init();
+
+    spawn_actor(tester_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+libactor - A C Actor Library
+pool_dispatch.c
+
+Sends numbered requests to a pool made with spawn_actor_pool() under
+each strategy, some with keys and some without, and checks that every
+request is handled exactly once, that round-robin gives each worker the
+same share, that hashing keeps each key on one worker, and that the pool
+exits once its workers have.
+
+usage: pool_dispatch [threads|scheduler] [requests] [workers]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libactor/actor.h>
+
+enum { REQUEST_MSG = 100, DONE_MSG, STOP_MSG };
+
+#define KEYS 64
+
+static const char *strategy_names[] = {"round-robin", "least depth", "hash", "two choices"};
+
+static long requests = 8000;
+static long workers = 4;
+static atomic_int failures;
+
+struct run {
+    atomic_int started;
+    atomic_int *handled;     /* per request */
+    atomic_long *share;      /* per worker */
+    atomic_int owner[KEYS];  /* the worker that took each key, or -1 */
+    int keyed;
+};
+
+ACTOR_FUNCTION(worker_func, args) {
+    struct run *run = (struct run *)args;
+    int me = atomic_fetch_add(&run->started, 1), expected;
+    actor_msg_t *msg;
+    long seq;
+
+    while ((msg = actor_receive())->type != STOP_MSG) {
+        if (msg->type == REQUEST_MSG) {
+            seq = *(const long *)msg->data;
+            atomic_fetch_add(&run->handled[seq], 1);
+            atomic_fetch_add(&run->share[me], 1);
+            expected = -1;
+            if (run->keyed && !atomic_compare_exchange_strong(&run->owner[seq % KEYS], &expected, me) &&
+                expected != me) {
+                fprintf(stderr, "key %ld went to workers %d and %d\n", seq % KEYS, expected, me);
+                failures++;
+            }
+            actor_reply_msg(msg, DONE_MSG, NULL, 0);
+        }
+        arelease(msg);
+    }
+    arelease(msg);
+    return 0;
+}
+
+static void run_pool(int strategy) {
+    struct run run;
+    actor_id pool;
+    long x, low, high;
+    int ok = 1;
+
+    atomic_init(&run.started, 0);
+    run.handled = (atomic_int *)calloc(requests, sizeof(atomic_int));
+    run.share = (atomic_long *)calloc(workers, sizeof(atomic_long));
+    for (x = 0; x < KEYS; x++) atomic_init(&run.owner[x], -1);
+    run.keyed = strategy == ACTOR_POOL_HASH;
+
+    pool = spawn_actor_pool(worker_func, &run, (unsigned int)workers, strategy);
+    if (pool == NULL) {
+        fprintf(stderr, "%s: spawn_actor_pool() failed\n", strategy_names[strategy]);
+        failures++;
+        return;
+    }
+
+    /* Keyed sends for hashing; the others ignore the key, and plain sends go in between */
+    for (x = 0; x < requests; x++) {
+        if (run.keyed || x % 2 == 0)
+            actor_send_key_msg(pool, (unsigned long)(x % KEYS), REQUEST_MSG, &x, sizeof(x));
+        else
+            actor_send_msg(pool, REQUEST_MSG, &x, sizeof(x));
+    }
+    for (x = 0; x < requests; x++) arelease(actor_receive_type(DONE_MSG, 0));
+
+    /* Every actor but the pool itself gets the broadcast, this one too */
+    actor_broadcast_msg(STOP_MSG, NULL, 0);
+    arelease(actor_receive_type(STOP_MSG, 0));
+    arelease(actor_receive_type(ACTOR_MSG_EXITED, 0));
+
+    for (x = 0; x < requests; x++) {
+        if (atomic_load(&run.handled[x]) != 1) {
+            fprintf(stderr, "%s: request %ld handled %d times\n", strategy_names[strategy], x,
+                    atomic_load(&run.handled[x]));
+            ok = 0;
+        }
+    }
+    if (atomic_load(&run.started) != workers) {
+        fprintf(stderr, "%s: %d of %ld workers started\n", strategy_names[strategy], atomic_load(&run.started),
+                workers);
+        ok = 0;
+    }
+    if (strategy == ACTOR_POOL_ROUND_ROBIN) {
+        low = high = atomic_load(&run.share[0]);
+        for (x = 1; x < workers; x++) {
+            if (atomic_load(&run.share[x]) < low) low = atomic_load(&run.share[x]);
+            if (atomic_load(&run.share[x]) > high) high = atomic_load(&run.share[x]);
+        }
+        if (high - low > 1) {
+            fprintf(stderr, "%s: workers took between %ld and %ld requests\n", strategy_names[strategy], low, high);
+            ok = 0;
+        }
+    }
+
+    if (!ok) failures++;
+    printf("%-12s %s\n", strategy_names[strategy], ok ? "ok" : "FAILED");
+    free(run.handled);
+    free(run.share);
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    int strategy;
+
+    (void)args;
+    actor_trap_exit(1);
+    for (strategy = ACTOR_POOL_ROUND_ROBIN; strategy <= ACTOR_POOL_TWO_CHOICES; strategy++) run_pool(strategy);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scheduler") == 0)
+        actor_init_scheduler(0);
+    else
+        actor_init();
+    if (argc > 2) requests = atol(argv[2]);
+    if (argc > 3) workers = atol(argv[3]);
+
+    spawn_actor(tester_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+libactor - A C Actor Library
+priority_lanes.c
+
+Queues messages in every lane in a mixed order while the receiver waits,
+then checks that they are received highest lane first, exit
+notifications above all, and in the order they were sent within each
+lane. Then sends an urgent message while normal ones are still queued
+and checks that it is the next one received.
+
+usage: priority_lanes [threads|scheduler] [messages]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libactor/actor.h>
+
+enum { DATA_MSG = 100, NAP_MSG };
+
+static const int lanes[] = {ACTOR_PRIORITY_NORMAL, ACTOR_PRIORITY_HIGH, ACTOR_PRIORITY_NORMAL, ACTOR_PRIORITY_URGENT,
+                            ACTOR_PRIORITY_NORMAL, ACTOR_PRIORITY_HIGH, ACTOR_PRIORITY_NORMAL};
+#define PATTERN ((long)(sizeof(lanes) / sizeof(lanes[0])))
+
+static long messages = 7000;
+static atomic_int stage;
+static int failures;
+
+/* Sleeps without taking anything else from the mailbox, on a thread or a task */
+static void nap(long ms) {
+    arelease(actor_receive_type(NAP_MSG, ms));
+}
+
+static void wait_stage(int until) {
+    while (atomic_load(&stage) < until) nap(1);
+}
+
+ACTOR_FUNCTION(child_func, args) {
+    (void)args;
+    return 0;
+}
+
+/* The number of messages in `lane` that the tester sends first */
+static long lane_count(int lane) {
+    long x, count = 0;
+
+    for (x = 0; x < messages; x++) count += lanes[x % PATTERN] == lane;
+    return count;
+}
+
+ACTOR_FUNCTION(receiver_func, args) {
+    static const int order[] = {ACTOR_PRIORITY_URGENT, ACTOR_PRIORITY_HIGH, ACTOR_PRIORITY_NORMAL};
+    actor_msg_t *msg;
+    long seq, last, count, x;
+    size_t o;
+
+    (void)args;
+    actor_trap_exit(1);
+    spawn_actor(child_func, NULL);
+    wait_stage(1);
+    /* Time for the exit notification to arrive */
+    nap(50);
+
+    msg = actor_receive();
+    if (msg->type != ACTOR_MSG_EXITED) {
+        fprintf(stderr, "message %ld came before the exit notification\n", msg->type);
+        failures++;
+    }
+    arelease(msg);
+
+    for (o = 0; o < sizeof(order) / sizeof(order[0]); o++) {
+        count = lane_count(order[o]);
+        /* Keep back a few normal messages for the urgent one to overtake */
+        if (order[o] == ACTOR_PRIORITY_NORMAL) count -= 10;
+        for (x = 0, last = -1; x < count; x++) {
+            msg = actor_receive();
+            seq = *(const long *)msg->data;
+            if (lanes[seq % PATTERN] != order[o]) {
+                fprintf(stderr, "message %ld of lane %d came while lane %d had messages\n", seq, lanes[seq % PATTERN],
+                        order[o]);
+                failures++;
+            } else if (seq <= last) {
+                fprintf(stderr, "message %ld of lane %d came after %ld\n", seq, order[o], last);
+                failures++;
+            }
+            last = seq;
+            arelease(msg);
+        }
+    }
+
+    atomic_store(&stage, 2);
+    wait_stage(3);
+    msg = actor_receive();
+    if (*(const long *)msg->data != messages) {
+        fprintf(stderr, "message %ld came before the urgent one sent last\n", *(const long *)msg->data);
+        failures++;
+    }
+    arelease(msg);
+
+    /* The normal messages kept back */
+    for (x = 0; x < 10; x++) arelease(actor_receive());
+    if ((msg = actor_receive_timeout(10)) != NULL) {
+        fprintf(stderr, "an extra message %ld was received\n", msg->type);
+        failures++;
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    actor_id receiver = spawn_actor(receiver_func, NULL);
+    long x;
+
+    (void)args;
+    for (x = 0; x < messages; x++) actor_send_priority_msg(receiver, lanes[x % PATTERN], DATA_MSG, &x, sizeof(x));
+    atomic_store(&stage, 1);
+
+    wait_stage(2);
+    actor_send_priority_msg(receiver, ACTOR_PRIORITY_URGENT, DATA_MSG, &messages, sizeof(messages));
+    atomic_store(&stage, 3);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scheduler") == 0)
+        actor_init_scheduler(0);
+    else
+        actor_init();
+    if (argc > 2) messages = atol(argv[2]);
+
+    spawn_actor(tester_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("%ld messages received highest lane first, in order within each\n", messages);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+libactor - A C Actor Library
+selective_receive.c
+
+Takes messages out of the middle of a mailbox with actor_receive_type()
+and actor_receive_match(), and checks that each gets the oldest message
+it selects, highest lane first, that the messages left behind are then
+received in the order they were sent, including those that arrive after
+the mailbox was indexed, and that the predicate is called once per type
+waiting rather than once per message.
+
+usage: selective_receive [threads|scheduler]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libactor/actor.h>
+
+enum { A_MSG = 100, B_MSG, C_MSG, D_MSG, NAP_MSG };
+
+static atomic_int stage;
+static int failures;
+static int match_calls;
+
+/* Sleeps without taking anything else from the mailbox, on a thread or a task */
+static void nap(long ms) {
+    arelease(actor_receive_type(NAP_MSG, ms));
+}
+
+static void wait_stage(int until) {
+    while (atomic_load(&stage) < until) nap(1);
+}
+
+static int is_b(long type, void *arg) {
+    (void)arg;
+    match_calls++;
+    return type == B_MSG;
+}
+
+static int is_nothing(long type, void *arg) {
+    (void)arg;
+    (void)type;
+    return 0;
+}
+
+static void send(actor_id to, int lane, long type, long seq) {
+    actor_send_priority_msg(to, lane, type, &seq, sizeof(seq));
+}
+
+/* Checks that `msg` is message `seq` of `type`, and releases it */
+static void expect(const char *what, actor_msg_t *msg, long type, long seq) {
+    if (msg == NULL) {
+        fprintf(stderr, "%s: nothing received, expected %ld/%ld\n", what, type, seq);
+        failures++;
+        return;
+    }
+    if (msg->type != type || *(const long *)msg->data != seq) {
+        fprintf(stderr, "%s: received %ld/%ld, expected %ld/%ld\n", what, msg->type, *(const long *)msg->data, type,
+                seq);
+        failures++;
+    }
+    arelease(msg);
+}
+
+ACTOR_FUNCTION(receiver_func, args) {
+    actor_msg_t *msg;
+    int calls;
+
+    (void)args;
+    wait_stage(1);
+
+    /* A0 B1 A2 C3 B4 A5 in the normal lane, A6 in the high lane */
+    expect("by type", actor_receive_type(C_MSG, 0), C_MSG, 3);
+    expect("by type, highest lane first", actor_receive_type(A_MSG, 0), A_MSG, 6);
+    if ((msg = actor_receive_match(is_nothing, NULL, 10)) != NULL) {
+        fprintf(stderr, "a predicate that matches nothing received %ld\n", msg->type);
+        failures++;
+        arelease(msg);
+    }
+
+    /* More arrive once the mailbox is indexed: D7 A8 B9 */
+    atomic_store(&stage, 2);
+    wait_stage(3);
+
+    match_calls = 0;
+    expect("by predicate", actor_receive_match(is_b, NULL, 0), B_MSG, 1);
+    calls = match_calls;
+    if (calls > 3) {
+        fprintf(stderr, "the predicate was called %d times for 3 types waiting\n", calls);
+        failures++;
+    }
+
+    /* The rest come in the order they were sent */
+    expect("in order", actor_receive(), A_MSG, 0);
+    expect("in order", actor_receive(), A_MSG, 2);
+    expect("in order", actor_receive(), B_MSG, 4);
+    expect("in order", actor_receive(), A_MSG, 5);
+    expect("in order", actor_receive(), D_MSG, 7);
+    expect("in order", actor_receive(), A_MSG, 8);
+    expect("in order", actor_receive(), B_MSG, 9);
+    if ((msg = actor_receive_timeout(10)) != NULL) {
+        fprintf(stderr, "an extra message %ld was received\n", msg->type);
+        failures++;
+        arelease(msg);
+    }
+    return 0;
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    actor_id receiver = spawn_actor(receiver_func, NULL);
+
+    (void)args;
+    send(receiver, ACTOR_PRIORITY_NORMAL, A_MSG, 0);
+    send(receiver, ACTOR_PRIORITY_NORMAL, B_MSG, 1);
+    send(receiver, ACTOR_PRIORITY_NORMAL, A_MSG, 2);
+    send(receiver, ACTOR_PRIORITY_NORMAL, C_MSG, 3);
+    send(receiver, ACTOR_PRIORITY_NORMAL, B_MSG, 4);
+    send(receiver, ACTOR_PRIORITY_NORMAL, A_MSG, 5);
+    send(receiver, ACTOR_PRIORITY_HIGH, A_MSG, 6);
+    atomic_store(&stage, 1);
+
+    wait_stage(2);
+    send(receiver, ACTOR_PRIORITY_NORMAL, D_MSG, 7);
+    send(receiver, ACTOR_PRIORITY_NORMAL, A_MSG, 8);
+    send(receiver, ACTOR_PRIORITY_NORMAL, B_MSG, 9);
+    atomic_store(&stage, 3);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "scheduler") == 0)
+        actor_init_scheduler(0);
+    else
+        actor_init();
+
+    spawn_actor(tester_func, NULL);
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("selective receives left the rest in order\n");
+    return 0;
+}
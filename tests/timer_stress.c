@@ -0,0 +1,129 @@
+/*
+libactor - A C Actor Library
+timer_stress.c
+
+Arms timers due within 0 to 1 ms from several actors at once and cancels
+each after a random wait, so that cancels land before, during and after
+the timer fires. Checks that no message arrives from a timer once
+actor_cancel_timer() has returned 0 for it, and that each single-shot
+timer that could not be cancelled delivers exactly one message.
+
+usage: timer_stress [iterations] [actors]
+*/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libactor/actor.h>
+
+enum { TICK_MSG = 100 };
+enum { PENDING, CANCELLED, FIRED };
+
+static long iterations = 5000;
+static long actors = 4;
+static atomic_int failures;
+
+struct tester {
+    unsigned int seed;
+    unsigned char *state;   /* per timer */
+    unsigned char *interval;
+    unsigned int *received;
+};
+
+static void take(struct tester *t, actor_msg_t *msg) {
+    long seq;
+
+    memcpy(&seq, msg->data, sizeof(seq));
+    t->received[seq]++;
+    if (t->state[seq] == CANCELLED) {
+        fprintf(stderr, "timer %ld delivered after it was cancelled\n", seq);
+        failures++;
+    }
+    arelease(msg);
+}
+
+/* Takes what is already queued; only messages sent before the cancel returned can be among them */
+static void drain(struct tester *t) {
+    actor_msg_t *msg;
+
+    while ((msg = actor_receive_timeout(1)) != NULL) take(t, msg);
+}
+
+ACTOR_FUNCTION(tester_func, args) {
+    struct tester t;
+    struct timespec wait;
+    actor_timer_id tid;
+    long seq;
+
+    t.seed = (unsigned int)(size_t)args;
+    t.state = calloc(iterations, 1);
+    t.interval = calloc(iterations, 1);
+    t.received = calloc(iterations, sizeof(unsigned int));
+
+    for (seq = 0; seq < iterations; seq++) {
+        t.interval[seq] = rand_r(&t.seed) % 4 == 0;
+        if (t.interval[seq])
+            tid = actor_send_interval(actor_self(), 1, TICK_MSG, &seq, sizeof(seq));
+        else
+            tid = actor_send_after(actor_self(), rand_r(&t.seed) % 2, TICK_MSG, &seq, sizeof(seq));
+
+        wait.tv_sec = 0;
+        wait.tv_nsec = rand_r(&t.seed) % 2 == 0 ? 0 : (rand_r(&t.seed) % 1500) * 1000;
+        if (wait.tv_nsec > 0) nanosleep(&wait, NULL);
+
+        if (actor_cancel_timer(tid) == 0) {
+            drain(&t);
+            if (!t.interval[seq] && t.received[seq] > 0) {
+                fprintf(stderr, "timer %ld delivered and then cancelled\n", seq);
+                failures++;
+            }
+            t.state[seq] = CANCELLED;
+        } else if (t.interval[seq]) {
+            fprintf(stderr, "interval timer %ld could not be cancelled\n", seq);
+            failures++;
+        } else {
+            t.state[seq] = FIRED;
+        }
+    }
+
+    /* Everything still due is due within a millisecond or two */
+    drain(&t);
+    wait.tv_sec = 0;
+    wait.tv_nsec = 20000000;
+    nanosleep(&wait, NULL);
+    drain(&t);
+
+    for (seq = 0; seq < iterations; seq++) {
+        if (t.state[seq] == FIRED && t.received[seq] != 1) {
+            fprintf(stderr, "timer %ld delivered %u messages, not 1\n", seq, t.received[seq]);
+            failures++;
+        }
+    }
+
+    free(t.state);
+    free(t.interval);
+    free(t.received);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    long x;
+
+    if (argc > 1) iterations = atol(argv[1]);
+    if (argc > 2) actors = atol(argv[2]);
+
+    actor_init();
+    for (x = 0; x < actors; x++) spawn_actor(tester_func, (void *)(size_t)(x + 1));
+    actor_wait_finish();
+    actor_destroy_all();
+
+    if (failures > 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("%ld timers in each of %ld actors, no failures\n", iterations, actors);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/*
+libactor - A C Actor Library
+trace2json.c
+
+Converts a trace written by actor_trace_start() to the JSON trace event
+format read by chrome://tracing and Perfetto (ui.perfetto.dev). Each
+actor gets a track of its own, with a slice from its spawn to its exit,
+and each message is an arrow from its send to its receive. Events of
+threads that are not actors go on a track per thread.
+
+The events are sorted by their tick counts, which assumes the counters
+of the CPUs agree, as invariant TSCs and the Arm generic timer do.
+
+usage: actor_trace2json trace [output.json]
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+struct event {
+    struct actor_trace_event e;
+    uint32_t thread;
+};
+
+/* An actor's track, found by the address of its ID */
+struct track {
+    uint64_t actor; /* 0 if the entry is free */
+    int tid;
+    double spawned; /* microseconds, negative if the spawn was not traced */
+};
+
+static struct track *tracks;
+static size_t tracks_capacity;
+static size_t tracks_count;
+
+static uint64_t start_ticks;
+static double us_per_tick;
+
+static int compare(const void *a, const void *b) {
+    const struct event *x = (const struct event *)a, *y = (const struct event *)b;
+
+    if (x->e.ticks != y->e.ticks) return x->e.ticks < y->e.ticks ? -1 : 1;
+    return 0;
+}
+
+static double timestamp(uint64_t ticks) {
+    return ticks > start_ticks ? (ticks - start_ticks) * us_per_tick : 0;
+}
+
+static size_t track_probe(uint64_t actor) {
+    size_t x = (size_t)((actor * 0x9e3779b97f4a7c15ull) >> 16) & (tracks_capacity - 1);
+
+    while (tracks[x].actor != 0 && tracks[x].actor != actor) x = (x + 1) & (tracks_capacity - 1);
+    return x;
+}
+
+/* The track of `actor`, named in the output as it is first seen */
+static struct track *track(FILE *out, uint64_t actor) {
+    struct track *old = tracks, *t;
+    size_t x, capacity = tracks_capacity;
+
+    if ((tracks_count + 1) * 2 > tracks_capacity) {
+        tracks_capacity = capacity == 0 ? 1024 : capacity * 2;
+        if ((tracks = calloc(tracks_capacity, sizeof(struct track))) == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        for (x = 0; x < capacity; x++) {
+            if (old[x].actor != 0) tracks[track_probe(old[x].actor)] = old[x];
+        }
+        free(old);
+    }
+
+    t = &tracks[track_probe(actor)];
+    if (t->actor == 0) {
+        t->actor = actor;
+        t->tid = (int)++tracks_count;
+        t->spawned = -1;
+        fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                     "\"args\": {\"name\": \"actor 0x%" PRIx64 "\"}}", t->tid, actor);
+    }
+    return t;
+}
+
+/* Where an event goes: the actor's track, or the thread's for a thread that is not an actor */
+static void where(FILE *out, const struct event *ev, int *pid, int *tid) {
+    if (ev->e.actor != 0) {
+        *pid = 1;
+        *tid = track(out, ev->e.actor)->tid;
+    } else {
+        *pid = 2;
+        *tid = (int)ev->thread;
+    }
+}
+
+static void convert(FILE *out, struct event *events, size_t count, uint32_t threads) {
+    const struct event *ev;
+    struct track *t;
+    double ts;
+    int pid, tid;
+    size_t x;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"actors\"}},\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"other threads\"}}");
+    for (x = 0; x < threads; x++)
+        fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": %zu, "
+                     "\"args\": {\"name\": \"thread %zu\"}}", x, x);
+
+    for (x = 0; x < count; x++) {
+        ev = &events[x];
+        ts = timestamp(ev->e.ticks);
+        where(out, ev, &pid, &tid);
+
+        switch (ev->e.event) {
+            case ACTOR_TRACE_SPAWN:
+                track(out, ev->e.object)->spawned = ts;
+                fprintf(out, ",\n{\"name\": \"spawn\", \"cat\": \"actor\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                             "\"pid\": %d, \"tid\": %d, \"args\": {\"actor\": \"0x%" PRIx64 "\"}}",
+                        ts, pid, tid, ev->e.object);
+                break;
+            case ACTOR_TRACE_EXIT:
+                t = track(out, ev->e.actor);
+                if (t->spawned >= 0)
+                    fprintf(out, ",\n{\"name\": \"actor\", \"cat\": \"actor\", \"ph\": \"X\", \"ts\": %.3f, "
+                                 "\"dur\": %.3f, \"pid\": 1, \"tid\": %d}", t->spawned, ts - t->spawned, t->tid);
+                fprintf(out, ",\n{\"name\": \"exit\", \"cat\": \"actor\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                             "\"pid\": %d, \"tid\": %d}", ts, pid, tid);
+                break;
+            case ACTOR_TRACE_SEND:
+            case ACTOR_TRACE_RECEIVE:
+                /* A zero-length slice for the arrow to bind to */
+                fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"msg\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": 0, "
+                             "\"pid\": %d, \"tid\": %d, \"args\": {\"type\": %" PRIu32 ", \"msg\": \"0x%" PRIx64 "\"}}",
+                        ev->e.event == ACTOR_TRACE_SEND ? "send" : "receive", ts, pid, tid, ev->e.arg, ev->e.object);
+                fprintf(out, ",\n{\"name\": \"message\", \"cat\": \"msg\", \"ph\": \"%s\", \"bp\": \"e\", "
+                             "\"id\": \"0x%" PRIx64 "\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+                        ev->e.event == ACTOR_TRACE_SEND ? "s" : "f", ev->e.object, ts, pid, tid);
+                break;
+            case ACTOR_TRACE_AMALLOC:
+                fprintf(out, ",\n{\"name\": \"amalloc\", \"cat\": \"alloc\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                             "\"pid\": %d, \"tid\": %d, \"args\": {\"block\": \"0x%" PRIx64 "\", \"size\": %" PRIu32 "}}",
+                        ts, pid, tid, ev->e.object, ev->e.arg);
+                break;
+            case ACTOR_TRACE_ARELEASE:
+                fprintf(out, ",\n{\"name\": \"arelease\", \"cat\": \"alloc\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                             "\"pid\": %d, \"tid\": %d, \"args\": {\"block\": \"0x%" PRIx64 "\"}}",
+                        ts, pid, tid, ev->e.object);
+                break;
+            default:
+                break;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+}
+
+int main(int argc, char **argv) {
+    struct actor_trace_header header;
+    struct actor_trace_block block;
+    struct event *events = NULL, *grown;
+    size_t count = 0, capacity = 0, x;
+    uint32_t threads = 0;
+    FILE *in, *out = stdout;
+
+    if (argc < 2) {
+        printf("usage: %s trace [output.json]\n", argv[0]);
+        return 1;
+    }
+    if ((in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, ACTOR_TRACE_MAGIC, 8) != 0 ||
+        header.version != ACTOR_TRACE_VERSION || header.event_size != sizeof(struct actor_trace_event)) {
+        fprintf(stderr, "%s: not a libactor trace of version %d\n", argv[1], ACTOR_TRACE_VERSION);
+        return 1;
+    }
+
+    start_ticks = header.start_ticks;
+    if (header.end_ticks > header.start_ticks) {
+        us_per_tick = (double)(header.end_ns - header.start_ns) / (header.end_ticks - header.start_ticks) / 1e3;
+    } else {
+        fprintf(stderr, "%s: the trace was not stopped; assuming a tick is a nanosecond\n", argv[1]);
+        us_per_tick = 1e-3;
+    }
+
+    while (fread(&block, sizeof(block), 1, in) == 1) {
+        if (count + block.count > capacity) {
+            capacity = (count + block.count) * 2;
+            if ((grown = realloc(events, capacity * sizeof(struct event))) == NULL) {
+                fprintf(stderr, "Out of memory.\n");
+                return 1;
+            }
+            events = grown;
+        }
+        for (x = 0; x < block.count; x++, count++) {
+            if (fread(&events[count].e, sizeof(struct actor_trace_event), 1, in) != 1) {
+                fprintf(stderr, "%s: truncated\n", argv[1]);
+                break;
+            }
+            events[count].thread = block.thread;
+        }
+        if (block.thread >= threads) threads = block.thread + 1;
+        if (x < block.count) break;
+    }
+    fclose(in);
+
+    qsort(events, count, sizeof(struct event), compare);
+
+    if (argc > 2 && (out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    convert(out, events, count, threads);
+    if (out != stdout) fclose(out);
+
+    fprintf(stderr, "%zu events, %zu actors, %.3f ms\n", count, tracks_count,
+            count > 0 ? timestamp(events[count - 1].e.ticks) / 1e3 : 0.0);
+    free(events);
+    free(tracks);
+    return 0;
+}